@@ -6,6 +6,8 @@
         'cflags_cc!': [ '-fno-exceptions' ],
         "sources": [
             "cppsrc/jammer/main.cpp",
+            "cppsrc/jammer/server/JammerMixPool.cpp",
+            "cppsrc/jammer/server/JammerPacket.cpp",
             "cppsrc/jammer/server/JammerServer.cpp",
             "cppsrc/jammer/server/JammerServerWrapper.cpp",
         ],
@@ -48,6 +50,18 @@
         "sources": [
             "cppsrc/ov/main.cpp",
             "cppsrc/ov/server/ov-server.cpp",
+            "cppsrc/ov/server/batch-socket.cpp",
+            "cppsrc/ov/server/timer-wheel.cpp",
+            "cppsrc/ov/server/route-table.cpp",
+            "cppsrc/ov/server/latency-matrix.cpp",
+            "cppsrc/ov/server/participant-list.cpp",
+            "cppsrc/ov/server/sched-probe.cpp",
+            "cppsrc/ov/server/stage-metrics.cpp",
+            "cppsrc/ov/server/async-log.cpp",
+            "cppsrc/ov/server/send-queue.cpp",
+            "cppsrc/ov/server/capture-file.cpp",
+            "cppsrc/ov/server/downmix.cpp",
+            "cppsrc/ov/server/trunk.cpp",
             "cppsrc/ov/server/ov-server-wrapper.cpp",
         ],
         "cflags!": [ "-fno-exceptions" ],
@@ -117,6 +131,133 @@
             ['OS=="linux"', {
               'defines': [
                 'LINUX'
+              ],
+              'sources': [
+                "cppsrc/ov/server/stage-engine.cpp",
+                "cppsrc/ov/server/stage-engine-wrapper.cpp",
+                "cppsrc/ov/server/uring-socket.cpp"
+              ]
+            }]
+        ]
+    },
+    {
+        "target_name": "ov-relay-bench",
+        "type": "executable",
+        "sources": [
+            "cppsrc/ov/bench/ov-relay-bench.cpp",
+            "cppsrc/ov/server/ov-server.cpp",
+            "cppsrc/ov/server/batch-socket.cpp",
+            "cppsrc/ov/server/timer-wheel.cpp",
+            "cppsrc/ov/server/route-table.cpp",
+            "cppsrc/ov/server/latency-matrix.cpp",
+            "cppsrc/ov/server/participant-list.cpp",
+            "cppsrc/ov/server/sched-probe.cpp",
+            "cppsrc/ov/server/stage-metrics.cpp",
+            "cppsrc/ov/server/async-log.cpp",
+            "cppsrc/ov/server/send-queue.cpp",
+            "cppsrc/ov/server/capture-file.cpp",
+            "cppsrc/ov/server/downmix.cpp",
+            "cppsrc/ov/server/trunk.cpp",
+        ],
+        "cflags!": [ "-fno-exceptions" ],
+        "cflags_cc!": [ "-fno-exceptions" ],
+        "cflags_cc": [
+            "-Wall",
+            "-Wno-deprecated-declarations",
+            "-fno-finite-math-only",
+            "-std=c++11",
+            "-pthread",
+            "-O2"
+          ],
+        'include_dirs': [
+            "<!(pwd)/libov/src"
+        ],
+        'libraries': [
+            "-lcurl",
+            "-ldl",
+            "-lpthread",
+             "<!(pwd)/libov/build/libov.a"
+        ],
+        'defines': [
+            'OVBOXVERSION="0.3"'
+         ],
+        'conditions': [
+            ['OS=="mac"', {
+              'xcode_settings': {
+                'GCC_ENABLE_CPP_EXCEPTIONS': 'YES'
+              },
+              'defines': [
+                'OSX'
+              ]
+            }],
+            ['OS=="linux"', {
+              'defines': [
+                'LINUX'
+              ],
+              'sources': [
+                "cppsrc/ov/server/stage-engine.cpp",
+                "cppsrc/ov/server/uring-socket.cpp"
+              ]
+            }]
+        ]
+    },
+    {
+        "target_name": "ov-replay",
+        "type": "executable",
+        "sources": [
+            "cppsrc/ov/bench/ov-replay.cpp",
+            "cppsrc/ov/server/ov-server.cpp",
+            "cppsrc/ov/server/batch-socket.cpp",
+            "cppsrc/ov/server/timer-wheel.cpp",
+            "cppsrc/ov/server/route-table.cpp",
+            "cppsrc/ov/server/latency-matrix.cpp",
+            "cppsrc/ov/server/participant-list.cpp",
+            "cppsrc/ov/server/sched-probe.cpp",
+            "cppsrc/ov/server/stage-metrics.cpp",
+            "cppsrc/ov/server/async-log.cpp",
+            "cppsrc/ov/server/send-queue.cpp",
+            "cppsrc/ov/server/capture-file.cpp",
+            "cppsrc/ov/server/downmix.cpp",
+            "cppsrc/ov/server/trunk.cpp",
+        ],
+        "cflags!": [ "-fno-exceptions" ],
+        "cflags_cc!": [ "-fno-exceptions" ],
+        "cflags_cc": [
+            "-Wall",
+            "-Wno-deprecated-declarations",
+            "-fno-finite-math-only",
+            "-std=c++11",
+            "-pthread",
+            "-O2"
+          ],
+        'include_dirs': [
+            "<!(pwd)/libov/src"
+        ],
+        'libraries': [
+            "-lcurl",
+            "-ldl",
+            "-lpthread",
+             "<!(pwd)/libov/build/libov.a"
+        ],
+        'defines': [
+            'OVBOXVERSION="0.3"'
+         ],
+        'conditions': [
+            ['OS=="mac"', {
+              'xcode_settings': {
+                'GCC_ENABLE_CPP_EXCEPTIONS': 'YES'
+              },
+              'defines': [
+                'OSX'
+              ]
+            }],
+            ['OS=="linux"', {
+              'defines': [
+                'LINUX'
+              ],
+              'sources': [
+                "cppsrc/ov/server/stage-engine.cpp",
+                "cppsrc/ov/server/uring-socket.cpp"
               ]
             }]
         ]
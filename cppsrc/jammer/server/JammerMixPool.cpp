@@ -0,0 +1,165 @@
+#include "JammerMixPool.h"
+
+#include <algorithm>
+
+namespace {
+
+	uint64_t makeRange(uint32_t next, uint32_t end) {
+		return ((uint64_t) end << 32) | next;
+	}
+
+}
+
+JammerMixPool::Batch::Batch(std::shared_ptr<JammerMixPool> pool, int jobs, std::function<void(int)> job) :
+	pool_(pool), job_(job), ranges_(new Range[pool->threads() + 1]),
+	finished_(new std::atomic<uint32_t>[std::max(1, jobs)]), generation_(0), remaining_(0), running_(0)
+{
+	for (int i = 0; i <= pool_->threads(); i++) {
+		ranges_[i].range.store(0, std::memory_order_relaxed);
+	}
+	for (int i = 0; i < std::max(1, jobs); i++) {
+		finished_[i].store(0, std::memory_order_relaxed);
+	}
+	pool_->attach(this);
+}
+
+JammerMixPool::Batch::~Batch() {
+	// No thread picks the batch after detach, wait for the ones which did
+	pool_->detach(this);
+	while (busy()) {
+		std::this_thread::yield();
+	}
+}
+
+void JammerMixPool::Batch::run(int count, std::chrono::steady_clock::time_point deadline) {
+	int parts = pool_->threads() + 1;
+	remaining_.store(count, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(pool_->mutex_);
+		// Zero is the initial value of the finished marks
+		uint32_t generation = generation_.load(std::memory_order_relaxed) + 1;
+		generation_.store(generation ? generation : 1, std::memory_order_release);
+		for (int i = 0; i < parts; i++) {
+			ranges_[i].range.store(makeRange(count * i / parts, count * (i + 1) / parts), std::memory_order_release);
+		}
+	}
+	pool_->condition_.notify_all();
+	while (remaining_.load(std::memory_order_acquire) > 0 && std::chrono::steady_clock::now() < deadline) {
+		if (!runOne(0)) {
+			// The remaining jobs are running on other threads
+			std::this_thread::yield();
+		}
+	}
+	// Skip the jobs which did not start in time
+	for (int i = 0; i < parts; i++) {
+		ranges_[i].range.store(0, std::memory_order_release);
+	}
+}
+
+bool JammerMixPool::Batch::pending() const {
+	for (int i = 0; i <= pool_->threads(); i++) {
+		uint64_t range = ranges_[i].range.load(std::memory_order_acquire);
+		if ((uint32_t) range < (uint32_t) (range >> 32)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool JammerMixPool::Batch::runOne(int self) {
+	int parts = pool_->threads() + 1;
+	for (int i = 0; i < parts; i++) {
+		// Own range first, then steal from the others
+		Range& r = ranges_[(self + i) % parts];
+		uint64_t range = r.range.load(std::memory_order_acquire);
+		while (true) {
+			uint32_t next = (uint32_t) range;
+			uint32_t end = (uint32_t) (range >> 32);
+			if (next >= end) {
+				break;
+			}
+			if (r.range.compare_exchange_weak(range, makeRange(next + 1, end), std::memory_order_acq_rel)) {
+				uint32_t generation = generation_.load(std::memory_order_acquire);
+				job_(next);
+				finished_[next].store(generation, std::memory_order_release);
+				remaining_.fetch_sub(1, std::memory_order_acq_rel);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+JammerMixPool::JammerMixPool(int threads) : quit_(false) {
+	for (int i = 0; i < threads; i++) {
+		threads_.push_back(std::thread(&JammerMixPool::workerThread, this, i + 1));
+	}
+}
+
+JammerMixPool::~JammerMixPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		quit_ = true;
+	}
+	condition_.notify_all();
+	for (auto& thread : threads_) {
+		thread.join();
+	}
+}
+
+int JammerMixPool::defaultThreads() {
+	return std::max(1, (int) std::thread::hardware_concurrency()) - 1;
+}
+
+std::shared_ptr<JammerMixPool> JammerMixPool::shared(int threads) {
+	static std::mutex mutex;
+	static std::weak_ptr<JammerMixPool> pool;
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<JammerMixPool> result = pool.lock();
+	if (!result) {
+		result = std::make_shared<JammerMixPool>(threads < 0 ? defaultThreads() : threads);
+		pool = result;
+	}
+	return result;
+}
+
+void JammerMixPool::attach(Batch* batch) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	batches_.push_back(batch);
+}
+
+void JammerMixPool::detach(Batch* batch) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	batches_.erase(std::remove(batches_.begin(), batches_.end(), batch), batches_.end());
+}
+
+void JammerMixPool::workerThread(int index) {
+	while (true) {
+		Batch* batch = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			condition_.wait(lock, [&] {
+				if (quit_) {
+					return true;
+				}
+				// Start the search at a different batch on each thread, so the threads spread over the servers
+				for (size_t i = 0; i < batches_.size(); i++) {
+					Batch* b = batches_[(index + i) % batches_.size()];
+					if (b->pending()) {
+						batch = b;
+						return true;
+					}
+				}
+				return false;
+			});
+			if (quit_) {
+				return;
+			}
+			// Taken under the lock, so the batch is not deleted while this thread works on it
+			batch->running_.fetch_add(1, std::memory_order_acq_rel);
+		}
+		while (batch->runOne(index)) {
+		}
+		batch->running_.fetch_sub(1, std::memory_order_release);
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef JAMMER_MIX_POOL_H
+#define JAMMER_MIX_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing pool for the per client jobs of the audio periods, one per process and shared by all servers (see
+// shared()). The jobs of one period form a batch. run() splits the jobs of a batch into one range per thread, each
+// thread works through its own range and then steals from the ranges of the others, so a slow or preempted thread
+// holds back at most the job it is running. The calling thread works on its batch, too.
+//
+// Jobs which did not start by the deadline of the period are skipped, the caller checks finished() for each job and
+// falls back for the others. A job which is still running at the deadline completes in the background, the inputs of
+// the batch must not change while busy() is true. A caller which alternates between two batches does not wait for
+// the late jobs of the last period.
+class JammerMixPool {
+public:
+	class Batch {
+	public:
+		// jobs: maximum number of jobs per run
+		Batch(std::shared_ptr<JammerMixPool> pool, int jobs, std::function<void(int)> job);
+		// Waits until the late jobs have returned
+		~Batch();
+
+		// Run jobs 0 ... count - 1, returns when all are finished or at the deadline
+		void run(int count, std::chrono::steady_clock::time_point deadline);
+
+		// Did the job finish within the last run?
+		bool finished(int job) const {
+			return finished_[job].load(std::memory_order_acquire) == generation_.load(std::memory_order_relaxed);
+		}
+
+		// Are jobs of the last run still running on the pool?
+		bool busy() const {
+			return running_.load(std::memory_order_acquire) > 0;
+		}
+
+	private:
+		friend class JammerMixPool;
+
+		// Unclaimed jobs of one thread, next in the low and end in the high half, so that claiming and replacing the
+		// range are single atomic operations
+		struct Range {
+			std::atomic<uint64_t> range;
+			// Ranges on separate cache lines
+			char padding[64 - sizeof(std::atomic<uint64_t>)];
+		};
+
+		bool runOne(int self);
+		bool pending() const;
+
+		std::shared_ptr<JammerMixPool> pool_;
+		std::function<void(int)> job_;
+		std::unique_ptr<Range[]> ranges_;
+		std::unique_ptr<std::atomic<uint32_t>[]> finished_;
+		std::atomic<uint32_t> generation_;
+		// Jobs of the current run which did not finish yet
+		std::atomic<int> remaining_;
+		// Pool threads which may be claiming or running a job of this batch
+		std::atomic<int> running_;
+	};
+
+	// threads: workers in addition to the calling threads
+	explicit JammerMixPool(int threads);
+	~JammerMixPool();
+
+	int threads() const {
+		return (int) threads_.size();
+	}
+
+	// Number of threads for this machine: one per core besides the calling thread
+	static int defaultThreads();
+
+	// The pool of the process. The first call creates it with threads workers, negative for defaultThreads(), later
+	// calls share it while any batch holds it.
+	static std::shared_ptr<JammerMixPool> shared(int threads);
+
+private:
+	void workerThread(int index);
+	void attach(Batch* batch);
+	void detach(Batch* batch);
+
+	std::vector<std::thread> threads_;
+	// Batches of all servers, guarded by mutex_
+	std::vector<Batch*> batches_;
+	std::mutex mutex_;
+	std::condition_variable condition_;
+	bool quit_;
+};
+
+#endif // JAMMER_MIX_POOL_H
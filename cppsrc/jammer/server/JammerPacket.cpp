@@ -0,0 +1,104 @@
+#include "JammerPacket.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+
+	struct Header {
+		uint32_t magic;
+		uint32_t sequence;
+		uint16_t channels;
+		uint16_t frames;
+		uint32_t sampleRate;
+	};
+
+	static_assert(sizeof(Header) == JAMMER_HEADER_SIZE, "unexpected header layout");
+
+	bool parseHeader(const char *data, size_t length, Header &header) {
+		if (length < sizeof(Header)) {
+			return false;
+		}
+		memcpy(&header, data, sizeof(header));
+		if (header.magic != JAMMER_MAGIC || header.sampleRate != JAMMER_SAMPLE_RATE || header.channels == 0
+			|| header.channels > JAMMER_MAX_CHANNELS || header.frames != JAMMER_BLOCK_FRAMES) {
+			return false;
+		}
+		return length >= sizeof(Header) + (size_t) header.channels * header.frames * sizeof(int16_t) + JAMMER_TAG_SIZE;
+	}
+
+	void sign(const char *data, size_t length, const std::string &key, unsigned char tag[EVP_MAX_MD_SIZE]) {
+		unsigned int tagLength = 0;
+		HMAC(EVP_sha256(), key.data(), (int) key.size(), (const unsigned char *) data, length, tag, &tagLength);
+	}
+
+}
+
+bool verifyAudioBlock(const char *data, size_t length, const std::string &key, uint32_t &sequence) {
+	Header header;
+	if (!parseHeader(data, length, header)) {
+		return false;
+	}
+	size_t signedLength = sizeof(Header) + (size_t) header.channels * header.frames * sizeof(int16_t);
+	unsigned char tag[EVP_MAX_MD_SIZE];
+	sign(data, signedLength, key, tag);
+	if (CRYPTO_memcmp(tag, data + signedLength, JAMMER_TAG_SIZE) != 0) {
+		return false;
+	}
+	sequence = header.sequence;
+	return true;
+}
+
+bool parseAudioBlock(const char *data, size_t length, AudioBlock &block) {
+	Header header;
+	if (!parseHeader(data, length, header)) {
+		return false;
+	}
+	size_t samples = (size_t) header.channels * header.frames;
+	block.sequence = header.sequence;
+	block.channels = header.channels;
+	block.frames = header.frames;
+	const char *p = data + sizeof(Header);
+	for (size_t i = 0; i < samples; i++) {
+		int16_t s;
+		memcpy(&s, p + i * sizeof(s), sizeof(s));
+		block.samples[i] = s * (1.0f / 32768.0f);
+	}
+	return true;
+}
+
+size_t serializeMix(const float mix[JAMMER_MIX_CHANNELS][JAMMER_BLOCK_FRAMES], uint32_t sequence,
+					const std::string &key, char *data) {
+	Header header;
+	header.magic = JAMMER_MAGIC;
+	header.sequence = sequence;
+	header.channels = JAMMER_MIX_CHANNELS;
+	header.frames = JAMMER_BLOCK_FRAMES;
+	header.sampleRate = JAMMER_SAMPLE_RATE;
+	memcpy(data, &header, sizeof(header));
+	char *p = data + sizeof(Header);
+	for (int f = 0; f < JAMMER_BLOCK_FRAMES; f++) {
+		for (int c = 0; c < JAMMER_MIX_CHANNELS; c++) {
+			int16_t s = (int16_t) lrintf(std::min(1.0f, std::max(-1.0f, mix[c][f])) * 32767.0f);
+			memcpy(p, &s, sizeof(s));
+			p += sizeof(s);
+		}
+	}
+	unsigned char tag[EVP_MAX_MD_SIZE];
+	sign(data, p - data, key, tag);
+	memcpy(p, tag, JAMMER_TAG_SIZE);
+	return p - data + JAMMER_TAG_SIZE;
+}
+
+void setMixSequence(char *data, size_t length, uint32_t sequence, const std::string &key) {
+	memcpy(data + offsetof(Header, sequence), &sequence, sizeof(sequence));
+	unsigned char tag[EVP_MAX_MD_SIZE];
+	sign(data, length - JAMMER_TAG_SIZE, key, tag);
+	memcpy(data + length - JAMMER_TAG_SIZE, tag, JAMMER_TAG_SIZE);
+}
@@ -0,0 +1,48 @@
+#ifndef JAMMER_PACKET_H
+#define JAMMER_PACKET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Wire format of the native Jammer server. Each datagram carries one block of interleaved 16 bit samples:
+//
+//   uint32 magic, uint32 sequence, uint16 channels, uint16 frames, uint32 sample rate, int16 samples[], uint8 tag[16]
+//
+// The tag is HMAC-SHA256 over everything before it, keyed with the crypto key of the stage and truncated to
+// JAMMER_TAG_SIZE bytes. Clients send blocks of any channel count up to JAMMER_MAX_CHANNELS, the server sends the
+// stereo mix of all clients in the same format.
+const uint32_t JAMMER_MAGIC = 0x415a4e4a; // "JNZA"
+const int JAMMER_SAMPLE_RATE = 48000;
+const int JAMMER_BLOCK_FRAMES = 128;
+const int JAMMER_MAX_CHANNELS = 8;
+const int JAMMER_MIX_CHANNELS = 2;
+const size_t JAMMER_HEADER_SIZE = 16;
+const size_t JAMMER_TAG_SIZE = 16;
+const size_t JAMMER_MAX_DATAGRAM = JAMMER_HEADER_SIZE + JAMMER_MAX_CHANNELS * JAMMER_BLOCK_FRAMES * sizeof(int16_t)
+								   + JAMMER_TAG_SIZE;
+const size_t JAMMER_MIX_DATAGRAM = JAMMER_HEADER_SIZE + JAMMER_MIX_CHANNELS * JAMMER_BLOCK_FRAMES * sizeof(int16_t)
+								   + JAMMER_TAG_SIZE;
+
+// One received block, already converted to float
+struct AudioBlock {
+	uint32_t sequence;
+	uint16_t channels;
+	uint16_t frames;
+	float samples[JAMMER_MAX_CHANNELS * JAMMER_BLOCK_FRAMES];
+};
+
+// Check the header and the tag of a datagram, before it is looked at any further. Returns the sequence number
+bool verifyAudioBlock(const char *data, size_t length, const std::string &key, uint32_t &sequence);
+
+// Parse a verified datagram, writes the samples into the preallocated block
+bool parseAudioBlock(const char *data, size_t length, AudioBlock &block);
+
+// Serialize and sign a planar mix, with clipping. Returns the datagram size
+size_t serializeMix(const float mix[JAMMER_MIX_CHANNELS][JAMMER_BLOCK_FRAMES], uint32_t sequence,
+					const std::string &key, char *data);
+
+// Replace the sequence number of a serialized mix and sign it again
+void setMixSequence(char *data, size_t length, uint32_t sequence, const std::string &key);
+
+#endif // JAMMER_PACKET_H
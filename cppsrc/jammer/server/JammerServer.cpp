@@ -1,32 +1,398 @@
 #include "JammerServer.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 
-static bool quit_jammer(false);
+namespace {
 
-JammerServer::JammerServer(const std::string& cryptoKey, int port, int buffer, int wait, int prefill, const std::string& stageId) : stageId_(stageId), port_(port), buffer_(buffer), wait_(wait), prefill_(prefill) // Setup standard mix down setup - two channels only in stereo
-	{
-	    // Init jammer server
+	int64_t nowMs() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	bool sameAddress(const sockaddr_in& a, const sockaddr_in& b) {
+		return a.sin_port == b.sin_port && a.sin_addr.s_addr == b.sin_addr.s_addr;
+	}
+
+}
 
-	    // Then start jammer inside worker thread
-	    std::cout << "Buffer: " << buffer_ << std::endl;
-	    std::cout << "Prefill: " << prefill_ << std::endl;
-	    std::cout << "Wait: " << wait_ << std::endl;
-        workerThread_ = std::thread(&JammerServer::start, this);
+JammerServer::JammerServer(const std::string& cryptoKey, int port, int buffer, int wait, int prefill, const std::string& stageId,
+						   int mixThreads) :
+	cryptoKey_(cryptoKey), stageId_(stageId), port_(port), buffer_(std::max(1, buffer)), wait_(std::max(0, wait)),
+	prefill_(std::min(std::max(1, prefill), std::max(1, buffer))), socket_(-1), quit_(false), running_(false),
+	sendQueue_(JAMMER_MAX_CLIENTS * JAMMER_SEND_BLOCKS), mixSequence_(0), mixedPeriods_(0), missedMixes_(0),
+	reportedMisses_(0)
+{
+	if (cryptoKey_.empty()) {
+		throw std::runtime_error("Crypto key must not be empty");
 	}
+	for (auto& client : clients_) {
+		client.state = FREE;
+		client.lastSeen = 0;
+		client.lastSequence = 0;
+		client.prefilling = true;
+		client.jitterBuffer.reset(new LockFreeRing<AudioBlock>(buffer_));
+		client.encodedLength[0] = client.encodedLength[1] = client.encodedLength[2] = 0;
+		client.goodMix = 0;
+		client.jobMix = 0;
+		client.hasMix = false;
+	}
+	std::shared_ptr<JammerMixPool> mixPool = JammerMixPool::shared(mixThreads);
+	for (auto& period : periods_) {
+		MixPeriod* p = &period;
+		period.batch.reset(new JammerMixPool::Batch(mixPool, JAMMER_MAX_CLIENTS, [this, p](int job) { mixJob(*p, job); }));
+	}
+
+	socket_ = ::socket(AF_INET, SOCK_DGRAM, 0);
+	if (socket_ < 0) {
+		throw std::runtime_error(std::string("Unable to create socket: ") + strerror(errno));
+	}
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port_);
+	if (bind(socket_, (sockaddr*) &address, sizeof(address)) < 0) {
+		int err = errno;
+		close(socket_);
+		throw std::runtime_error("Unable to bind port " + std::to_string(port_) + ": " + strerror(err));
+	}
+	// The receive thread checks for shutdown and client timeouts at least this often
+	timeval timeout = { 0, 100000 };
+	setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	std::cout << "Buffer: " << buffer_ << std::endl;
+	std::cout << "Prefill: " << prefill_ << std::endl;
+	std::cout << "Wait: " << wait_ << std::endl;
+	std::cout << "Mix threads: " << mixPool->threads() << std::endl;
+}
 
 JammerServer::~JammerServer() {
+	stop();
 }
 
 void JammerServer::start() {
-    // Start jammer server
-    // Inform node about successful start
-    this->on_ready(port_);
-    while (!quit_jammer) {
-        std::this_thread::sleep_for(std::chrono::microseconds(2000));
-    }
+	if (running_.exchange(true)) {
+		return;
+	}
+	receiveThread_ = std::thread(&JammerServer::receiveThread, this);
+	mixerThread_ = std::thread(&JammerServer::mixerThread, this);
+	sendThread_ = std::thread(&JammerServer::sendThread, this);
+	// Inform node about successful start
+	if (on_ready) {
+		on_ready(port_);
+	}
 }
 
-
 void JammerServer::stop() {
-    quit_jammer = true;
-}
\ No newline at end of file
+	if (quit_.exchange(true)) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(sendMutex_);
+	}
+	sendCondition_.notify_one();
+	for (auto thread : { &receiveThread_, &mixerThread_, &sendThread_ }) {
+		if (thread->joinable()) {
+			thread->join();
+		}
+	}
+	// Free the port and the mix pool right away, the owner may keep the stopped server for a while
+	close(socket_);
+	socket_ = -1;
+	for (auto& period : periods_) {
+		period.batch.reset();
+	}
+}
+
+JammerServer::ClientSlot* JammerServer::findClient(const sockaddr_in& address) {
+	for (auto& client : clients_) {
+		if (client.state.load(std::memory_order_relaxed) == ACTIVE && sameAddress(client.address, address)) {
+			return &client;
+		}
+	}
+	return nullptr;
+}
+
+JammerServer::ClientSlot* JammerServer::claimClient(const sockaddr_in& address, int64_t now) {
+	for (auto& client : clients_) {
+		if (client.state.load(std::memory_order_acquire) == FREE) {
+			client.address = address;
+			client.lastSeen = now;
+			client.state.store(ACTIVE, std::memory_order_release);
+			char host[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+			std::cout << "New client " << host << ":" << ntohs(address.sin_port) << std::endl;
+			return &client;
+		}
+	}
+	return nullptr;
+}
+
+void JammerServer::expireClients(int64_t now) {
+	for (auto& client : clients_) {
+		if (client.state.load(std::memory_order_relaxed) == ACTIVE && now - client.lastSeen > JAMMER_CLIENT_TIMEOUT_MS) {
+			client.state.store(CLOSING, std::memory_order_release);
+		}
+	}
+}
+
+void JammerServer::receiveThread() {
+	char datagram[JAMMER_MAX_DATAGRAM];
+	int64_t lastExpire = nowMs();
+	int64_t lastMissReport = lastExpire;
+	while (!quit_) {
+		sockaddr_in from;
+		socklen_t fromLength = sizeof(from);
+		ssize_t length = recvfrom(socket_, datagram, sizeof(datagram), 0, (sockaddr*) &from, &fromLength);
+		int64_t now = nowMs();
+		if (now - lastExpire >= 100) {
+			expireClients(now);
+			lastExpire = now;
+		}
+		if (now - lastMissReport >= JAMMER_MISS_REPORT_MS) {
+			// The mixer thread only counts, so it never blocks on the console
+			uint64_t missed = missedMixes_.load(std::memory_order_relaxed);
+			if (missed != reportedMisses_) {
+				std::cout << missed - reportedMisses_ << " mixes missed their period, previous mix sent" << std::endl;
+				reportedMisses_ = missed;
+			}
+			lastMissReport = now;
+		}
+		if (length <= 0 || from.sin_family != AF_INET) {
+			continue;
+		}
+		uint32_t sequence;
+		if (!verifyAudioBlock(datagram, length, cryptoKey_, sequence)) {
+			continue;
+		}
+		ClientSlot* client = findClient(from);
+		bool isNew = false;
+		if (!client) {
+			if (!(client = claimClient(from, now))) {
+				continue;
+			}
+			isNew = true;
+		}
+		// Drop duplicates and reordered blocks which were already replaced, unless the client restarted its stream
+		int32_t step = (int32_t) (sequence - client->lastSequence);
+		if (!isNew && step <= 0 && step > -JAMMER_SEQUENCE_WINDOW) {
+			continue;
+		}
+		client->lastSeen = now;
+		client->lastSequence = sequence;
+		// The block is decoded in place, a full jitter buffer drops the newest block
+		AudioBlock* block = client->jitterBuffer->writeSlot();
+		if (!block || !parseAudioBlock(datagram, length, *block)) {
+			continue;
+		}
+		client->jitterBuffer->commitWrite();
+	}
+}
+
+bool JammerServer::mixReady(std::chrono::steady_clock::time_point deadline) {
+	while (true) {
+		bool ready = true;
+		for (auto& client : clients_) {
+			if (client.state.load(std::memory_order_acquire) == ACTIVE && !client.prefilling && client.jitterBuffer->size() == 0) {
+				ready = false;
+				break;
+			}
+		}
+		if (ready || quit_ || std::chrono::steady_clock::now() >= deadline) {
+			return ready;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+}
+
+void JammerServer::mixerThread() {
+	const std::chrono::nanoseconds period(1000000000LL * JAMMER_BLOCK_FRAMES / JAMMER_SAMPLE_RATE);
+	const std::chrono::nanoseconds waitTime = std::min<std::chrono::nanoseconds>(std::chrono::milliseconds(wait_), period);
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	while (!quit_) {
+		next += period;
+		std::this_thread::sleep_until(next);
+		// Do not try to catch up after a stall, the period starts now
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now - next > period) {
+			next = now;
+		}
+		// Give late clients up to wait ms before mixing without them
+		mixReady(next + waitTime);
+		// The mix jobs may take the rest of the period, however long the wait was
+		mix(next + period);
+	}
+}
+
+void JammerServer::mix(std::chrono::steady_clock::time_point deadline) {
+	MixPeriod& period = periods_[mixedPeriods_ & 1];
+	uint64_t missed = 0;
+	if (period.batch->busy()) {
+		// Late jobs of the period before the last one still read these sums, all clients get their previous mix
+		for (auto& client : clients_) {
+			if (client.state.load(std::memory_order_acquire) == ACTIVE) {
+				sendMix(client, false);
+				missed++;
+			}
+		}
+		missedMixes_.store(missedMixes_.load(std::memory_order_relaxed) + missed, std::memory_order_relaxed);
+		mixSequence_++;
+		{
+			std::lock_guard<std::mutex> lock(sendMutex_);
+		}
+		sendCondition_.notify_one();
+		return;
+	}
+	memset(period.total, 0, sizeof(period.total));
+	bool any = false;
+	for (int i = 0; i < JAMMER_MAX_CLIENTS; i++) {
+		ClientSlot& client = clients_[i];
+		period.contributing[i] = false;
+		int state = client.state.load(std::memory_order_acquire);
+		if (state == CLOSING) {
+			client.jitterBuffer->clear();
+			client.prefilling = true;
+			client.hasMix = false;
+			client.state.store(FREE, std::memory_order_release);
+			continue;
+		}
+		if (state != ACTIVE) {
+			continue;
+		}
+		any = true;
+		LockFreeRing<AudioBlock>& ring = *client.jitterBuffer;
+		if (client.prefilling) {
+			if (ring.size() < (size_t) prefill_) {
+				continue;
+			}
+			client.prefilling = false;
+		}
+		const AudioBlock* block = ring.readSlot();
+		if (!block) {
+			// Underrun, rebuild the jitter buffer
+			client.prefilling = true;
+			continue;
+		}
+		float (&own)[JAMMER_MIX_CHANNELS][JAMMER_BLOCK_FRAMES] = period.own[i];
+		memset(own, 0, sizeof(own));
+		const float* samples = block->samples;
+		for (int f = 0; f < JAMMER_BLOCK_FRAMES; f++) {
+			if (block->channels == 1) {
+				for (int c = 0; c < JAMMER_MIX_CHANNELS; c++) {
+					own[c][f] = samples[f];
+				}
+			}
+			else {
+				for (int c = 0; c < block->channels; c++) {
+					own[c % JAMMER_MIX_CHANNELS][f] += samples[f * block->channels + c];
+				}
+			}
+		}
+		ring.commitRead();
+		for (int c = 0; c < JAMMER_MIX_CHANNELS; c++) {
+			for (int f = 0; f < JAMMER_BLOCK_FRAMES; f++) {
+				period.total[c][f] += own[c][f];
+			}
+		}
+		period.contributing[i] = true;
+	}
+	if (!any) {
+		return;
+	}
+	// Each client receives the total minus its own signal, mixed and encoded by the pool. A job writes neither the
+	// good mix nor the one a late job of the last period may still write, the jobs of the period before have returned.
+	int jobs = 0;
+	for (int i = 0; i < JAMMER_MAX_CLIENTS; i++) {
+		ClientSlot& client = clients_[i];
+		if (client.state.load(std::memory_order_acquire) == ACTIVE) {
+			int slot = 0;
+			while (slot == client.goodMix || slot == client.jobMix) {
+				slot++;
+			}
+			client.jobMix = slot;
+			period.clients[jobs] = i;
+			period.mixes[jobs] = slot;
+			jobs++;
+		}
+	}
+	period.sequence = mixSequence_;
+	period.batch->run(jobs, deadline);
+	mixedPeriods_++;
+	for (int job = 0; job < jobs; job++) {
+		ClientSlot& client = clients_[period.clients[job]];
+		bool fresh = period.batch->finished(job);
+		if (fresh) {
+			client.goodMix = period.mixes[job];
+			client.hasMix = true;
+		}
+		else {
+			missed++;
+		}
+		sendMix(client, fresh);
+	}
+	mixSequence_++;
+	if (missed) {
+		missedMixes_.store(missedMixes_.load(std::memory_order_relaxed) + missed, std::memory_order_relaxed);
+	}
+	{
+		std::lock_guard<std::mutex> lock(sendMutex_);
+	}
+	sendCondition_.notify_one();
+}
+
+void JammerServer::sendMix(ClientSlot& client, bool fresh) {
+	if (!fresh) {
+		if (!client.hasMix) {
+			return;
+		}
+		// The previous mix goes out again with the sequence of this period
+		setMixSequence(client.encoded[client.goodMix], client.encodedLength[client.goodMix], mixSequence_, cryptoKey_);
+	}
+	MixPacket* packet = sendQueue_.writeSlot();
+	if (!packet) {
+		return;
+	}
+	packet->recipient = client.address;
+	packet->length = client.encodedLength[client.goodMix];
+	memcpy(packet->data, client.encoded[client.goodMix], packet->length);
+	sendQueue_.commitWrite();
+}
+
+void JammerServer::mixJob(MixPeriod& period, int job) {
+	int i = period.clients[job];
+	ClientSlot& client = clients_[i];
+	float mix[JAMMER_MIX_CHANNELS][JAMMER_BLOCK_FRAMES];
+	const float (*source)[JAMMER_BLOCK_FRAMES] = period.total;
+	if (period.contributing[i]) {
+		for (int c = 0; c < JAMMER_MIX_CHANNELS; c++) {
+			for (int f = 0; f < JAMMER_BLOCK_FRAMES; f++) {
+				mix[c][f] = period.total[c][f] - period.own[i][c][f];
+			}
+		}
+		source = mix;
+	}
+	int slot = period.mixes[job];
+	client.encodedLength[slot] = serializeMix(source, period.sequence, cryptoKey_, client.encoded[slot]);
+}
+
+void JammerServer::sendThread() {
+	while (true) {
+		MixPacket* packet;
+		while ((packet = sendQueue_.readSlot())) {
+			sendto(socket_, packet->data, packet->length, 0, (const sockaddr*) &packet->recipient, sizeof(packet->recipient));
+			sendQueue_.commitRead();
+		}
+		std::unique_lock<std::mutex> lock(sendMutex_);
+		if (quit_) {
+			break;
+		}
+		sendCondition_.wait_for(lock, std::chrono::milliseconds(10), [this] { return quit_ || sendQueue_.size() > 0; });
+	}
+}
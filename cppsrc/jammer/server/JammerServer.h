@@ -7,63 +7,146 @@
 #ifndef JAMMER_SERVER_H
 #define JAMMER_SERVER_H
 
-/*
-#include "JuceHeader.h"
-
-#include "JammerNetzPackage.h"
-
-#include "MixerThread.h"
-#include "AcceptThread.h"
-#include "SendThread.h"
-#include "Encryption.h"
-
-#include "BuffersConfig.h"
-#include "Recorder.h"
-
-#include "ServerLogger.h"
-
-#include "version.cpp"
+#include "JammerMixPool.h"
+#include "JammerPacket.h"
+#include "LockFreeRing.h"
 
-#include <curses.h>*/
+#include <netinet/in.h>
 
-#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 
-
+const int JAMMER_MAX_CLIENTS = 32;
+// Clients which did not send for this time are removed
+const int JAMMER_CLIENT_TIMEOUT_MS = 2000;
+// Blocks up to this far behind the last one are dropped as duplicate or late, a larger step back restarts the stream
+const int JAMMER_SEQUENCE_WINDOW = 64;
+// Mixes queued between mixer and send thread, per client
+const int JAMMER_SEND_BLOCKS = 4;
+// Interval of the log line about mixes which missed their period
+const int JAMMER_MISS_REPORT_MS = 1000;
+
+// The server runs three threads connected by preallocated lock free rings, so nothing is allocated per packet:
+//
+//   receive thread -> one jitter buffer per client -> mixer thread -> send queue -> send thread
+//
+// Datagrams without a valid tag for the crypto key (see JammerPacket.h) are dropped before they can take or keep a
+// client slot.
+//
+// The mixer runs on the audio clock of JAMMER_BLOCK_FRAMES at JAMMER_SAMPLE_RATE. A client is mixed once its jitter
+// buffer holds prefill blocks, and goes back to prefilling after an underrun. A late client is waited for at most
+// wait milliseconds in each period before the mix is sent without it. Each client receives the mix of all other
+// clients.
+//
+// The mixer thread sums the blocks of all clients, the per client mix and encode jobs of the period run on the work
+// stealing pool of the process (see JammerMixPool). A job which does not finish by the start of the next period is
+// replaced by the previous mix of the client. Two sets of sums alternate, so a late job reads its sums while the
+// next period is mixed. Only if the jobs of the period before the last one are still running, the period is not
+// mixed and all clients get their previous mix.
 class JammerServer {
 public:
-	JammerServer(const std::string& cryptoKey, int port, int buffer, int wait, int prefill, const std::string& stageId);
+	// mixThreads: threads of the mix pool besides the mixer threads, negative for one per core. The pool is shared by
+	// all servers of the process, the first server created while there is none sets its size.
+	JammerServer(const std::string& cryptoKey, int port, int buffer, int wait, int prefill, const std::string& stageId,
+				 int mixThreads = -1);
 	~JammerServer();
 
 	void start();
 
+	// Joins the threads and closes the socket, so the port can be bound again
 	void stop();
 
-    std::function<void(int)> on_ready;
+	std::function<void(int)> on_ready;
 
-private:
-    std::string stageId_;
-    int port_;
-    int buffer_;
-    int wait_;
-    int prefill_;
-    std::thread workerThread_;
+	// Mixes which were replaced by the previous mix of the client, since the start
+	uint64_t missedMixes() const {
+		return missedMixes_.load(std::memory_order_relaxed);
+	}
 
-/*
-	DatagramSocket socket_;
-	std::unique_ptr<AcceptThread> acceptThread_;
-	std::unique_ptr<SendThread> sendThread_;
-	std::unique_ptr<MixerThread> mixerThread_;
-
-	TPacketStreamBundle incomingStreams_;
-	TOutgoingQueue sendQueue_;
-	TMessageQueue wakeUpQueue_;
-
-	Recorder clientRecorder_; // Later I need one per client
-	Recorder mixdownRecorder_;
-	JammerNetzChannelSetup mixdownSetup_; // This is the same for everybody
-	*/
+private:
+	enum SlotState { FREE, ACTIVE, CLOSING };
+
+	// The receive thread claims a FREE slot for a new client and marks it CLOSING on timeout, the mixer drains a
+	// CLOSING slot and frees it again. The address is only written while the slot is FREE.
+	struct ClientSlot {
+		std::atomic<int> state;
+		sockaddr_in address;
+		// Receive thread only
+		int64_t lastSeen;
+		uint32_t lastSequence;
+		// Mixer thread only
+		bool prefilling;
+		std::unique_ptr<LockFreeRing<AudioBlock>> jitterBuffer;
+		// Encoded mixes: the last one which was finished in time, and the ones the mix jobs of the current and the
+		// last period write
+		char encoded[3][JAMMER_MIX_DATAGRAM];
+		size_t encodedLength[3];
+		int goodMix;
+		int jobMix;
+		bool hasMix;
+	};
+
+	// Inputs of the mix jobs of one period, periods alternate between two of them
+	struct MixPeriod {
+		uint32_t sequence;
+		float total[JAMMER_MIX_CHANNELS][JAMMER_BLOCK_FRAMES];
+		float own[JAMMER_MAX_CLIENTS][JAMMER_MIX_CHANNELS][JAMMER_BLOCK_FRAMES];
+		bool contributing[JAMMER_MAX_CLIENTS];
+		// Clients which receive the mix of the period and the encoded mix each job writes, by job
+		int clients[JAMMER_MAX_CLIENTS];
+		int mixes[JAMMER_MAX_CLIENTS];
+		std::unique_ptr<JammerMixPool::Batch> batch;
+	};
+
+	struct MixPacket {
+		sockaddr_in recipient;
+		size_t length;
+		char data[JAMMER_MIX_DATAGRAM];
+	};
+
+	void receiveThread();
+	void mixerThread();
+	void sendThread();
+
+	ClientSlot* findClient(const sockaddr_in& address);
+	ClientSlot* claimClient(const sockaddr_in& address, int64_t now);
+	void expireClients(int64_t now);
+	bool mixReady(std::chrono::steady_clock::time_point deadline);
+	void mix(std::chrono::steady_clock::time_point deadline);
+	void mixJob(MixPeriod& period, int job);
+	void sendMix(ClientSlot& client, bool fresh);
+
+	std::string cryptoKey_;
+	std::string stageId_;
+	int port_;
+	int buffer_;
+	int wait_;
+	int prefill_;
+	int socket_;
+	std::atomic<bool> quit_;
+	std::atomic<bool> running_;
+
+	ClientSlot clients_[JAMMER_MAX_CLIENTS];
+	LockFreeRing<MixPacket> sendQueue_;
+	std::mutex sendMutex_;
+	std::condition_variable sendCondition_;
+	uint32_t mixSequence_;
+	// Periods which ran mix jobs, selects the inputs of the next one
+	uint32_t mixedPeriods_;
+	MixPeriod periods_[2];
+	// Written by the mixer thread, logged by the receive thread
+	std::atomic<uint64_t> missedMixes_;
+	uint64_t reportedMisses_;
+
+	std::thread receiveThread_;
+	std::thread mixerThread_;
+	std::thread sendThread_;
 };
 
 #endif // JAMMER_SERVER_H
@@ -12,7 +12,9 @@ Napi::Object JammerServerWrapper::Init(Napi::Env env, Napi::Object exports)
   Napi::HandleScope scope(env);
 
   Napi::Function func = DefineClass(
-      env, "JammerServerWrapper", {InstanceMethod("stop", &JammerServerWrapper::Stop)});
+      env, "JammerServerWrapper",
+      {InstanceMethod("stop", &JammerServerWrapper::Stop),
+       InstanceMethod("getMetrics", &JammerServerWrapper::GetMetrics)});
 
   constructor = Napi::Persistent(func);
   constructor.SuppressDestruct();
@@ -22,47 +24,77 @@ Napi::Object JammerServerWrapper::Init(Napi::Env env, Napi::Object exports)
 }
 
 JammerServerWrapper::JammerServerWrapper(const Napi::CallbackInfo& info)
-    : Napi::ObjectWrap<JammerServerWrapper>(info)
+    : Napi::ObjectWrap<JammerServerWrapper>(info), jammerServer_(NULL)
 {
   Napi::Env env = info.Env();
   int length = info.Length();
 
-  if(length != 6) {
-    Napi::TypeError::New(env, "Four arguments expected")
+  if(length < 3 || length > 4) {
+    Napi::TypeError::New(env, "Three or four arguments expected")
         .ThrowAsJavaScriptException();
+    return;
+  }
+  // crypto key
+  if(!info[0].IsString()) {
+    Napi::TypeError::New(env, "First argument is not a string")
+        .ThrowAsJavaScriptException();
+    return;
   }
-
   // port
   if(!info[1].IsNumber()) {
     Napi::TypeError::New(env, "Second argument is not a number")
         .ThrowAsJavaScriptException();
+    return;
   }
-  // buffer
-  if(!info[2].IsNumber()) {
-    Napi::TypeError::New(env, "Third argument is not a number")
-        .ThrowAsJavaScriptException();
-  }
-  // wait
-  if(!info[3].IsNumber()) {
-    Napi::TypeError::New(env, "Forth argument is not a number")
+  // stage id
+  if(!info[2].IsString()) {
+    Napi::TypeError::New(env, "Third argument is not a string")
         .ThrowAsJavaScriptException();
+    return;
   }
-  // prefill
-  if(!info[4].IsNumber()) {
-    Napi::TypeError::New(env, "Fifth argument is not a number")
+  // options
+  if(length == 4 && !info[3].IsObject()) {
+    Napi::TypeError::New(env, "Fourth argument is not an object")
         .ThrowAsJavaScriptException();
+    return;
   }
 
   // Initialize class
-  Napi::String cryptoKey = info[0].As<Napi::String>();
+  std::string cryptoKey = info[0].As<Napi::String>();
   Napi::Number portno = info[1].As<Napi::Number>();
-  Napi::Number buffer = info[2].As<Napi::Number>();
-  Napi::Number wait = info[3].As<Napi::Number>();
-  Napi::Number prefill = info[4].As<Napi::Number>();
-  Napi::String stage_id = info[5].As<Napi::String>();
+  std::string stage_id = info[2].As<Napi::String>();
+  int buffer(16);
+  int wait(2);
+  int prefill(2);
+  int mixThreads(-1);
+  if(length == 4) {
+    Napi::Object options = info[3].As<Napi::Object>();
+    // undefined options keep their defaults
+    const char* names[] = {"buffer", "wait", "prefill", "mixThreads"};
+    int* values[] = {&buffer, &wait, &prefill, &mixThreads};
+    for(size_t k = 0; k < 4; ++k) {
+      Napi::Value value = options.Get(names[k]);
+      if(value.IsUndefined())
+        continue;
+      if(!value.IsNumber()) {
+        Napi::TypeError::New(env, std::string("Option ") + names[k] +
+                                      " is not a number")
+            .ThrowAsJavaScriptException();
+        return;
+      }
+      *values[k] = value.As<Napi::Number>().Int32Value();
+    }
+  }
 
-  this->jammerServer_ =
-      new JammerServer(cryptoKey, portno.DoubleValue(), buffer.DoubleValue(), wait.DoubleValue(), prefill.DoubleValue(), stage_id);
+  try {
+    this->jammerServer_ = new JammerServer(cryptoKey, portno.Int32Value(),
+                                           buffer, wait, prefill, stage_id,
+                                           mixThreads);
+  }
+  catch(const std::exception& e) {
+    Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+    return;
+  }
 
   // Bind events
   //Napi::Function emit = info.This().As<Napi::Object>().Get("emit").As<Napi::Function>();
@@ -82,11 +114,28 @@ JammerServerWrapper::JammerServerWrapper(const Napi::CallbackInfo& info)
       args = {Napi::String::New(env, "ready"), Napi::Number::New(env, port)};
     });
   };
+  this->jammerServer_->start();
+}
+
+JammerServerWrapper::~JammerServerWrapper()
+{
+  delete this->jammerServer_;
 }
 
 Napi::Value JammerServerWrapper::Stop(const Napi::CallbackInfo& info)
 {
   Napi::Env env = info.Env();
-  this->jammerServer_->stop();
+  if(this->jammerServer_)
+    this->jammerServer_->stop();
   return Napi::String::New(env, "stopped");
 }
+
+Napi::Value JammerServerWrapper::GetMetrics(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  if(!this->jammerServer_)
+    return env.Null();
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("missedMixes", (double)this->jammerServer_->missedMixes());
+  return obj;
+}
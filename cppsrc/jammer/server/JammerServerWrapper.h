@@ -5,10 +5,12 @@ class JammerServerWrapper : public Napi::ObjectWrap<JammerServerWrapper> {
 public:
   static Napi::Object Init(Napi::Env env, Napi::Object exports);
   JammerServerWrapper(const Napi::CallbackInfo& info);
+  ~JammerServerWrapper();
 
 private:
   static Napi::FunctionReference constructor;
   Napi::Value Stop(const Napi::CallbackInfo& info);
+  Napi::Value GetMetrics(const Napi::CallbackInfo& info);
 
   JammerServer* jammerServer_;
 };
@@ -0,0 +1,81 @@
+#ifndef LOCK_FREE_RING_H
+#define LOCK_FREE_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounded single producer single consumer ring. The slots are allocated once in the constructor, producer and
+// consumer work on the slots in place, so no copy or allocation happens per element.
+template <class T> class LockFreeRing {
+public:
+	explicit LockFreeRing(size_t capacity) : slots_(roundUp(capacity)), mask_(slots_.size() - 1), padding0_(), head_(0), padding1_(), tail_(0), dropped_(0) {}
+
+	// Producer: slot for the next element, or nullptr if the ring is full (the element is counted as dropped)
+	T* writeSlot() {
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		return &slots_[tail & mask_];
+	}
+
+	// Producer: publish the slot returned by writeSlot()
+	void commitWrite() {
+		tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Consumer: oldest element, or nullptr if the ring is empty
+	T* readSlot() {
+		size_t head = head_.load(std::memory_order_relaxed);
+		if (head == tail_.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+		return &slots_[head & mask_];
+	}
+
+	// Consumer: release the slot returned by readSlot()
+	void commitRead() {
+		head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Consumer: drop all queued elements
+	void clear() {
+		head_.store(tail_.load(std::memory_order_acquire), std::memory_order_release);
+	}
+
+	size_t size() const {
+		return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const {
+		return slots_.size();
+	}
+
+	uint64_t takeDropped() {
+		return dropped_.exchange(0, std::memory_order_relaxed);
+	}
+
+private:
+	static size_t roundUp(size_t capacity) {
+		size_t n = 1;
+		while (n < capacity) {
+			n <<= 1;
+		}
+		return n;
+	}
+
+	std::vector<T> slots_;
+	const size_t mask_;
+	// Producer and consumer index on separate cache lines. Padding instead of alignas, which would need C++17 aligned
+	// new for heap allocated rings
+	char padding0_[64];
+	std::atomic<size_t> head_;
+	char padding1_[64];
+	std::atomic<size_t> tail_;
+	std::atomic<uint64_t> dropped_;
+};
+
+#endif // LOCK_FREE_RING_H
@@ -0,0 +1,706 @@
+/*
+ * Relay benchmark and load generator: runs a number of stages on
+ * loopback and drives each of them with synthetic ovbox clients, which
+ * register, answer pings and stream audio sized packets. Reports the
+ * packet rate, the forwarding latency through the relay and the CPU
+ * time spent per stage.
+ *
+ * The audio payload is mono PCM (see pcm_header_t), followed by padding
+ * and a bench_stamp_t at its end, so that the server mix can be
+ * measured, too.
+ */
+#include "../server/ov-server.h"
+#if defined(LINUX)
+#include "../server/stage-engine.h"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <memory>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// destination port of the synthetic audio streams:
+#define BENCHAUDIOPORT 4464
+// sampling rate of the synthetic audio streams:
+#define BENCHSRATE 48000
+// time between start of the clients and start of the measurement:
+#define BENCHWARMUPMS 2000
+// time for packets in flight after the measurement:
+#define BENCHDRAINMS 200
+// receive buffer of the client sockets:
+#define BENCHRCVBUF (1 << 20)
+// trunk key of the two relays of a stage in trunk mode:
+#define BENCHTRUNKKEY 0x7472756e
+
+struct bench_config_t {
+  bench_config_t()
+      : port(9000), stages(1), clients(4), duration_s(10), period_us(2000),
+        payload(400), io_mode(OV_IO_SINGLE), workers(1), downmix(0),
+        engine_threads(-1), shared_port(false), trunk(false), prio(50),
+        send_buffer(0){};
+  port_t port;
+  unsigned int stages;
+  unsigned int clients;
+  unsigned int duration_s;
+  unsigned int period_us;
+  size_t payload;
+  ov_io_mode_t io_mode;
+  // relay threads per stage:
+  unsigned int workers;
+  // number of B_DOWNMIXONLY clients per stage, served by the server mix:
+  unsigned int downmix;
+  // number of event loops of the stage engine, or -1 for one set of
+  // threads per stage:
+  int engine_threads;
+  // serve all stages of the engine on the first port:
+  bool shared_port;
+  // serve each stage by two relays connected by a trunk, half of the
+  // clients on each:
+  bool trunk;
+  int prio;
+  // kernel send buffer of the server sockets, zero for the default:
+  int send_buffer;
+  // record the received datagrams of each stage here (see ov-replay):
+  std::string capture_dir;
+};
+
+// tail of the payload of each audio packet:
+struct bench_stamp_t {
+  int64_t sent_ns;
+  uint32_t seq;
+  // sent during the measurement phase:
+  uint32_t measured;
+};
+
+enum bench_phase_t { BENCH_WARMUP, BENCH_MEASURE, BENCH_DRAIN, BENCH_DONE };
+
+static std::atomic<int> phase(BENCH_WARMUP);
+
+static int64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static double cpu_time(clockid_t clk)
+{
+  struct timespec t;
+  clock_gettime(clk, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/**
+ * Tracks the CPU time a thread spends in the measurement phase.
+ */
+class bench_cpu_meter_t {
+public:
+  bench_cpu_meter_t() : seen(BENCH_WARMUP), start(0), used(0){};
+  /**
+   * @return False once the benchmark is done
+   */
+  bool update()
+  {
+    int p(phase.load());
+    if(p == seen)
+      return true;
+    if(p == BENCH_MEASURE)
+      start = cpu_time(CLOCK_THREAD_CPUTIME_ID);
+    else if(seen == BENCH_MEASURE)
+      used = cpu_time(CLOCK_THREAD_CPUTIME_ID) - start;
+    seen = p;
+    return p != BENCH_DONE;
+  };
+  bool measuring() const { return seen == BENCH_MEASURE; };
+  double get_used() const { return used; };
+
+private:
+  int seen;
+  double start;
+  double used;
+};
+
+/**
+ * Hardware cache misses of the whole process in user space, including
+ * threads started after the counter was opened. Not available without
+ * a PMU or with a restrictive perf_event_paranoid.
+ */
+class bench_cache_counter_t {
+public:
+  bench_cache_counter_t();
+  ~bench_cache_counter_t();
+  bool available() const { return fd >= 0; };
+  void start();
+  void stop();
+  uint64_t get() const;
+
+private:
+  int fd;
+};
+
+bench_cache_counter_t::bench_cache_counter_t() : fd(-1)
+{
+#if defined(LINUX)
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+bench_cache_counter_t::~bench_cache_counter_t()
+{
+  if(fd >= 0)
+    ::close(fd);
+}
+
+void bench_cache_counter_t::start()
+{
+#if defined(LINUX)
+  // enabling the counter also enables the copies of all threads:
+  if(fd >= 0)
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+void bench_cache_counter_t::stop()
+{
+#if defined(LINUX)
+  if(fd >= 0)
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+uint64_t bench_cache_counter_t::get() const
+{
+  uint64_t v(0);
+  if((fd < 0) || (read(fd, &v, sizeof(v)) != sizeof(v)))
+    return 0;
+  return v;
+}
+
+/**
+ * One synthetic ovbox client of a stage.
+ */
+class bench_client_t {
+public:
+  bench_client_t(stage_device_id_t cid, epmode_t mode, port_t server_port);
+  ~bench_client_t();
+  void send_registration(secret_t pin);
+  void send_audio(secret_t pin, size_t payload, uint32_t period_us,
+                  uint32_t seq, bool measured);
+  void send_pong(secret_t pin, const char* msg, size_t len);
+  int get_fd() const { return fd; };
+
+private:
+  void send(size_t len);
+  stage_device_id_t cid;
+  epmode_t mode;
+  int fd;
+  endpoint_t server;
+  char buffer[BUFSIZE];
+};
+
+bench_client_t::bench_client_t(stage_device_id_t cid, epmode_t mode,
+                               port_t server_port)
+    : cid(cid), mode(mode), fd(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP))
+{
+  if(fd < 0)
+    throw ErrMsg("Unable to create client socket", errno);
+  int rcvbuf(BENCHRCVBUF);
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  endpoint_t local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(bind(fd, (struct sockaddr*)&local, sizeof(local)) < 0) {
+    ::close(fd);
+    throw ErrMsg("Unable to bind client socket", errno);
+  }
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  server.sin_port = htons(server_port);
+}
+
+bench_client_t::~bench_client_t()
+{
+  ::close(fd);
+}
+
+void bench_client_t::send(size_t len)
+{
+  sendto(fd, buffer, len, MSG_DONTWAIT, (struct sockaddr*)&server,
+         sizeof(server));
+}
+
+void bench_client_t::send_registration(secret_t pin)
+{
+  // the sequence field of the registration carries the mode:
+  send(packmsg(buffer, BUFSIZE, pin, cid, PORT_REGISTER, mode, OVBOXVERSION,
+               strlen(OVBOXVERSION) + 1));
+}
+
+void bench_client_t::send_audio(secret_t pin, size_t payload,
+                                uint32_t period_us, uint32_t seq, bool measured)
+{
+  char data[BUFSIZE - HEADERLEN];
+  pcm_header_t h;
+  h.magic = PCM_MAGIC;
+  h.srate = BENCHSRATE;
+  h.frames = std::min((uint64_t)MIXMAXFRAMES,
+                      (uint64_t)BENCHSRATE * period_us / 1000000);
+  h.channels = 1;
+  h.format = PCM_S16;
+  payload = std::max(payload, sizeof(h) + h.frames * sizeof(int16_t) +
+                                  sizeof(bench_stamp_t));
+  if(payload > sizeof(data))
+    return;
+  memset(data, 0, payload);
+  memcpy(data, &h, sizeof(h));
+  bench_stamp_t stamp;
+  stamp.sent_ns = now_ns();
+  stamp.seq = seq;
+  stamp.measured = measured;
+  memcpy(&data[payload - sizeof(stamp)], &stamp, sizeof(stamp));
+  send(packmsg(buffer, BUFSIZE, pin, cid, BENCHAUDIOPORT, seq, data, payload));
+}
+
+void bench_client_t::send_pong(secret_t pin, const char* msg, size_t len)
+{
+  // the ping payload is returned unchanged:
+  send(packmsg(buffer, BUFSIZE, pin, cid, PORT_PONG, 0, msg, len));
+}
+
+/**
+ * The clients of one stage, driven by a sender and a receiver thread.
+ */
+class bench_stage_t {
+public:
+  /**
+   * Client cid connects to relay (cid % number of relays), with the port
+   * and pin of that relay.
+   */
+  bench_stage_t(const bench_config_t& cfg, const std::vector<port_t>& ports,
+                const std::vector<secret_t>& relay_pins);
+  ~bench_stage_t();
+  void start();
+  void join();
+  // results of the measurement phase, valid after join():
+  uint64_t sent;
+  // number of forwarded packets if nothing is lost:
+  uint64_t expected;
+  uint64_t received;
+  // server mix packets received by the downmix clients:
+  uint64_t mixed;
+  latency_histogram_t latency;
+  double client_cpu;
+
+private:
+  void sender();
+  void receiver();
+  const bench_config_t& cfg;
+  // pin of the relay of each client:
+  std::vector<secret_t> pins;
+  std::vector<std::unique_ptr<bench_client_t>> clients;
+  bench_cpu_meter_t sender_cpu;
+  bench_cpu_meter_t receiver_cpu;
+  std::thread sender_thread;
+  std::thread receiver_thread;
+};
+
+bench_stage_t::bench_stage_t(const bench_config_t& cfg,
+                             const std::vector<port_t>& ports,
+                             const std::vector<secret_t>& relay_pins)
+    : sent(0), expected(0), received(0), mixed(0), client_cpu(0), cfg(cfg)
+{
+  // the first clients are downmix-only receivers:
+  for(stage_device_id_t cid = 0; cid < cfg.clients; ++cid) {
+    size_t relay(cid % ports.size());
+    clients.emplace_back(new bench_client_t(
+        cid, (cid < cfg.downmix) ? B_DOWNMIXONLY : 0, ports[relay]));
+    pins.push_back(relay_pins[relay]);
+  }
+}
+
+bench_stage_t::~bench_stage_t()
+{
+  join();
+}
+
+void bench_stage_t::start()
+{
+  sender_thread = std::thread(&bench_stage_t::sender, this);
+  receiver_thread = std::thread(&bench_stage_t::receiver, this);
+}
+
+void bench_stage_t::join()
+{
+  if(sender_thread.joinable())
+    sender_thread.join();
+  if(receiver_thread.joinable())
+    receiver_thread.join();
+  client_cpu = sender_cpu.get_used() + receiver_cpu.get_used();
+}
+
+void bench_stage_t::sender()
+{
+  const std::chrono::microseconds period(cfg.period_us);
+  const uint32_t regperiod(
+      std::max(1u, PINGPERIODMS * 1000u / std::max(1u, cfg.period_us)));
+  uint32_t seq(0);
+  std::chrono::steady_clock::time_point next(std::chrono::steady_clock::now());
+  while(sender_cpu.update()) {
+    if(seq % regperiod == 0)
+      for(size_t k = 0; k < clients.size(); ++k)
+        clients[k]->send_registration(pins[k]);
+    bool measuring(sender_cpu.measuring());
+    for(size_t k = 0; k < clients.size(); ++k)
+      clients[k]->send_audio(pins[k], cfg.payload, cfg.period_us, seq,
+                             measuring);
+    if(measuring) {
+      // downmix-only clients receive only the server mix:
+      uint32_t direct(cfg.clients - std::min(cfg.downmix, cfg.clients));
+      sent += clients.size();
+      expected += clients.size() * direct - direct;
+    }
+    ++seq;
+    next += period;
+    std::this_thread::sleep_until(next);
+  }
+}
+
+void bench_stage_t::receiver()
+{
+  std::vector<struct pollfd> fds(clients.size());
+  for(size_t k = 0; k < clients.size(); ++k) {
+    fds[k].fd = clients[k]->get_fd();
+    fds[k].events = POLLIN;
+  }
+  char buffer[BUFSIZE];
+  while(receiver_cpu.update()) {
+    if(poll(fds.data(), fds.size(), 100) <= 0)
+      continue;
+    for(size_t k = 0; k < fds.size(); ++k) {
+      if(!(fds[k].revents & POLLIN))
+        continue;
+      ssize_t n;
+      while((n = recv(fds[k].fd, buffer, BUFSIZE, MSG_DONTWAIT)) >=
+            (ssize_t)HEADERLEN) {
+        port_t destport(msg_port(buffer));
+        if(destport == PORT_PING) {
+          clients[k]->send_pong(pins[k], &buffer[HEADERLEN], n - HEADERLEN);
+        } else if((destport == BENCHAUDIOPORT) &&
+                  (msg_callerid(buffer) == MAXEP - 1)) {
+          if(receiver_cpu.measuring())
+            ++mixed;
+        } else if((destport == BENCHAUDIOPORT) &&
+                  (n >= (ssize_t)(HEADERLEN + sizeof(bench_stamp_t)))) {
+          bench_stamp_t stamp;
+          memcpy(&stamp, &buffer[n - sizeof(stamp)], sizeof(stamp));
+          if(stamp.measured) {
+            latency.add(std::max((int64_t)0, now_ns() - stamp.sent_ns) / 1000);
+            ++received;
+          }
+        }
+      }
+    }
+  }
+}
+
+static const char* io_mode_name(ov_io_mode_t mode)
+{
+  switch(mode) {
+  case OV_IO_BATCHED:
+    return "batched";
+  case OV_IO_URING:
+    return "io_uring";
+  default:
+    return "single";
+  }
+}
+
+static port_t stage_port(const bench_config_t& cfg, unsigned int stage)
+{
+  if(cfg.shared_port)
+    return cfg.port;
+  return cfg.port + stage;
+}
+
+static void usage(const char* name)
+{
+  printf("Usage: %s [options]\n"
+         "  -p port      first UDP port of the stages (9000)\n"
+         "  -s stages    number of stages (1)\n"
+         "  -c clients   clients per stage (4)\n"
+         "  -d seconds   duration of the measurement (10)\n"
+         "  -t us        packet period of each client (2000)\n"
+         "  -l bytes     audio payload size (400)\n"
+         "  -b           use batched socket I/O\n"
+#if defined(LINUX)
+         "  -u           use io_uring socket I/O\n"
+#endif
+         "  -w workers   relay threads per stage (1)\n"
+         "  -m clients   downmix-only clients per stage, mixed by the\n"
+         "               server (0)\n"
+#if defined(LINUX)
+         "  -e threads   host all stages in the stage engine, 0 for one\n"
+         "               event loop per core\n"
+         "  -S           serve all stages of the engine on the first port\n"
+#endif
+         "  -T           serve each stage by two relays connected by a\n"
+         "               trunk, the second set of ports follows the first\n"
+         "  -r prio      thread priority of the relay (50)\n"
+         "  -q bytes     send buffer of the server sockets (default)\n"
+         "  -k dir       record the received datagrams to capture files\n",
+         name);
+}
+
+int main(int argc, char** argv)
+{
+  bench_config_t cfg;
+  int opt;
+  while((opt = getopt(argc, argv, "p:s:c:d:t:l:buw:m:e:STr:q:k:h")) != -1) {
+    switch(opt) {
+    case 'p':
+      cfg.port = atoi(optarg);
+      break;
+    case 's':
+      cfg.stages = std::max(1, atoi(optarg));
+      break;
+    case 'c':
+      cfg.clients = std::min(std::max(2, atoi(optarg)), MAXEP - 1);
+      break;
+    case 'd':
+      cfg.duration_s = std::max(1, atoi(optarg));
+      break;
+    case 't':
+      cfg.period_us = std::max(100, atoi(optarg));
+      break;
+    case 'l':
+      cfg.payload = std::max(0, atoi(optarg));
+      break;
+    case 'b':
+      cfg.io_mode = OV_IO_BATCHED;
+      break;
+#if defined(LINUX)
+    case 'u':
+      cfg.io_mode = OV_IO_URING;
+      break;
+#endif
+    case 'w':
+      cfg.workers = std::max(1, atoi(optarg));
+      break;
+    case 'm':
+      cfg.downmix = std::max(0, atoi(optarg));
+      break;
+#if defined(LINUX)
+    case 'e':
+      cfg.engine_threads = std::max(0, atoi(optarg));
+      break;
+    case 'S':
+      cfg.shared_port = true;
+      cfg.engine_threads = std::max(0, cfg.engine_threads);
+      break;
+#endif
+    case 'T':
+      cfg.trunk = true;
+      break;
+    case 'r':
+      cfg.prio = atoi(optarg);
+      break;
+    case 'q':
+      cfg.send_buffer = std::max(0, atoi(optarg));
+      break;
+    case 'k':
+      cfg.capture_dir = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return (opt == 'h') ? 0 : 1;
+    }
+  }
+  try {
+    // opened before any thread is started, so that all are counted:
+    bench_cache_counter_t cache_misses;
+    ov_server_options_t options;
+    options.io_mode = cfg.io_mode;
+    options.relay_workers = cfg.workers;
+    options.server_downmix = (cfg.downmix > 0);
+    options.send_buffer = cfg.send_buffer;
+    options.capture_dir = cfg.capture_dir;
+    if(cfg.trunk)
+      options.trunk_key = BENCHTRUNKKEY;
+#if defined(LINUX)
+    std::unique_ptr<ov_stage_engine_t> engine;
+    if(cfg.engine_threads >= 0) {
+      options.hosted = true;
+      if(cfg.shared_port)
+        options.shared_port = cfg.port;
+      engine.reset(new ov_stage_engine_t(cfg.prio, cfg.engine_threads,
+                                         options.shared_port,
+                                         options.send_buffer));
+    }
+#endif
+    std::vector<ov_server_t*> servers;
+    std::vector<std::shared_ptr<const stage_counters_t>> counters;
+    // in trunk mode the second relay of stage k is server stages + k:
+    unsigned int relays(cfg.trunk ? 2 : 1);
+    for(unsigned int k = 0; k < relays * cfg.stages; ++k) {
+      ov_server_t* server(new ov_server_t(stage_port(cfg, k), cfg.prio,
+                                          "bench" + std::to_string(k), options));
+      // both relays of a stage are configured as trunk of each other:
+      if(k >= cfg.stages) {
+        ov_server_t* first(servers[k - cfg.stages]);
+        server->add_trunk("127.0.0.1:" + std::to_string(first->portno));
+        first->add_trunk("127.0.0.1:" + std::to_string(server->portno));
+      }
+      servers.push_back(server);
+      counters.push_back(server->get_counters());
+      // hosted stages are started by the engine:
+      server->start();
+#if defined(LINUX)
+      if(engine)
+        engine->add_stage(server);
+#endif
+    }
+    // the pin is drawn by the first announcement:
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * PINGPERIODMS));
+    std::vector<std::unique_ptr<bench_stage_t>> stages;
+    for(unsigned int k = 0; k < cfg.stages; ++k) {
+      std::vector<port_t> ports;
+      std::vector<secret_t> pins;
+      for(unsigned int r = 0; r < relays; ++r) {
+        ports.push_back(servers[k + r * cfg.stages]->portno);
+        pins.push_back(servers[k + r * cfg.stages]->get_pin());
+      }
+      stages.emplace_back(new bench_stage_t(cfg, ports, pins));
+    }
+    for(auto& s : stages)
+      s->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(BENCHWARMUPMS));
+    double cpu0(cpu_time(CLOCK_PROCESS_CPUTIME_ID));
+    int64_t t0(now_ns());
+    cache_misses.start();
+    phase = BENCH_MEASURE;
+    std::this_thread::sleep_for(std::chrono::seconds(cfg.duration_s));
+    phase = BENCH_DRAIN;
+    cache_misses.stop();
+    double cpu1(cpu_time(CLOCK_PROCESS_CPUTIME_ID));
+    double wall(1e-9 * (now_ns() - t0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(BENCHDRAINMS));
+    phase = BENCH_DONE;
+    uint64_t sent(0);
+    uint64_t expected(0);
+    uint64_t received(0);
+    uint64_t mixed(0);
+    double client_cpu(0);
+    latency_histogram_t latency;
+    for(auto& s : stages) {
+      s->join();
+      sent += s->sent;
+      expected += s->expected;
+      received += s->received;
+      mixed += s->mixed;
+      client_cpu += s->client_cpu;
+      latency.add(s->latency);
+    }
+    stages.clear();
+#if defined(LINUX)
+    if(engine) {
+      // the engine owns and deletes the stages:
+      servers.clear();
+      engine.reset();
+    }
+#endif
+    for(auto server : servers)
+      delete server;
+    // server side view, including warmup and drain:
+    stage_metrics_t total;
+    total.packets_in = total.packets_out = total.invalid = 0;
+    total.send_errors = total.mix_dropped = total.queue_dropped = 0;
+    total.trunk_in = total.trunk_out = total.lost = 0;
+    uint64_t reordered(0);
+    uint64_t duplicates(0);
+    uint64_t gaps(0);
+    double jitter(0);
+    for(auto& c : counters) {
+      stage_metrics_t m;
+      c->snapshot(m);
+      total.packets_in += m.packets_in;
+      total.packets_out += m.packets_out;
+      total.invalid += m.invalid;
+      total.send_errors += m.send_errors;
+      total.mix_dropped += m.mix_dropped;
+      total.queue_dropped += m.queue_dropped;
+      total.trunk_in += m.trunk_in;
+      total.trunk_out += m.trunk_out;
+      total.lost += m.lost;
+      for(auto& e : m.endpoints) {
+        reordered += e.reordered;
+        duplicates += e.duplicates;
+        gaps += e.gaps;
+        jitter = std::max(jitter, e.jitter_ms);
+      }
+    }
+    double server_cpu(std::max(0.0, cpu1 - cpu0 - client_cpu));
+    printf("stages %u, %u clients per stage, period %u us, payload %zu "
+           "bytes, %s I/O, %u workers, %s%s\n",
+           cfg.stages, cfg.clients, cfg.period_us, cfg.payload,
+           io_mode_name(cfg.io_mode), cfg.workers,
+           (cfg.engine_threads < 0) ? "threads per stage"
+           : cfg.shared_port        ? "stage engine, shared port"
+                                    : "stage engine",
+           cfg.trunk ? ", two relays per stage" : "");
+    printf("sent:        %12.1f packets/s\n", sent / wall);
+    printf("forwarded:   %12.1f packets/s (loss %1.3f%%)\n", received / wall,
+           expected ? 100.0 * (1.0 - (double)received / expected) : 0.0);
+    printf("latency:     p50 %u us, p99 %u us, p99.9 %u us, max %u us\n",
+           latency.quantile(0.5), latency.quantile(0.99),
+           latency.quantile(0.999), latency.get_max());
+    if(cfg.downmix)
+      printf("mixed:       %12.1f packets/s (%u receivers per stage)\n",
+             mixed / wall, cfg.downmix);
+    printf("counters:    in %" PRIu64 ", out %" PRIu64 ", invalid %" PRIu64
+           ", send errors %" PRIu64 ", mix dropped %" PRIu64
+           ", queue dropped %" PRIu64 "\n",
+           total.packets_in, total.packets_out, total.invalid,
+           total.send_errors, total.mix_dropped, total.queue_dropped);
+    // client to relay, from the sequence numbers of the audio streams:
+    printf("streams:     lost %" PRIu64 ", reordered %" PRIu64
+           ", duplicates %" PRIu64 ", gaps %" PRIu64
+           ", max jitter %1.3f ms\n",
+           total.lost, reordered, duplicates, gaps, jitter);
+    if(cfg.trunk)
+      printf("trunks:      in %" PRIu64 ", out %" PRIu64 "\n", total.trunk_in,
+             total.trunk_out);
+    printf("server cpu:  %1.2f%% of one core per stage\n",
+           100.0 * server_cpu / wall / cfg.stages);
+    printf("client cpu:  %1.2f%% of one core\n", 100.0 * client_cpu / wall);
+    if(cache_misses.available())
+      printf("cache miss:  %1.1f per forwarded packet (whole process)\n",
+             (double)cache_misses.get() / std::max((uint64_t)1, received));
+    else
+      printf("cache miss:  not available\n");
+  }
+  catch(const std::exception& e) {
+    fprintf(stderr, "Error: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
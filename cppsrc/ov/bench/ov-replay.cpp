@@ -0,0 +1,514 @@
+/*
+ * Replay of capture files (see capture_writer_t): runs a stage on
+ * loopback and sends the recorded datagrams to it, at the recorded pace
+ * or accelerated, each recorded sender from its own socket. Reports the
+ * forwarding latency through the relay and the CPU time of the server,
+ * so that relay changes can be compared on real session traffic.
+ *
+ * The recorded session pin is replaced by the pin of the replay stage.
+ * Pings of the server are answered by the replay clients, recorded pong
+ * messages are not sent.
+ */
+#include "../server/capture-file.h"
+#include "../server/ov-server.h"
+#if defined(LINUX)
+#include "../server/stage-engine.h"
+#endif
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <map>
+#include <memory>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// receive buffer of the client sockets:
+#define REPLAYRCVBUF (1 << 20)
+// maximum number of distinct senders replayed:
+#define REPLAYMAXCLIENTS 1024
+// number of send times kept for matching forwarded datagrams:
+#define REPLAYSTAMPS 4096
+// time for packets in flight after the replay:
+#define REPLAYDRAINMS 200
+
+struct replay_config_t {
+  replay_config_t()
+      : port(9000), speed(1.0), batched(false), workers(1), downmix(false),
+        engine_threads(-1), prio(50){};
+  port_t port;
+  // 1 replays at the recorded pace, 0 as fast as possible:
+  double speed;
+  bool batched;
+  unsigned int workers;
+  bool downmix;
+  int engine_threads;
+  int prio;
+};
+
+static std::atomic<bool> replaying(true);
+
+static int64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static double cpu_time(clockid_t clk)
+{
+  struct timespec t;
+  clock_gettime(clk, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/**
+ * Read-only memory mapping of one capture file.
+ */
+class capture_file_t {
+public:
+  capture_file_t(const std::string& path);
+  ~capture_file_t();
+  /**
+   * First record, or NULL if the file has none.
+   */
+  const capture_record_t* first() const { return get(header_size); };
+  /**
+   * Record after r, or NULL at the end of the file. An incomplete
+   * record at the end (file still written) is ignored.
+   */
+  const capture_record_t* next(const capture_record_t* r) const
+  {
+    return get((const char*)r - data + capture_record_size(r->len));
+  };
+  const std::string path;
+
+private:
+  const capture_record_t* get(size_t pos) const
+  {
+    if(pos + sizeof(capture_record_t) > size)
+      return NULL;
+    const capture_record_t* r((const capture_record_t*)(data + pos));
+    if(pos + sizeof(capture_record_t) + r->len > size)
+      return NULL;
+    return r;
+  };
+  const char* data;
+  size_t size;
+  size_t header_size;
+};
+
+capture_file_t::capture_file_t(const std::string& path)
+    : path(path), data(NULL), size(0), header_size(0)
+{
+  int fd(open(path.c_str(), O_RDONLY));
+  if(fd < 0)
+    throw ErrMsg("Unable to open " + path, errno);
+  struct stat st;
+  if(fstat(fd, &st) < 0) {
+    ::close(fd);
+    throw ErrMsg("Unable to read " + path, errno);
+  }
+  size = st.st_size;
+  if(size < sizeof(capture_file_header_t)) {
+    ::close(fd);
+    throw ErrMsg(path + " is not a capture file");
+  }
+  void* p(mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0));
+  ::close(fd);
+  if(p == MAP_FAILED)
+    throw ErrMsg("Unable to map " + path, errno);
+  data = (const char*)p;
+  capture_file_header_t h;
+  memcpy(&h, data, sizeof(h));
+  if(memcmp(h.magic, CAPTUREMAGIC, sizeof(h.magic)) ||
+     (h.version != CAPTUREVERSION) || (h.header_size < sizeof(h)) ||
+     (h.header_size % CAPTUREALIGN)) {
+    munmap(p, size);
+    throw ErrMsg(path + " is not a capture file of version " +
+                 std::to_string(CAPTUREVERSION));
+  }
+  header_size = h.header_size;
+}
+
+capture_file_t::~capture_file_t()
+{
+  munmap((void*)data, size);
+}
+
+/**
+ * Send time of recently replayed audio datagrams, to find the latency of
+ * their forwarded copies. Written by the sender, read by the receiver.
+ */
+class replay_stamps_t {
+public:
+  replay_stamps_t()
+  {
+    for(size_t k = 0; k < REPLAYSTAMPS; ++k)
+      slot[k].key = 0;
+  };
+  void set(const char* msg, int64_t t)
+  {
+    uint64_t k(key(msg));
+    slot_t& s(slot[k % REPLAYSTAMPS]);
+    s.key.store(0, std::memory_order_relaxed);
+    s.sent_ns.store(t, std::memory_order_relaxed);
+    s.key.store(k, std::memory_order_release);
+  };
+  /**
+   * @return Send time, or -1 if the datagram is unknown
+   */
+  int64_t get(const char* msg) const
+  {
+    uint64_t k(key(msg));
+    const slot_t& s(slot[k % REPLAYSTAMPS]);
+    if(s.key.load(std::memory_order_acquire) != k)
+      return -1;
+    int64_t t(s.sent_ns.load(std::memory_order_relaxed));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return (s.key.load(std::memory_order_relaxed) == k) ? t : -1;
+  };
+
+private:
+  static uint64_t key(const char* msg)
+  {
+    // never zero, which marks an empty slot:
+    return ((uint64_t)msg_seq(msg) << 24) | ((uint64_t)msg_port(msg) << 8) |
+           ((uint64_t)msg_callerid(msg) + 1);
+  };
+  struct slot_t {
+    std::atomic<uint64_t> key;
+    std::atomic<int64_t> sent_ns;
+  };
+  slot_t slot[REPLAYSTAMPS];
+};
+
+/**
+ * Socket replaying the datagrams of one recorded sender.
+ */
+struct replay_client_t {
+  replay_client_t();
+  ~replay_client_t();
+  int fd;
+  // caller ID of the recorded sender, used for pongs:
+  stage_device_id_t cid;
+};
+
+replay_client_t::replay_client_t()
+    : fd(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)), cid(MAXEP)
+{
+  if(fd < 0)
+    throw ErrMsg("Unable to create client socket", errno);
+  int rcvbuf(REPLAYRCVBUF);
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  endpoint_t local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(bind(fd, (struct sockaddr*)&local, sizeof(local)) < 0) {
+    ::close(fd);
+    throw ErrMsg("Unable to bind client socket", errno);
+  }
+}
+
+replay_client_t::~replay_client_t()
+{
+  ::close(fd);
+}
+
+class replay_t {
+public:
+  replay_t(const std::vector<std::unique_ptr<capture_file_t>>& files,
+           const replay_config_t& cfg, secret_t pin);
+  void run();
+  size_t get_senders() const { return clients.size(); };
+  // results, valid after run():
+  uint64_t sent;
+  uint64_t received;
+  // datagrams longer than the snap length, which are not sent:
+  uint64_t truncated;
+  double replayed_s;
+  latency_histogram_t latency;
+  double client_cpu;
+
+private:
+  void sender();
+  void receiver();
+  const std::vector<std::unique_ptr<capture_file_t>>& files;
+  const replay_config_t& cfg;
+  const secret_t pin;
+  endpoint_t server;
+  // recorded sender address and port to replay socket:
+  std::map<uint64_t, size_t> senders;
+  std::vector<std::unique_ptr<replay_client_t>> clients;
+  replay_stamps_t stamps;
+  double receiver_cpu;
+};
+
+replay_t::replay_t(const std::vector<std::unique_ptr<capture_file_t>>& files,
+                   const replay_config_t& cfg, secret_t pin)
+    : sent(0), received(0), truncated(0), replayed_s(0), client_cpu(0),
+      files(files), cfg(cfg), pin(pin), receiver_cpu(0)
+{
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  server.sin_port = htons(cfg.port);
+  // one socket per recorded sender, created before the replay starts:
+  for(auto& f : files)
+    for(const capture_record_t* r = f->first(); r; r = f->next(r)) {
+      uint64_t key(((uint64_t)r->addr << 16) | r->port);
+      if(senders.count(key))
+        continue;
+      if(clients.size() == REPLAYMAXCLIENTS)
+        throw ErrMsg("More than " + std::to_string(REPLAYMAXCLIENTS) +
+                     " senders in the capture");
+      senders[key] = clients.size();
+      clients.emplace_back(new replay_client_t());
+    }
+}
+
+void replay_t::run()
+{
+  std::thread rx(&replay_t::receiver, this);
+  double cpu0(cpu_time(CLOCK_THREAD_CPUTIME_ID));
+  sender();
+  double sender_cpu(cpu_time(CLOCK_THREAD_CPUTIME_ID) - cpu0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(REPLAYDRAINMS));
+  replaying = false;
+  rx.join();
+  client_cpu = sender_cpu + receiver_cpu;
+}
+
+void replay_t::sender()
+{
+  char buffer[CAPTURESNAPLEN];
+  int64_t start(now_ns());
+  // offset of the record times, shifted if a file starts a new capture:
+  int64_t offset(0);
+  int64_t last(0);
+  bool first(true);
+  for(auto& f : files) {
+    for(const capture_record_t* r = f->first(); r; r = f->next(r)) {
+      if(first) {
+        offset = -(int64_t)r->time_ns;
+        first = false;
+      } else if((int64_t)r->time_ns + offset < last) {
+        offset = last - (int64_t)r->time_ns;
+      }
+      last = r->time_ns + offset;
+      if(cfg.speed > 0) {
+        int64_t due(start + (int64_t)(last / cfg.speed));
+        int64_t wait(due - now_ns());
+        if(wait > 0)
+          std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+      }
+      if(r->len < r->orig_len) {
+        ++truncated;
+        continue;
+      }
+      replay_client_t& c(
+          *clients[senders[((uint64_t)r->addr << 16) | r->port]]);
+      memcpy(buffer, (const char*)(r + 1), r->len);
+      if(r->len >= HEADERLEN) {
+        if(c.cid == MAXEP)
+          c.cid = msg_callerid(buffer);
+        // the replay clients answer the pings themselves:
+        if(msg_port(buffer) == PORT_PONG)
+          continue;
+        msg_secret(buffer) = pin;
+        if(ov_audio_port(msg_port(buffer)))
+          stamps.set(buffer, now_ns());
+      }
+      sendto(c.fd, buffer, r->len, 0, (struct sockaddr*)&server,
+             sizeof(server));
+      ++sent;
+    }
+  }
+  replayed_s = 1e-9 * (now_ns() - start);
+}
+
+void replay_t::receiver()
+{
+  double cpu0(cpu_time(CLOCK_THREAD_CPUTIME_ID));
+  std::vector<struct pollfd> fds(clients.size());
+  for(size_t k = 0; k < clients.size(); ++k) {
+    fds[k].fd = clients[k]->fd;
+    fds[k].events = POLLIN;
+  }
+  char buffer[BUFSIZE];
+  while(replaying) {
+    if(poll(fds.data(), fds.size(), 100) <= 0)
+      continue;
+    for(size_t k = 0; k < fds.size(); ++k) {
+      if(!(fds[k].revents & POLLIN))
+        continue;
+      ssize_t n;
+      while((n = recv(fds[k].fd, buffer, BUFSIZE, MSG_DONTWAIT)) >=
+            (ssize_t)HEADERLEN) {
+        port_t destport(msg_port(buffer));
+        if(destport == PORT_PING) {
+          // the ping payload is returned unchanged:
+          char pong[BUFSIZE];
+          size_t len(packmsg(pong, BUFSIZE, pin, clients[k]->cid, PORT_PONG,
+                             0, &buffer[HEADERLEN], n - HEADERLEN));
+          sendto(fds[k].fd, pong, len, MSG_DONTWAIT,
+                 (struct sockaddr*)&server, sizeof(server));
+        } else if(ov_audio_port(destport)) {
+          int64_t t(stamps.get(buffer));
+          if(t >= 0)
+            latency.add(std::max((int64_t)0, now_ns() - t) / 1000);
+          ++received;
+        }
+      }
+    }
+  }
+  receiver_cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID) - cpu0;
+}
+
+static void usage(const char* name)
+{
+  printf("Usage: %s [options] capture-file [capture-file ...]\n"
+         "  -p port      UDP port of the replay stage (9000)\n"
+         "  -x factor    speed relative to the recording, 0 for as fast\n"
+         "               as possible (1)\n"
+         "  -b           use batched socket I/O\n"
+         "  -w workers   relay threads (1)\n"
+         "  -m           mix on the server for downmix-only clients\n"
+#if defined(LINUX)
+         "  -e threads   host the stage in the stage engine, 0 for one\n"
+         "               event loop per core\n"
+#endif
+         "  -r prio      thread priority of the relay (50)\n"
+         "Rotated files are replayed in the given order, oldest first.\n",
+         name);
+}
+
+int main(int argc, char** argv)
+{
+  replay_config_t cfg;
+  int opt;
+  while((opt = getopt(argc, argv, "p:x:bw:me:r:h")) != -1) {
+    switch(opt) {
+    case 'p':
+      cfg.port = atoi(optarg);
+      break;
+    case 'x':
+      cfg.speed = std::max(0.0, atof(optarg));
+      break;
+    case 'b':
+      cfg.batched = true;
+      break;
+    case 'w':
+      cfg.workers = std::max(1, atoi(optarg));
+      break;
+    case 'm':
+      cfg.downmix = true;
+      break;
+#if defined(LINUX)
+    case 'e':
+      cfg.engine_threads = std::max(0, atoi(optarg));
+      break;
+#endif
+    case 'r':
+      cfg.prio = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return (opt == 'h') ? 0 : 1;
+    }
+  }
+  if(optind == argc) {
+    usage(argv[0]);
+    return 1;
+  }
+  try {
+    std::vector<std::unique_ptr<capture_file_t>> files;
+    for(int k = optind; k < argc; ++k)
+      files.emplace_back(new capture_file_t(argv[k]));
+    ov_server_options_t options;
+    options.io_mode = cfg.batched ? OV_IO_BATCHED : OV_IO_SINGLE;
+    options.relay_workers = cfg.workers;
+    options.server_downmix = cfg.downmix;
+#if defined(LINUX)
+    std::unique_ptr<ov_stage_engine_t> engine;
+    if(cfg.engine_threads >= 0) {
+      options.hosted = true;
+      engine.reset(new ov_stage_engine_t(cfg.prio, cfg.engine_threads));
+    }
+#endif
+    ov_server_t* server(new ov_server_t(cfg.port, cfg.prio, "replay", options));
+    std::shared_ptr<const stage_counters_t> counters(server->get_counters());
+    // hosted stages are started by the engine:
+    server->start();
+#if defined(LINUX)
+    if(engine)
+      engine->add_stage(server);
+#endif
+    // the pin is drawn by the first announcement:
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * PINGPERIODMS));
+    replay_t replay(files, cfg, server->get_pin());
+    double cpu0(cpu_time(CLOCK_PROCESS_CPUTIME_ID));
+    replay.run();
+    double cpu1(cpu_time(CLOCK_PROCESS_CPUTIME_ID));
+#if defined(LINUX)
+    if(engine) {
+      // the engine owns and deletes the stage:
+      server = NULL;
+      engine.reset();
+    }
+#endif
+    delete server;
+    stage_metrics_t m;
+    counters->snapshot(m);
+    double wall(std::max(1e-3, replay.replayed_s));
+    double server_cpu(std::max(0.0, cpu1 - cpu0 - replay.client_cpu));
+    printf("replayed %zu files, %zu senders, speed %g, %s I/O, %u workers, "
+           "%s\n",
+           files.size(), replay.get_senders(), cfg.speed,
+           cfg.batched ? "batched" : "single", cfg.workers,
+           (cfg.engine_threads >= 0) ? "stage engine" : "thread per stage");
+    printf("sent:        %" PRIu64 " datagrams in %1.3f s (%1.1f packets/s), "
+           "%" PRIu64 " truncated records skipped\n",
+           replay.sent, wall, replay.sent / wall, replay.truncated);
+    printf("forwarded:   %12.1f packets/s\n", replay.received / wall);
+    printf("latency:     p50 %u us, p99 %u us, p99.9 %u us, max %u us\n",
+           replay.latency.quantile(0.5), replay.latency.quantile(0.99),
+           replay.latency.quantile(0.999), replay.latency.get_max());
+    printf("counters:    in %" PRIu64 ", out %" PRIu64 ", invalid %" PRIu64
+           ", send errors %" PRIu64 ", mix dropped %" PRIu64
+           ", queue dropped %" PRIu64 "\n",
+           m.packets_in, m.packets_out, m.invalid, m.send_errors,
+           m.mix_dropped, m.queue_dropped);
+    uint64_t reordered(0);
+    uint64_t duplicates(0);
+    uint64_t gaps(0);
+    double jitter(0);
+    for(auto& e : m.endpoints) {
+      reordered += e.reordered;
+      duplicates += e.duplicates;
+      gaps += e.gaps;
+      jitter = std::max(jitter, e.jitter_ms);
+    }
+    // sequence numbers of the recording, as seen by the relay:
+    printf("streams:     lost %" PRIu64 ", reordered %" PRIu64
+           ", duplicates %" PRIu64 ", gaps %" PRIu64
+           ", max jitter %1.3f ms\n",
+           m.lost, reordered, duplicates, gaps, jitter);
+    printf("server cpu:  %1.2f%% of one core\n", 100.0 * server_cpu / wall);
+    printf("client cpu:  %1.2f%% of one core\n",
+           100.0 * replay.client_cpu / wall);
+  }
+  catch(const std::exception& e) {
+    fprintf(stderr, "Error: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
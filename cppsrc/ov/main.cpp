@@ -1,9 +1,15 @@
 #include "server/ov-server-wrapper.h"
+#if defined(LINUX)
+#include "server/stage-engine-wrapper.h"
+#endif
 #include <napi.h>
 
 Napi::Object InitAll(Napi::Env env, Napi::Object exports)
 {
   OvServerWrapper::Init(env, exports);
+#if defined(LINUX)
+  OvStageEngineWrapper::Init(env, exports);
+#endif
   return exports;
 }
 
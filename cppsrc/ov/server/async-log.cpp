@@ -0,0 +1,131 @@
+#include "async-log.h"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <string>
+
+thread_local async_log_t::thread_ring_t async_log_t::thread_ring;
+std::mutex async_log_t::mtx;
+size_t async_log_t::users(0);
+std::atomic<bool> async_log_t::running(false);
+std::thread async_log_t::thread;
+std::mutex async_log_t::ringmtx;
+std::vector<async_log_t::ring_t*> async_log_t::rings;
+uint32_t async_log_t::written[LOG_NUMEVENTS];
+uint64_t async_log_t::suppressed[LOG_NUMEVENTS];
+
+static const char* event_names[LOG_NUMEVENTS] = {
+    "sequence error", "peer latency", "latency"};
+
+async_log_t::ring_t* async_log_t::thread_ring_t::attach()
+{
+  ring = new ring_t();
+  std::lock_guard<std::mutex> lk(ringmtx);
+  rings.push_back(ring);
+  return ring;
+}
+
+async_log_t::thread_ring_t::~thread_ring_t()
+{
+  // the logger deletes the ring after writing the remaining records:
+  if(ring)
+    ring->orphaned = true;
+}
+
+void async_log_t::acquire()
+{
+  std::lock_guard<std::mutex> lk(mtx);
+  if(users++ == 0) {
+    running = true;
+    thread = std::thread(&async_log_t::run);
+  }
+}
+
+void async_log_t::release()
+{
+  std::lock_guard<std::mutex> lk(mtx);
+  if(users == 0)
+    return;
+  if(--users == 0) {
+    running = false;
+    thread.join();
+  }
+}
+
+void async_log_t::run()
+{
+  uint32_t ticks(0);
+  while(running) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(LOGPERIODMS));
+    drain();
+    if(++ticks == 1000 / LOGPERIODMS) {
+      // one second is complete, report what the rate limit suppressed:
+      ticks = 0;
+      for(size_t k = 0; k < LOG_NUMEVENTS; ++k) {
+        if(suppressed[k])
+          log(0, "suppressed " + std::to_string(suppressed[k]) + " " +
+                     event_names[k] + " messages");
+        suppressed[k] = 0;
+        written[k] = 0;
+      }
+    }
+  }
+  drain();
+}
+
+void async_log_t::drain()
+{
+  uint64_t dropped(0);
+  std::lock_guard<std::mutex> lk(ringmtx);
+  for(auto it = rings.begin(); it != rings.end();) {
+    ring_t* ring(*it);
+    // records pushed before the thread exited are visible after this:
+    bool orphaned(ring->orphaned);
+    log_record_t* r;
+    while((r = ring->queue.front())) {
+      if(r->type < LOG_NUMEVENTS) {
+        if(written[r->type] < LOGRATELIMIT) {
+          ++written[r->type];
+          write(*r);
+        } else {
+          ++suppressed[r->type];
+        }
+      }
+      ring->queue.release();
+    }
+    dropped += ring->queue.take_dropped();
+    if(orphaned) {
+      delete ring;
+      it = rings.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if(dropped)
+    log(0, "log rings full, dropped " + std::to_string(dropped) + " messages");
+}
+
+void async_log_t::write(const log_record_t& r)
+{
+  char ctmp[1024];
+  switch(r.type) {
+  case LOG_SEQERR:
+    sprintf(ctmp, "sequence error %d sender %.0f %.0f", r.cid, r.v[0], r.v[1]);
+    log(r.portno, ctmp);
+    break;
+  case LOG_PEERLAT:
+    sprintf(ctmp, "peerlat %d-%g min=%1.2fms, mean=%1.2fms, max=%1.2fms",
+            r.cid, r.v[0], r.v[1], r.v[2], r.v[3]);
+    log(r.portno, ctmp);
+    sprintf(ctmp, "packages %d-%g received=%g lost=%g (%1.2f%%)", r.cid,
+            r.v[0], r.v[4], r.v[5],
+            100.0 * r.v[5] / (std::max(1.0, r.v[4] + r.v[5])));
+    log(r.portno, ctmp);
+    break;
+  case LOG_LATENCY:
+    sprintf(ctmp, "latency %d min=%1.2fms, mean=%1.2fms, max=%1.2fms", r.cid,
+            r.v[0], r.v[1], r.v[2]);
+    log(r.portno, ctmp);
+    break;
+  }
+}
@@ -0,0 +1,99 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include "common.h"
+#include "spsc-queue.h"
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+// capacity of the log ring of each thread, in records:
+#define LOGRINGSIZE 256
+// wakeup period of the background logger, in milliseconds:
+#define LOGPERIODMS 50
+// maximum number of records per event type and second, the rest is
+// only counted:
+#define LOGRATELIMIT 20
+
+enum log_event_t {
+  // sequence error reported by a receiver (PORT_SEQREP):
+  LOG_SEQERR,
+  // peer-to-peer latency report (PORT_PEERLATREP):
+  LOG_PEERLAT,
+  // server ping latency of a client:
+  LOG_LATENCY,
+  LOG_NUMEVENTS
+};
+
+/**
+ * Structured log event. The record is formatted by the background
+ * logger, the meaning of the values depends on the event type.
+ */
+struct log_record_t {
+  uint8_t type;
+  stage_device_id_t cid;
+  int portno;
+  double v[6];
+};
+
+/**
+ * Process-wide asynchronous logger. Real-time threads push binary
+ * records into a lock-free ring of their own; a background thread
+ * formats them and writes them with log(). If the ring of a thread is
+ * full, the record is dropped and counted.
+ */
+class async_log_t {
+public:
+  /**
+   * Start the background logger if this is the first user.
+   */
+  static void acquire();
+  /**
+   * Write the pending records and stop the background logger when the
+   * last user is gone.
+   */
+  static void release();
+  /**
+   * Queue a record, called by any thread. Costs a few stores, except
+   * for the first call of a thread, which allocates its ring.
+   */
+  static void push(const log_record_t& r)
+  {
+    ring_t* ring(thread_ring.ring);
+    if(!ring)
+      ring = thread_ring.attach();
+    ring->queue.push(r);
+  };
+
+private:
+  struct ring_t {
+    ring_t() : orphaned(false){};
+    spsc_queue_t<log_record_t, LOGRINGSIZE> queue;
+    // the thread has exited, the ring is deleted once it is drained:
+    std::atomic<bool> orphaned;
+  };
+  struct thread_ring_t {
+    thread_ring_t() : ring(NULL){};
+    ~thread_ring_t();
+    ring_t* attach();
+    ring_t* ring;
+  };
+  static void run();
+  static void drain();
+  static void write(const log_record_t& r);
+  static thread_local thread_ring_t thread_ring;
+  static std::mutex mtx;
+  static size_t users;
+  static std::atomic<bool> running;
+  static std::thread thread;
+  // rings of all threads, protected by ringmtx:
+  static std::mutex ringmtx;
+  static std::vector<ring_t*> rings;
+  // rate limit state, used by the logger thread only:
+  static uint32_t written[LOG_NUMEVENTS];
+  static uint64_t suppressed[LOG_NUMEVENTS];
+};
+
+#endif // ASYNC_LOG_H
@@ -0,0 +1,283 @@
+#include "batch-socket.h"
+#include "errmsg.h"
+#include "send-queue.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#if defined(LINUX)
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
+#endif
+
+rx_batch_t::rx_batch_t() : count(0)
+{
+#if defined(LINUX)
+  memset(hdr, 0, sizeof(hdr));
+  for(size_t k = 0; k < RXBATCHSIZE; ++k) {
+    iov[k].iov_base = buf[k];
+    iov[k].iov_len = BUFSIZE;
+    hdr[k].msg_hdr.msg_iov = &iov[k];
+    hdr[k].msg_hdr.msg_iovlen = 1;
+    hdr[k].msg_hdr.msg_name = &from[k];
+    hdr[k].msg_hdr.msg_namelen = sizeof(endpoint_t);
+  }
+#endif
+}
+
+tx_batch_t::tx_batch_t() : count(0), backlog(NULL)
+{
+#if defined(LINUX)
+  memset(hdr, 0, sizeof(hdr));
+  for(size_t k = 0; k < TXBATCHSIZE; ++k) {
+    hdr[k].msg_hdr.msg_iov = &iov[k];
+    hdr[k].msg_hdr.msg_iovlen = 1;
+    hdr[k].msg_hdr.msg_name = &to[k];
+    hdr[k].msg_hdr.msg_namelen = sizeof(endpoint_t);
+  }
+#endif
+}
+
+ovbox_batch_socket_t::ovbox_batch_socket_t(secret_t secret)
+    : ovbox_udpsocket_t(secret)
+{
+}
+
+size_t ovbox_batch_socket_t::recv_batch(rx_batch_t& batch, bool wait)
+{
+  batch.count = 0;
+#if defined(LINUX)
+  for(size_t k = 0; k < RXBATCHSIZE; ++k)
+    batch.hdr[k].msg_hdr.msg_namelen = sizeof(endpoint_t);
+  // block for the first datagram only, then take what is queued:
+  int r(recvmmsg(sockfd, batch.hdr, RXBATCHSIZE,
+                 wait ? MSG_WAITFORONE : MSG_DONTWAIT, NULL));
+  if(r <= 0)
+    return 0;
+  for(int k = 0; k < r; ++k)
+    batch.len[k] = batch.hdr[k].msg_len;
+  batch.count = r;
+#else
+  socklen_t addrlen(sizeof(endpoint_t));
+  ssize_t n(::recvfrom(sockfd, batch.buf[0], BUFSIZE, wait ? 0 : MSG_DONTWAIT,
+                       (struct sockaddr*)&(batch.from[0]), &addrlen));
+  if(n <= 0)
+    return 0;
+  batch.len[0] = n;
+  batch.count = 1;
+#endif
+  return batch.count;
+}
+
+size_t ovbox_batch_socket_t::recv(char* buf, endpoint_t& from)
+{
+  socklen_t addrlen(sizeof(endpoint_t));
+  ssize_t n(::recvfrom(sockfd, buf, BUFSIZE, 0, (struct sockaddr*)&from,
+                       &addrlen));
+  if(n <= 0)
+    return 0;
+  return n;
+}
+
+char* ovbox_batch_socket_t::decode(char* buf, size_t ilen, size_t& len,
+                                   stage_device_id_t& cid, port_t& destport,
+                                   sequence_t& seq) const
+{
+  if(ilen < HEADERLEN)
+    return NULL;
+  if(msg_secret(buf) != secret)
+    return NULL;
+  cid = msg_callerid(buf);
+  destport = msg_port(buf);
+  seq = msg_seq(buf);
+  len = ilen - HEADERLEN;
+  return &(buf[HEADERLEN]);
+}
+
+size_t ovbox_batch_socket_t::queue(tx_batch_t& batch, const char* buf,
+                                   size_t len, const endpoint_t& ep,
+                                   stage_device_id_t cid)
+{
+  size_t failed(0);
+  if(batch.count == TXBATCHSIZE)
+    failed = flush(batch);
+  size_t k(batch.count);
+  batch.to[k] = ep;
+  batch.cid[k] = cid;
+#if defined(LINUX)
+  batch.iov[k].iov_base = const_cast<char*>(buf);
+  batch.iov[k].iov_len = len;
+#else
+  batch.data[k] = buf;
+  batch.len[k] = len;
+#endif
+  ++batch.count;
+  return failed;
+}
+
+size_t ovbox_batch_socket_t::flush(tx_batch_t& batch)
+{
+  size_t failed(0);
+#if defined(LINUX)
+  size_t sent(0);
+  while(sent < batch.count) {
+    int r(sendmmsg(sockfd, &(batch.hdr[sent]), batch.count - sent,
+                   MSG_DONTWAIT));
+    if(r < 0) {
+      if(errno == EINTR)
+        continue;
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ENOBUFS)) {
+        // the send buffer is full, keep the rest for later:
+        if(!batch.backlog)
+          break;
+        for(size_t k = sent; k < batch.count; ++k)
+          batch.backlog->push(batch.cid[k], batch.to[k],
+                              (const char*)batch.iov[k].iov_base,
+                              batch.iov[k].iov_len);
+        batch.count = 0;
+        return failed;
+      }
+      // skip the datagram which failed, the others may still succeed:
+      r = 1;
+      ++failed;
+    }
+    sent += r;
+  }
+  failed += batch.count - sent;
+#else
+  for(size_t k = 0; k < batch.count; ++k) {
+    send_result_t r(send_nowait(batch.data[k], batch.len[k], batch.to[k]));
+    if((r == SEND_AGAIN) && batch.backlog)
+      batch.backlog->push(batch.cid[k], batch.to[k], batch.data[k],
+                          batch.len[k]);
+    else if(r != SEND_OK)
+      ++failed;
+  }
+#endif
+  batch.count = 0;
+  return failed;
+}
+
+send_result_t ovbox_batch_socket_t::send_nowait(const char* buf, size_t len,
+                                                const endpoint_t& ep)
+{
+  while(::sendto(sockfd, buf, len, MSG_DONTWAIT, (const struct sockaddr*)&ep,
+                 sizeof(ep)) < 0) {
+    if(errno == EINTR)
+      continue;
+    if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ENOBUFS))
+      return SEND_AGAIN;
+    return SEND_FAILED;
+  }
+  return SEND_OK;
+}
+
+bool ovbox_batch_socket_t::send_at(const char* buf, size_t len,
+                                   const endpoint_t& ep, uint64_t txtime_ns)
+{
+#if defined(LINUX) && defined(SO_TXTIME)
+  char control[CMSG_SPACE(sizeof(txtime_ns))];
+  memset(control, 0, sizeof(control));
+  struct iovec iov;
+  iov.iov_base = const_cast<char*>(buf);
+  iov.iov_len = len;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = const_cast<endpoint_t*>(&ep);
+  msg.msg_namelen = sizeof(ep);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr* cm(CMSG_FIRSTHDR(&msg));
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_TXTIME;
+  cm->cmsg_len = CMSG_LEN(sizeof(txtime_ns));
+  memcpy(CMSG_DATA(cm), &txtime_ns, sizeof(txtime_ns));
+  return ::sendmsg(sockfd, &msg, 0) >= 0;
+#else
+  return false;
+#endif
+}
+
+void ovbox_batch_socket_t::set_send_buffer(int bytes)
+{
+  if(bytes <= 0)
+    return;
+  if(setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes)) < 0)
+    throw ErrMsg("Unable to set SO_SNDBUF", errno);
+}
+
+void ovbox_batch_socket_t::set_recv_buffer(int bytes)
+{
+  if(bytes <= 0)
+    return;
+  if(setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) < 0)
+    throw ErrMsg("Unable to set SO_RCVBUF", errno);
+}
+
+bool ovbox_batch_socket_t::enable_txtime()
+{
+#if defined(LINUX) && defined(SO_TXTIME)
+  struct sock_txtime cfg;
+  cfg.clockid = CLOCK_MONOTONIC;
+  cfg.flags = 0;
+  return setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg)) == 0;
+#else
+  return false;
+#endif
+}
+
+void ovbox_batch_socket_t::set_reuseport()
+{
+#if defined(SO_REUSEPORT)
+  int one(1);
+  if(setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+    throw ErrMsg("Unable to set SO_REUSEPORT", errno);
+#endif
+}
+
+void ovbox_batch_socket_t::steer_by_callerid(unsigned int workers)
+{
+  steer_by_byte(POS_CALLERID, workers);
+}
+
+void ovbox_batch_socket_t::steer_by_secret(unsigned int sockets)
+{
+  steer_by_byte(POS_SECRET, sockets);
+}
+
+void ovbox_batch_socket_t::steer_by_byte(size_t pos, unsigned int sockets)
+{
+#if defined(SO_ATTACH_REUSEPORT_CBPF)
+  // the program sees the UDP payload, its result is the index of the
+  // receiving socket in the group (in bind order):
+  struct sock_filter code[] = {
+      {BPF_LD | BPF_B | BPF_ABS, 0, 0, (uint32_t)pos},
+      {BPF_ALU | BPF_MOD | BPF_K, 0, 0, sockets},
+      {BPF_RET | BPF_A, 0, 0, 0},
+  };
+  struct sock_fprog prog;
+  prog.len = sizeof(code) / sizeof(code[0]);
+  prog.filter = code;
+  if(setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                sizeof(prog)) < 0)
+    throw ErrMsg("Unable to attach the reuseport steering program", errno);
+#endif
+}
+
+void ovbox_batch_socket_t::share(const ovbox_batch_socket_t& other)
+{
+  int fd(dup(other.sockfd));
+  if(fd < 0)
+    throw ErrMsg("Unable to share the socket", errno);
+  ::close(sockfd);
+  sockfd = fd;
+}
+
+void ovbox_batch_socket_t::interrupt()
+{
+  // on an unconnected UDP socket, shutdown fails with ENOTCONN, but
+  // still wakes up blocked readers (linux):
+  ::shutdown(sockfd, SHUT_RD);
+}
@@ -0,0 +1,179 @@
+#ifndef BATCH_SOCKET_H
+#define BATCH_SOCKET_H
+
+#include "ov-protocol.h"
+#include "udpsocket.h"
+#include <string.h>
+#include <vector>
+#if defined(LINUX)
+#include <sys/socket.h>
+#endif
+
+// maximum number of datagrams drained per wakeup:
+#define RXBATCHSIZE 32
+// maximum number of datagrams per sendmmsg call (UIO_MAXIOV):
+#define TXBATCHSIZE 1024
+
+class send_queue_t;
+
+enum send_result_t {
+  SEND_OK,
+  // the send buffer is full:
+  SEND_AGAIN,
+  SEND_FAILED
+};
+
+/**
+ * Received datagrams of one recv_batch call. The buffers stay valid
+ * until the next call of recv_batch, so the fan-out can reference them
+ * without copying.
+ */
+class rx_batch_t {
+public:
+  rx_batch_t();
+  size_t count;
+  char buf[RXBATCHSIZE][BUFSIZE];
+  size_t len[RXBATCHSIZE];
+  endpoint_t from[RXBATCHSIZE];
+#if defined(LINUX)
+  struct mmsghdr hdr[RXBATCHSIZE];
+  struct iovec iov[RXBATCHSIZE];
+#endif
+};
+
+/**
+ * Pending outgoing datagrams. Only pointers to the payload are stored,
+ * the caller has to keep the data alive until flush().
+ */
+class tx_batch_t {
+public:
+  tx_batch_t();
+  size_t count;
+  endpoint_t to[TXBATCHSIZE];
+  stage_device_id_t cid[TXBATCHSIZE];
+  // if set, datagrams which would block are moved here by flush():
+  send_queue_t* backlog;
+#if defined(LINUX)
+  struct mmsghdr hdr[TXBATCHSIZE];
+  struct iovec iov[TXBATCHSIZE];
+#else
+  const char* data[TXBATCHSIZE];
+  size_t len[TXBATCHSIZE];
+#endif
+};
+
+/**
+ * ovbox socket with batched receive and send, based on recvmmsg and
+ * sendmmsg. On platforms without these calls, the batches are
+ * processed with one syscall per datagram.
+ */
+class ovbox_batch_socket_t : public ovbox_udpsocket_t {
+public:
+  ovbox_batch_socket_t(secret_t secret);
+  /**
+   * Receive up to RXBATCHSIZE datagrams. If wait is true, blocks until
+   * at least one datagram is available or the socket timeout expires.
+   * @return Number of received datagrams
+   */
+  size_t recv_batch(rx_batch_t& batch, bool wait = true);
+  /**
+   * Receive a single datagram into buf (of size BUFSIZE), blocking until
+   * a datagram is available or the socket timeout expires.
+   * @return Length of the datagram, or zero
+   */
+  size_t recv(char* buf, endpoint_t& from);
+  /**
+   * Relay fast path: authenticate a datagram and classify it from the
+   * fixed header offsets, without decoding the header or copying the
+   * payload. Control datagrams still need decode().
+   * @return True if the datagram is valid and addressed to an audio port
+   */
+  bool peek_audio(const char* buf, size_t len, stage_device_id_t& cid) const
+  {
+    if(len < HEADERLEN)
+      return false;
+    secret_t s;
+    port_t p;
+    memcpy(&s, &buf[POS_SECRET], sizeof(s));
+    memcpy(&p, &buf[POS_PORT], sizeof(p));
+    cid = buf[POS_CALLERID];
+    return (s == secret) && ov_audio_port(p);
+  };
+  /**
+   * Decode and authenticate the header of a received datagram, same as
+   * recv_sec_msg does for a single datagram.
+   * @return Pointer to the payload, or NULL if the datagram is invalid
+   */
+  char* decode(char* buf, size_t ilen, size_t& len, stage_device_id_t& cid,
+               port_t& destport, sequence_t& seq) const;
+  /**
+   * Queue a datagram to receiver cid, flushes the batch if it is full.
+   * @return Number of datagrams which could not be sent by the flush
+   */
+  size_t queue(tx_batch_t& batch, const char* buf, size_t len,
+               const endpoint_t& ep, stage_device_id_t cid);
+  /**
+   * Send all queued datagrams without blocking and clear the batch.
+   * Datagrams which would block go to the backlog of the batch.
+   * @return Number of datagrams which could not be sent
+   */
+  size_t flush(tx_batch_t& batch);
+  /**
+   * Send one datagram without blocking.
+   */
+  send_result_t send_nowait(const char* buf, size_t len, const endpoint_t& ep);
+  /**
+   * Send a datagram at the given CLOCK_MONOTONIC time (SO_TXTIME).
+   * @return False if the datagram was not sent
+   */
+  bool send_at(const char* buf, size_t len, const endpoint_t& ep,
+               uint64_t txtime_ns);
+  /**
+   * Size of the kernel send buffer, zero keeps the system default.
+   */
+  void set_send_buffer(int bytes);
+  /**
+   * Size of the kernel receive buffer, zero keeps the system default.
+   */
+  void set_recv_buffer(int bytes);
+  /**
+   * Allow send_at(), linux only.
+   * @return False if SO_TXTIME is not supported
+   */
+  bool enable_txtime();
+  int get_fd() const { return sockfd; };
+  /**
+   * Allow other sockets to bind to the same port, must be called
+   * before bind().
+   */
+  void set_reuseport();
+  /**
+   * Distribute the datagrams of a SO_REUSEPORT group by caller id, so
+   * that all datagrams of one sender are received by the same socket.
+   * @param workers Number of sockets in the group
+   */
+  void steer_by_callerid(unsigned int workers);
+  /**
+   * Distribute the datagrams of a SO_REUSEPORT group by the low byte of
+   * the session secret (first byte on little endian hosts), so that all
+   * datagrams of one stage are received by the same socket.
+   * @param sockets Number of sockets in the group
+   */
+  void steer_by_secret(unsigned int sockets);
+  /**
+   * Send and receive through the socket of another object, which keeps
+   * its own secret. The socket is duplicated, both objects close their
+   * own descriptor.
+   */
+  void share(const ovbox_batch_socket_t& other);
+  /**
+   * Wake up a thread blocking in a receive call. Later receive calls
+   * return immediately.
+   */
+  void interrupt();
+
+private:
+  void steer_by_byte(size_t pos, unsigned int sockets);
+};
+
+#endif // BATCH_SOCKET_H
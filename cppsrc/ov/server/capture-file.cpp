@@ -0,0 +1,158 @@
+#include "capture-file.h"
+#include "errmsg.h"
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t clock_ns(clockid_t clk)
+{
+  struct timespec t;
+  clock_gettime(clk, &t);
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+capture_writer_t::capture_writer_t(const std::string& path, int portno,
+                                   size_t producers, uint64_t max_file_size,
+                                   uint32_t max_files)
+    : path(path), portno(portno), max_file_size(max_file_size),
+      max_files(std::max(1u, max_files)),
+      start_mono_ns(clock_ns(CLOCK_MONOTONIC)),
+      start_real_ns(clock_ns(CLOCK_REALTIME)), file(NULL), file_size(0),
+      running(true)
+{
+  for(size_t k = 0; k < producers; ++k)
+    fifos.emplace_back(new fifo_t());
+  open();
+  if(!file)
+    throw ErrMsg("Unable to create capture file " + path, errno);
+  log(portno, "capturing received datagrams to " + path);
+  thread = std::thread(&capture_writer_t::run, this);
+}
+
+capture_writer_t::~capture_writer_t()
+{
+  running = false;
+  if(thread.joinable())
+    thread.join();
+  if(file)
+    fclose(file);
+}
+
+void capture_writer_t::push(size_t producer, const char* buf, size_t len,
+                            const endpoint_t& from)
+{
+  packet_t* p(fifos[producer]->reserve());
+  if(!p)
+    return;
+  size_t n(std::min(len, (size_t)CAPTURESNAPLEN));
+  p->rec.time_ns = clock_ns(CLOCK_MONOTONIC) - start_mono_ns;
+  p->rec.addr = from.sin_addr.s_addr;
+  p->rec.port = from.sin_port;
+  p->rec.len = n;
+  p->rec.orig_len = std::min(len, (size_t)UINT16_MAX);
+  p->rec.worker = producer;
+  p->rec.reserved = 0;
+  memcpy(p->data, buf, n);
+  fifos[producer]->commit();
+}
+
+void capture_writer_t::run()
+{
+  uint32_t ticks(0);
+  while(running) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(CAPTUREPERIODMS));
+    drain();
+    if(++ticks == 1000 / CAPTUREPERIODMS) {
+      ticks = 0;
+      uint64_t dropped(0);
+      for(auto& f : fifos)
+        dropped += f->take_dropped();
+      if(dropped)
+        log(portno, "capture queue full, " + std::to_string(dropped) +
+                        " datagrams not recorded");
+    }
+  }
+  drain();
+}
+
+void capture_writer_t::drain()
+{
+  // merge the queues by receive time, each queue is already ordered:
+  while(true) {
+    fifo_t* next(NULL);
+    packet_t* first(NULL);
+    for(auto& f : fifos) {
+      packet_t* p(f->front());
+      if(p && (!first || (p->rec.time_ns < first->rec.time_ns))) {
+        first = p;
+        next = f.get();
+      }
+    }
+    if(!next)
+      break;
+    write(*first);
+    next->release();
+  }
+  if(file)
+    fflush(file);
+}
+
+void capture_writer_t::write(const packet_t& p)
+{
+  if(!file)
+    return;
+  size_t size(capture_record_size(p.rec.len));
+  if(max_file_size && (file_size + size > max_file_size))
+    rotate();
+  if(!file)
+    return;
+  static const char padding[CAPTUREALIGN] = {0};
+  if((fwrite(&p.rec, sizeof(p.rec), 1, file) != 1) ||
+     (fwrite(p.data, 1, p.rec.len, file) != p.rec.len) ||
+     (fwrite(padding, 1, size - sizeof(p.rec) - p.rec.len, file) !=
+      size - sizeof(p.rec) - p.rec.len)) {
+    log(portno, "unable to write capture file " + path + ": " +
+                    strerror(errno) + ", capture stopped");
+    fclose(file);
+    file = NULL;
+    return;
+  }
+  file_size += size;
+}
+
+void capture_writer_t::open()
+{
+  file = fopen(path.c_str(), "wb");
+  if(!file)
+    return;
+  // the writer flushes once per period:
+  setvbuf(file, NULL, _IOFBF, 1 << 18);
+  capture_file_header_t h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CAPTUREMAGIC, sizeof(h.magic));
+  h.version = CAPTUREVERSION;
+  h.header_size = sizeof(h);
+  h.start_ns = start_real_ns;
+  h.snaplen = CAPTURESNAPLEN;
+  h.portno = portno;
+  fwrite(&h, sizeof(h), 1, file);
+  file_size = sizeof(h);
+}
+
+void capture_writer_t::rotate()
+{
+  fclose(file);
+  file = NULL;
+  if(max_files > 1) {
+    for(uint32_t k = max_files - 1; k > 1; --k)
+      rename((path + "." + std::to_string(k - 1)).c_str(),
+             (path + "." + std::to_string(k)).c_str());
+    rename(path.c_str(), (path + ".1").c_str());
+  }
+  open();
+  if(!file)
+    log(portno, "unable to create capture file " + path + ": " +
+                    strerror(errno) + ", capture stopped");
+}
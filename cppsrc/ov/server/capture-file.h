@@ -0,0 +1,132 @@
+#ifndef CAPTURE_FILE_H
+#define CAPTURE_FILE_H
+
+#include "common.h"
+#include "spsc-queue.h"
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// first bytes of a capture file:
+#define CAPTUREMAGIC "OVCAPT01"
+// format version, changed on incompatible changes of the records:
+#define CAPTUREVERSION 1
+// datagrams are truncated to this length (ethernet MTU):
+#define CAPTURESNAPLEN 1472
+// records are padded to a multiple of this size:
+#define CAPTUREALIGN 8
+// capacity of the queue from each relay thread to the capture writer:
+#define CAPTUREFIFOSIZE 512
+// wakeup period of the capture writer, in milliseconds:
+#define CAPTUREPERIODMS 20
+// default size of one capture file before it is rotated, in bytes:
+#define CAPTUREFILESIZE (64u << 20)
+// default number of capture files kept, including the current one:
+#define CAPTUREFILES 4
+
+/**
+ * Header at the start of each capture file. All fields are in host byte
+ * order, except for the sender addresses of the records.
+ */
+struct capture_file_header_t {
+  char magic[8];
+  uint32_t version;
+  // offset of the first record:
+  uint32_t header_size;
+  // wall clock time of the start of the capture, in ns since the epoch:
+  uint64_t start_ns;
+  uint32_t snaplen;
+  int32_t portno;
+};
+
+/**
+ * Record of one received datagram, followed by len bytes of data and
+ * padding up to the next multiple of CAPTUREALIGN. The records of a
+ * file can be read in place from a memory mapping.
+ */
+struct capture_record_t {
+  // receive time, in ns since the start of the capture (monotonic):
+  uint64_t time_ns;
+  // sender address and port, in network byte order:
+  uint32_t addr;
+  uint16_t port;
+  // stored length, at most snaplen:
+  uint16_t len;
+  // length of the datagram as received:
+  uint16_t orig_len;
+  // relay thread which received the datagram:
+  uint16_t worker;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(capture_file_header_t) % CAPTUREALIGN == 0,
+              "capture header breaks the record alignment");
+static_assert(sizeof(capture_record_t) % CAPTUREALIGN == 0,
+              "capture record breaks the record alignment");
+
+/**
+ * Size of a record with its data and padding.
+ */
+inline size_t capture_record_size(size_t len)
+{
+  return (sizeof(capture_record_t) + len + CAPTUREALIGN - 1) &
+         ~(size_t)(CAPTUREALIGN - 1);
+}
+
+/**
+ * Records all datagrams received by a stage into append-only capture
+ * files, for offline replay (see ov-replay). The relay threads only copy
+ * the datagram into their own queue; a background thread writes the
+ * queues to the file, so that file I/O never delays the relay. If a
+ * queue is full, the datagram is not recorded and counted.
+ *
+ * When a file reaches its maximum size it is renamed to path.1 (older
+ * files move to path.2 and so on) and a new file is started, at most
+ * the given number of files is kept. A maximum size of zero disables
+ * the rotation.
+ */
+class capture_writer_t {
+public:
+  /**
+   * @param path Name of the current capture file
+   * @param producers Number of relay threads calling push()
+   */
+  capture_writer_t(const std::string& path, int portno, size_t producers,
+                   uint64_t max_file_size = CAPTUREFILESIZE,
+                   uint32_t max_files = CAPTUREFILES);
+  ~capture_writer_t();
+  /**
+   * Record a datagram, called by relay thread producer only.
+   */
+  void push(size_t producer, const char* buf, size_t len,
+            const endpoint_t& from);
+
+private:
+  struct packet_t {
+    capture_record_t rec;
+    char data[CAPTURESNAPLEN];
+  };
+  typedef spsc_queue_t<packet_t, CAPTUREFIFOSIZE> fifo_t;
+  void run();
+  void drain();
+  void write(const packet_t& p);
+  void open();
+  void rotate();
+  const std::string path;
+  const int portno;
+  const uint64_t max_file_size;
+  const uint32_t max_files;
+  std::vector<std::unique_ptr<fifo_t>> fifos;
+  uint64_t start_mono_ns;
+  uint64_t start_real_ns;
+  FILE* file;
+  uint64_t file_size;
+  std::atomic<bool> running;
+  std::thread thread;
+};
+
+#endif // CAPTURE_FILE_H
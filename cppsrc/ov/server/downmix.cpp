@@ -0,0 +1,294 @@
+#include "downmix.h"
+#include <math.h>
+#include <string.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+void mix_gain_accumulate(float* dst, const float* src, float gain, size_t n)
+{
+  size_t k(0);
+#if defined(__SSE__)
+  __m128 g(_mm_set1_ps(gain));
+  for(; k + 4 <= n; k += 4)
+    _mm_storeu_ps(&dst[k], _mm_add_ps(_mm_loadu_ps(&dst[k]),
+                                      _mm_mul_ps(_mm_loadu_ps(&src[k]), g)));
+#elif defined(__ARM_NEON)
+  float32x4_t g(vdupq_n_f32(gain));
+  for(; k + 4 <= n; k += 4)
+    vst1q_f32(&dst[k], vmlaq_f32(vld1q_f32(&dst[k]), vld1q_f32(&src[k]), g));
+#endif
+  for(; k < n; ++k)
+    dst[k] += gain * src[k];
+}
+
+void pcm_block_t::clear(uint32_t frames_)
+{
+  frames = frames_;
+  for(size_t c = 0; c < MIXCHANNELS; ++c)
+    memset(data[c], 0, frames * sizeof(float));
+}
+
+bool pcm_decode(const char* payload, size_t len, pcm_block_t& block)
+{
+  pcm_header_t h;
+  if(len < sizeof(h))
+    return false;
+  memcpy(&h, payload, sizeof(h));
+  if((h.magic != PCM_MAGIC) || (h.srate == 0) || (h.channels == 0) ||
+     (h.frames == 0) || (h.frames > MIXMAXFRAMES))
+    return false;
+  size_t bps(0);
+  if(h.format == PCM_S16)
+    bps = sizeof(int16_t);
+  else if(h.format == PCM_F32)
+    bps = sizeof(float);
+  else
+    return false;
+  if(len < sizeof(h) + (size_t)h.frames * h.channels * bps)
+    return false;
+  block.clear(h.frames);
+  block.srate = h.srate;
+  const char* p(payload + sizeof(h));
+  for(uint32_t f = 0; f < h.frames; ++f) {
+    for(uint32_t c = 0; c < h.channels; ++c) {
+      float v;
+      if(h.format == PCM_S16) {
+        int16_t s;
+        memcpy(&s, p, sizeof(s));
+        v = s * (1.0f / 32768.0f);
+      } else {
+        memcpy(&v, p, sizeof(v));
+      }
+      p += bps;
+      if(h.channels == 1) {
+        for(size_t oc = 0; oc < MIXCHANNELS; ++oc)
+          block.data[oc][f] = v;
+      } else {
+        block.data[c % MIXCHANNELS][f] += v;
+      }
+    }
+  }
+  return true;
+}
+
+size_t pcm_encode(const pcm_block_t& block, char* payload, size_t maxlen)
+{
+  pcm_header_t h;
+  size_t len(sizeof(h) + block.frames * MIXCHANNELS * sizeof(int16_t));
+  if(len > maxlen)
+    return 0;
+  h.magic = PCM_MAGIC;
+  h.srate = block.srate;
+  h.frames = block.frames;
+  h.channels = MIXCHANNELS;
+  h.format = PCM_S16;
+  memcpy(payload, &h, sizeof(h));
+  int16_t* p((int16_t*)(payload + sizeof(h)));
+  for(uint32_t f = 0; f < block.frames; ++f)
+    for(size_t c = 0; c < MIXCHANNELS; ++c)
+      *p++ = lrintf(
+          std::min(1.0f, std::max(-1.0f, block.data[c][f])) * 32767.0f);
+  return len;
+}
+
+ov_mixer_t::ov_mixer_t(ovbox_batch_socket_t& socket,
+                       const std::atomic<secret_t>& secret,
+                       route_table_t& routes, size_t producers)
+    : socket(socket), secret(secret), routes(routes),
+      reader(routes.add_reader()), num_receivers(0), inputs(MAXEP),
+      fresh(MAXEP, false), destport(0), seq(0), period(0)
+{
+  for(size_t k = 0; k < producers; ++k)
+    fifos.emplace_back(new fifo_t());
+}
+
+bool ov_mixer_t::has_receivers(const endpoint_state_t& endpoints)
+{
+  // an external mixer client sends with the last caller id:
+  if(endpoints.active(MAXEP - 1))
+    return false;
+  for(size_t k = 0; k < EPWORDS; ++k)
+    if(endpoints.downmix_set[k])
+      return true;
+  return false;
+}
+
+bool ov_mixer_t::push(size_t producer, const char* buf, size_t len)
+{
+  if((len > MIXMAXPACKET) || (producer >= fifos.size()))
+    return false;
+  packet_t* p(fifos[producer]->reserve());
+  if(!p)
+    return false;
+  p->len = len;
+  memcpy(p->data, buf, len);
+  fifos[producer]->commit();
+  return true;
+}
+
+size_t ov_mixer_t::get_queue_depth() const
+{
+  size_t depth(0);
+  for(auto& fifo : fifos)
+    depth += fifo->size();
+  return depth;
+}
+
+void ov_mixer_t::process(std::chrono::steady_clock::time_point now)
+{
+  for(auto& fifo : fifos) {
+    packet_t* p;
+    while((p = fifo->front())) {
+      if(p->len >= HEADERLEN) {
+        stage_device_id_t cid(msg_callerid(p->data));
+        if((cid < MAXEP) && pcm_decode(&(p->data[HEADERLEN]),
+                                       p->len - HEADERLEN, inputs[cid])) {
+          fresh[cid] = true;
+          destport = msg_port(p->data);
+          period = std::chrono::microseconds(
+              (uint64_t)inputs[cid].frames * 1000000 / inputs[cid].srate);
+        }
+      }
+      fifo->release();
+    }
+  }
+  if(period.count() == 0)
+    return;
+  // wait for the first block of the next period:
+  if((now < next_mix) || !mix())
+    return;
+  next_mix += period;
+  // do not try to catch up after a stall:
+  if(next_mix < now)
+    next_mix = now + period;
+}
+
+bool ov_mixer_t::mix()
+{
+  const pcm_block_t* first(NULL);
+  for(stage_device_id_t cid = 0; cid != MAXEP; ++cid)
+    if(fresh[cid]) {
+      first = &inputs[cid];
+      break;
+    }
+  if(!first)
+    return false;
+  {
+    // only the bit sets and the addresses of the receivers are read:
+    route_table_t::read_guard_t route(routes, reader);
+    const endpoint_state_t& endpoints(route->endpoints);
+    num_receivers = 0;
+    if(has_receivers(endpoints))
+      for(size_t k = 0; k < EPWORDS; ++k)
+        for(uint64_t w = endpoints.downmix_set[k]; w; w &= w - 1) {
+          stage_device_id_t cid(k * 64 + __builtin_ctzll(w));
+          receiver_cid[num_receivers] = cid;
+          receiver_ep[num_receivers] = endpoints.ep[cid];
+          ++num_receivers;
+        }
+  }
+  if(!num_receivers) {
+    fresh.assign(MAXEP, false);
+    return true;
+  }
+  // the sum of all senders is computed once, each receiver gets the
+  // sum minus its own signal:
+  total.clear(first->frames);
+  total.srate = first->srate;
+  for(stage_device_id_t cid = 0; cid != MAXEP; ++cid)
+    if(fresh[cid])
+      for(size_t c = 0; c < MIXCHANNELS; ++c)
+        mix_gain_accumulate(total.data[c], inputs[cid].data[c], 1.0f,
+                            std::min(total.frames, inputs[cid].frames));
+  char total_payload[BUFSIZE - HEADERLEN];
+  char own_payload[BUFSIZE - HEADERLEN];
+  size_t total_len(pcm_encode(total, total_payload, sizeof(total_payload)));
+  for(size_t r = 0; r < num_receivers; ++r) {
+    stage_device_id_t cid(receiver_cid[r]);
+    const char* payload(total_payload);
+    size_t len(total_len);
+    if(fresh[cid]) {
+      out.frames = total.frames;
+      out.srate = total.srate;
+      for(size_t c = 0; c < MIXCHANNELS; ++c) {
+        memcpy(out.data[c], total.data[c], total.frames * sizeof(float));
+        mix_gain_accumulate(out.data[c], inputs[cid].data[c], -1.0f,
+                            std::min(out.frames, inputs[cid].frames));
+      }
+      payload = own_payload;
+      len = pcm_encode(out, own_payload, sizeof(own_payload));
+    }
+    if(!len)
+      continue;
+    size_t n(packmsg(buffer, BUFSIZE, secret, MAXEP - 1, destport, seq,
+                     payload, len));
+    socket.send(buffer, n, receiver_ep[r]);
+  }
+  ++seq;
+  fresh.assign(MAXEP, false);
+  return true;
+}
+
+std::mutex mix_pool_t::mtx;
+std::vector<mix_pool_t::worker_t*> mix_pool_t::workers;
+size_t mix_pool_t::num_mixers(0);
+std::atomic<bool> mix_pool_t::running(false);
+
+void mix_pool_t::add(ov_mixer_t* mixer)
+{
+  std::lock_guard<std::mutex> lk(mtx);
+  running = true;
+  worker_t* w(NULL);
+  for(auto c : workers)
+    if(!w || (c->mixers.size() < w->mixers.size()))
+      w = c;
+  if((!w || !w->mixers.empty()) &&
+     (workers.size() < std::max(1u, std::thread::hardware_concurrency()))) {
+    w = new worker_t();
+    w->thread = std::thread(&mix_pool_t::run, w);
+    workers.push_back(w);
+  }
+  std::lock_guard<std::mutex> wlk(w->mtx);
+  w->mixers.push_back(mixer);
+  ++num_mixers;
+}
+
+void mix_pool_t::remove(ov_mixer_t* mixer)
+{
+  std::lock_guard<std::mutex> lk(mtx);
+  for(auto w : workers) {
+    std::lock_guard<std::mutex> wlk(w->mtx);
+    for(auto it = w->mixers.begin(); it != w->mixers.end(); ++it)
+      if(*it == mixer) {
+        w->mixers.erase(it);
+        --num_mixers;
+        break;
+      }
+  }
+  if(num_mixers)
+    return;
+  running = false;
+  for(auto w : workers) {
+    w->thread.join();
+    delete w;
+  }
+  workers.clear();
+}
+
+void mix_pool_t::run(worker_t* w)
+{
+  std::chrono::steady_clock::time_point next(std::chrono::steady_clock::now());
+  while(running) {
+    next += std::chrono::microseconds(MIXTICKUS);
+    std::this_thread::sleep_until(next);
+    std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+    if(now - next > std::chrono::microseconds(10 * MIXTICKUS))
+      next = now;
+    std::lock_guard<std::mutex> lk(w->mtx);
+    for(auto mixer : w->mixers)
+      mixer->process(now);
+  }
+}
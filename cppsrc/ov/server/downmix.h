@@ -0,0 +1,152 @@
+#ifndef DOWNMIX_H
+#define DOWNMIX_H
+
+#include "batch-socket.h"
+#include "callerlist.h"
+#include "ov-protocol.h"
+#include "route-table.h"
+#include "spsc-queue.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// number of output channels of the server mix:
+#define MIXCHANNELS 2
+// maximum number of frames per audio packet:
+#define MIXMAXFRAMES 512
+// maximum size of a datagram passed to the mixer (ethernet MTU):
+#define MIXMAXPACKET 1472
+// capacity of the queue from each relay worker to the mixer:
+#define MIXFIFOSIZE 128
+// wakeup period of the mix pool threads, in microseconds:
+#define MIXTICKUS 500
+
+/**
+ * dst[k] += gain * src[k], vectorized with SSE or NEON where available.
+ */
+void mix_gain_accumulate(float* dst, const float* src, float gain, size_t n);
+
+/**
+ * One period of planar audio with MIXCHANNELS channels.
+ */
+class pcm_block_t {
+public:
+  pcm_block_t() : frames(0), srate(0){};
+  void clear(uint32_t frames);
+  uint32_t frames;
+  uint32_t srate;
+  float data[MIXCHANNELS][MIXMAXFRAMES];
+};
+
+/**
+ * Decode a PCM payload (see pcm_header_t). Mono input is copied to all
+ * output channels, additional input channels are folded onto the output
+ * channels.
+ * @return False if the payload is not valid PCM
+ */
+bool pcm_decode(const char* payload, size_t len, pcm_block_t& block);
+
+/**
+ * Encode a block as 16 bit PCM, with clipping.
+ * @return Size of the payload, or zero if it does not fit
+ */
+size_t pcm_encode(const pcm_block_t& block, char* payload, size_t maxlen);
+
+/**
+ * Server side mixer of one stage. The relay workers pass copies of the
+ * audio datagrams through lock free queues; a mix pool thread decodes
+ * them and sends one mix per period to each B_DOWNMIXONLY receiver,
+ * containing all other senders.
+ */
+class ov_mixer_t {
+public:
+  /**
+   * @param routes Route table of the stage, the receivers are taken
+   * from its endpoint state
+   */
+  ov_mixer_t(ovbox_batch_socket_t& socket, const std::atomic<secret_t>& secret,
+             route_table_t& routes, size_t producers);
+  /**
+   * Is there a receiver for the server mix? Receivers are downmix-only
+   * endpoints, as long as no external mixer client is connected.
+   */
+  static bool has_receivers(const endpoint_state_t& endpoints);
+  /**
+   * Queue a received audio datagram, called by one relay worker each.
+   * Never blocks, the datagram is dropped if the queue is full.
+   * @return False if the datagram was dropped
+   */
+  bool push(size_t producer, const char* buf, size_t len);
+  /**
+   * Number of datagrams waiting in the queues, any thread may call.
+   */
+  size_t get_queue_depth() const;
+  /**
+   * Decode the queued datagrams and send the mix if a period is
+   * complete, called by the mix pool.
+   */
+  void process(std::chrono::steady_clock::time_point now);
+
+private:
+  struct packet_t {
+    uint16_t len;
+    char data[MIXMAXPACKET];
+  };
+  typedef spsc_queue_t<packet_t, MIXFIFOSIZE> fifo_t;
+  /**
+   * @return False if no sender had a new block
+   */
+  bool mix();
+  ovbox_batch_socket_t& socket;
+  const std::atomic<secret_t>& secret;
+  route_table_t& routes;
+  const size_t reader;
+  // receivers of the current period, copied from the route table:
+  size_t num_receivers;
+  stage_device_id_t receiver_cid[MAXEP];
+  endpoint_t receiver_ep[MAXEP];
+  std::vector<std::unique_ptr<fifo_t>> fifos;
+  packet_t packet;
+  // latest block of each sender, and whether it is not yet mixed:
+  std::vector<pcm_block_t> inputs;
+  std::vector<bool> fresh;
+  pcm_block_t total;
+  pcm_block_t out;
+  port_t destport;
+  sequence_t seq;
+  std::chrono::steady_clock::time_point next_mix;
+  std::chrono::microseconds period;
+  char buffer[BUFSIZE];
+};
+
+/**
+ * Process-wide pool of mix threads. Each mixer is served by one thread:
+ * a new thread is started for each mixer up to the number of cores,
+ * then mixers are added to the least loaded thread. The threads run
+ * while there is at least one mixer.
+ */
+class mix_pool_t {
+public:
+  static void add(ov_mixer_t* mixer);
+  /**
+   * Remove a mixer, waits until it is no longer processed.
+   */
+  static void remove(ov_mixer_t* mixer);
+
+private:
+  struct worker_t {
+    std::mutex mtx;
+    std::vector<ov_mixer_t*> mixers;
+    std::thread thread;
+  };
+  static void run(worker_t* w);
+  static std::mutex mtx;
+  static std::vector<worker_t*> workers;
+  static size_t num_mixers;
+  static std::atomic<bool> running;
+};
+
+#endif // DOWNMIX_H
@@ -0,0 +1,28 @@
+#include "latency-matrix.h"
+
+void latency_matrix_t::update(const latreport_t& lr)
+{
+  cell_t& c(cells[(lr.src << 8) | lr.dest]);
+  c.latency = lr.tmean;
+  c.jitter = lr.jitter;
+  c.received = lr.received;
+  c.lost = lr.lost;
+  c.updated = true;
+}
+
+size_t latency_matrix_t::take_updates(std::vector<double>& rows)
+{
+  rows.clear();
+  for(auto& c : cells) {
+    if(!c.second.updated)
+      continue;
+    c.second.updated = false;
+    rows.push_back(c.first >> 8);
+    rows.push_back(c.first & 0xff);
+    rows.push_back(c.second.latency);
+    rows.push_back(c.second.jitter);
+    rows.push_back(c.second.received);
+    rows.push_back(c.second.lost);
+  }
+  return rows.size() / LATMATRIXFIELDS;
+}
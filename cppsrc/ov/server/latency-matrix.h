@@ -0,0 +1,54 @@
+#ifndef LATENCY_MATRIX_H
+#define LATENCY_MATRIX_H
+
+#include "common.h"
+#include <map>
+#include <vector>
+
+// number of values per row of a latency matrix snapshot:
+// src, dest, latency, jitter, received, lost
+#define LATMATRIXFIELDS 6
+
+class latreport_t {
+public:
+  latreport_t() : src(0), dest(0), tmean(0), jitter(0), received(0), lost(0){};
+  latreport_t(stage_device_id_t src_, stage_device_id_t dest_, double tmean_,
+              double jitter_, double received_ = 0, double lost_ = 0)
+      : src(src_), dest(dest_), tmean(tmean_), jitter(jitter_),
+        received(received_), lost(lost_){};
+  stage_device_id_t src;
+  stage_device_id_t dest;
+  double tmean;
+  double jitter;
+  double received;
+  double lost;
+};
+
+/**
+ * Latest latency, jitter and packet loss of all device pairs of a
+ * stage. Reports are accumulated and delivered as one snapshot instead
+ * of one event per report.
+ */
+class latency_matrix_t {
+public:
+  void update(const latreport_t& lr);
+  /**
+   * Take all pairs which were updated since the last call.
+   * @param rows Output, LATMATRIXFIELDS values per pair
+   * @return Number of pairs
+   */
+  size_t take_updates(std::vector<double>& rows);
+
+private:
+  struct cell_t {
+    double latency;
+    double jitter;
+    double received;
+    double lost;
+    bool updated;
+  };
+  // cells by (src << 8) | dest:
+  std::map<uint16_t, cell_t> cells;
+};
+
+#endif // LATENCY_MATRIX_H
@@ -0,0 +1,81 @@
+#ifndef OV_PROTOCOL_H
+#define OV_PROTOCOL_H
+
+#include "common.h"
+
+/*
+ * Router extensions of the ovbox protocol. All extension messages are
+ * sent to one dedicated control port, the sequence field of the header
+ * carries the message type. The server sends them only to clients which
+ * announced the extensions with ROUTEREXT_HELLO or ROUTEREXT_SUBSCRIBE,
+ * all other clients get the legacy messages.
+ */
+// first port above the control ports reserved by libov, never used for
+// audio:
+#define PORT_ROUTEREXT (MAXSPECIALPORT + 1)
+
+static_assert(PORT_ROUTEREXT > MAXSPECIALPORT,
+              "PORT_ROUTEREXT is in the range of the libov control ports");
+static_assert((PORT_ROUTEREXT != PORT_REGISTER) &&
+                  (PORT_ROUTEREXT != PORT_LISTCID) &&
+                  (PORT_ROUTEREXT != PORT_PING) &&
+                  (PORT_ROUTEREXT != PORT_PONG) &&
+                  (PORT_ROUTEREXT != PORT_SEQREP) &&
+                  (PORT_ROUTEREXT != PORT_SETLOCALIP) &&
+                  (PORT_ROUTEREXT != PORT_PEERLATREP),
+              "PORT_ROUTEREXT is used by libov");
+#ifdef PORT_PING_SRV
+static_assert((PORT_ROUTEREXT != PORT_PING_SRV) &&
+                  (PORT_ROUTEREXT != PORT_PONG_SRV),
+              "PORT_ROUTEREXT is used by libov");
+#endif
+#ifdef PORT_PING_LOCAL
+static_assert((PORT_ROUTEREXT != PORT_PING_LOCAL) &&
+                  (PORT_ROUTEREXT != PORT_PONG_LOCAL),
+              "PORT_ROUTEREXT is used by libov");
+#endif
+
+/**
+ * Is a destination port an audio port? The ports up to MAXSPECIALPORT
+ * and PORT_ROUTEREXT carry control messages.
+ */
+inline bool ov_audio_port(port_t p)
+{
+  return (p > MAXSPECIALPORT) && (p != PORT_ROUTEREXT);
+}
+
+// compact participant list, see participant_list_t:
+#define ROUTEREXT_PARTICIPANTS 1
+// client to server: bit mask of the senders a client wants to receive,
+// bit (cid % 8) of byte (cid / 8). Senders beyond the end of the mask
+// are received, an empty mask subscribes to all senders:
+#define ROUTEREXT_SUBSCRIBE 2
+
+// router to router: participant list of a trunk, see trunk_table_t:
+#define ROUTEREXT_TRUNK 3
+// client to server: the client understands the router extensions and
+// gets the compact participant list instead of the legacy messages:
+#define ROUTEREXT_HELLO 4
+
+// caller id used in messages originating from the server:
+#define SERVER_CALLERID MAXEP
+
+/*
+ * Raw PCM audio payload which the server can decode and mix for
+ * B_DOWNMIXONLY receivers: a pcm_header_t, followed by interleaved
+ * samples in little endian byte order. Other audio payloads are
+ * relayed, but not mixed.
+ */
+#define PCM_MAGIC 0x4d435056
+#define PCM_S16 1
+#define PCM_F32 2
+
+struct pcm_header_t {
+  uint32_t magic;
+  uint32_t srate;
+  uint16_t frames;
+  uint8_t channels;
+  uint8_t format;
+};
+
+#endif // OV_PROTOCOL_H
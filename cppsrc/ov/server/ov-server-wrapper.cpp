@@ -1,4 +1,5 @@
 #include "napi-thread-safe-callback.hpp"
+#include <algorithm>
 #include <chrono>
 #include <thread>
 
@@ -11,7 +12,10 @@ Napi::Object OvServerWrapper::Init(Napi::Env env, Napi::Object exports)
   Napi::HandleScope scope(env);
 
   Napi::Function func = DefineClass(
-      env, "OvServerWrapper", {InstanceMethod("stop", &OvServerWrapper::Stop)});
+      env, "OvServerWrapper",
+      {InstanceMethod("stop", &OvServerWrapper::Stop),
+       InstanceMethod("getMetrics", &OvServerWrapper::GetMetrics),
+       InstanceMethod("addTrunk", &OvServerWrapper::AddTrunk)});
 
   constructor = Napi::Persistent(func);
   constructor.SuppressDestruct();
@@ -21,13 +25,13 @@ Napi::Object OvServerWrapper::Init(Napi::Env env, Napi::Object exports)
 }
 
 OvServerWrapper::OvServerWrapper(const Napi::CallbackInfo& info)
-    : Napi::ObjectWrap<OvServerWrapper>(info)
+    : Napi::ObjectWrap<OvServerWrapper>(info), ov_server_(NULL)
 {
   Napi::Env env = info.Env();
   int length = info.Length();
 
-  if(length != 3) {
-    Napi::TypeError::New(env, "Three arguments expected")
+  if(length != 3 && length != 4) {
+    Napi::TypeError::New(env, "Three or four arguments expected")
         .ThrowAsJavaScriptException();
   }
 
@@ -40,26 +44,89 @@ OvServerWrapper::OvServerWrapper(const Napi::CallbackInfo& info)
         .ThrowAsJavaScriptException();
   }
 
+  if(length == 4 && !info[3].IsObject()) {
+    Napi::TypeError::New(env, "Fourth argument is not an object")
+        .ThrowAsJavaScriptException();
+  }
+
   // Initialize class
   Napi::Number portno = info[0].As<Napi::Number>();
   Napi::Number prio = info[1].As<Napi::Number>();
   Napi::String stage_id = info[2].As<Napi::String>();
-  this->ov_server_ =
-      new ov_server_t(portno.DoubleValue(), prio.DoubleValue(), stage_id);
+  ov_server_options_t options;
+  if(length == 4)
+    options = ParseOptions(info[3].As<Napi::Object>());
+  try {
+    this->ov_server_ = new ov_server_t(
+        portno.DoubleValue(), prio.DoubleValue(), stage_id, options);
+  }
+  catch(const std::exception& e) {
+    Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+    return;
+  }
 
   // Bind events
   auto callback = std::make_shared<ThreadSafeCallback>(
       info.This().As<Napi::Object>(),
       info.This().As<Napi::Object>().Get("emit").As<Napi::Function>());
+  BindEvents(this->ov_server_, callback);
+  // the threads see the bound callbacks:
+  this->ov_server_->start();
+}
 
-  this->ov_server_->on_ready = [callback](int port) {
+ov_server_options_t OvServerWrapper::ParseOptions(const Napi::Object& opts)
+{
+  ov_server_options_t options;
+  if(opts.Has("batchedIo") && opts.Get("batchedIo").ToBoolean())
+    options.io_mode = OV_IO_BATCHED;
+  if(opts.Has("ioUring") && opts.Get("ioUring").ToBoolean())
+    options.io_mode = OV_IO_URING;
+  if(opts.Has("latencyInterval") && opts.Get("latencyInterval").IsNumber())
+    options.latency_interval_ms =
+        opts.Get("latencyInterval").As<Napi::Number>().Uint32Value();
+  if(opts.Has("relayWorkers") && opts.Get("relayWorkers").IsNumber())
+    options.relay_workers =
+        opts.Get("relayWorkers").As<Napi::Number>().Uint32Value();
+  if(opts.Has("serverDownmix") && opts.Get("serverDownmix").ToBoolean())
+    options.server_downmix = true;
+  if(opts.Has("sendBuffer") && opts.Get("sendBuffer").IsNumber())
+    options.send_buffer =
+        opts.Get("sendBuffer").As<Napi::Number>().Int32Value();
+  if(opts.Has("txtime") && opts.Get("txtime").ToBoolean())
+    options.txtime = true;
+  if(opts.Has("captureDir") && opts.Get("captureDir").IsString())
+    options.capture_dir =
+        opts.Get("captureDir").As<Napi::String>().Utf8Value();
+  if(opts.Has("captureFileSize") && opts.Get("captureFileSize").IsNumber())
+    options.capture_file_size =
+        opts.Get("captureFileSize").As<Napi::Number>().Int64Value();
+  if(opts.Has("captureFiles") && opts.Get("captureFiles").IsNumber())
+    options.capture_files =
+        opts.Get("captureFiles").As<Napi::Number>().Uint32Value();
+  if(opts.Has("sharedPort") && opts.Get("sharedPort").IsNumber())
+    options.shared_port =
+        opts.Get("sharedPort").As<Napi::Number>().Int32Value();
+  if(opts.Has("trunkKey") && opts.Get("trunkKey").IsNumber())
+    options.trunk_key =
+        opts.Get("trunkKey").As<Napi::Number>().Uint32Value();
+  return options;
+}
+
+void OvServerWrapper::BindEvents(ov_server_t* server,
+                                 std::shared_ptr<ThreadSafeCallback> callback)
+{
+  std::string stage_id(server->get_stage_id());
+
+  server->on_ready = [callback, stage_id](int port) {
     // Call back with result
-    callback->call([port](Napi::Env env, std::vector<napi_value>& args) {
-      args = {Napi::String::New(env, "ready"), Napi::Number::New(env, port)};
-    });
+    callback->call(
+        [port, stage_id](Napi::Env env, std::vector<napi_value>& args) {
+          args = {Napi::String::New(env, "ready"), Napi::Number::New(env, port),
+                  Napi::String::New(env, stage_id)};
+        });
   };
 
-  this->ov_server_->on_connect = [callback](connection_report_t report) {
+  server->on_connect = [callback](connection_report_t report) {
     // Call back with result
     callback->call([report](Napi::Env env, std::vector<napi_value>& args) {
       Napi::Object obj = Napi::Object::New(env);
@@ -78,7 +145,7 @@ OvServerWrapper::OvServerWrapper(const Napi::CallbackInfo& info)
     });
   };
 
-  this->ov_server_->on_latency = [callback](latency_report_t report) {
+  server->on_latency = [callback](latency_report_t report) {
     // Call back with result
     callback->call([report](Napi::Env env, std::vector<napi_value>& args) {
       Napi::Object obj = Napi::Object::New(env);
@@ -91,7 +158,22 @@ OvServerWrapper::OvServerWrapper(const Napi::CallbackInfo& info)
     });
   };
 
-  this->ov_server_->on_status = [callback](status_report_t report) {
+  server->on_latency_matrix =
+      [callback](const latency_matrix_report_t& report) {
+        std::string stage_id(report.stage_id);
+        std::vector<double> rows(report.rows);
+        // Call back with result, one typed array for all device pairs
+        callback->call(
+            [stage_id, rows](Napi::Env env, std::vector<napi_value>& args) {
+              Napi::Float64Array matrix =
+                  Napi::Float64Array::New(env, rows.size());
+              std::copy(rows.begin(), rows.end(), matrix.Data());
+              args = {Napi::String::New(env, "latencyMatrix"),
+                      Napi::String::New(env, stage_id), matrix};
+            });
+      };
+
+  server->on_status = [callback](status_report_t report) {
     // Call back with result
     callback->call([report](Napi::Env env, std::vector<napi_value>& args) {
       Napi::Object obj = Napi::Object::New(env);
@@ -99,21 +181,121 @@ OvServerWrapper::OvServerWrapper(const Napi::CallbackInfo& info)
       obj.Set("pin", report.pin);
       obj.Set("serverjitter", report.serverjitter);
       obj.Set("port", report.portno);
+      obj.Set("jitterP50", report.jitter_p50);
+      obj.Set("jitterP99", report.jitter_p99);
+      obj.Set("jitterP999", report.jitter_p999);
       args = {Napi::String::New(env, "status"), obj};
     });
   };
 
-  this->ov_server_->on_disconnect = [callback](stage_device_id_t id) {
+  server->on_closed = [callback, stage_id](int port) {
     // Call back with result
-    callback->call([id](Napi::Env env, std::vector<napi_value>& args) {
-      args = {Napi::String::New(env, "disconnect"), Napi::Number::New(env, id)};
-    });
+    callback->call(
+        [port, stage_id](Napi::Env env, std::vector<napi_value>& args) {
+          args = {Napi::String::New(env, "closed"), Napi::Number::New(env, port),
+                  Napi::String::New(env, stage_id)};
+        });
+  };
+
+  server->on_disconnect = [callback, stage_id](stage_device_id_t id) {
+    // Call back with result
+    callback->call(
+        [id, stage_id](Napi::Env env, std::vector<napi_value>& args) {
+          args = {Napi::String::New(env, "disconnect"),
+                  Napi::Number::New(env, id), Napi::String::New(env, stage_id)};
+        });
   };
 }
 
+OvServerWrapper::~OvServerWrapper()
+{
+  ov_server_release(this->ov_server_);
+  this->ov_server_ = NULL;
+}
+
 Napi::Value OvServerWrapper::Stop(const Napi::CallbackInfo& info)
 {
   Napi::Env env = info.Env();
-  this->ov_server_->stop();
+  // the closed event is emitted when the port is free:
+  ov_server_release(this->ov_server_);
+  this->ov_server_ = NULL;
   return Napi::String::New(env, "stopped");
-}
\ No newline at end of file
+}
+
+Napi::Value OvServerWrapper::GetMetrics(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  if(!this->ov_server_)
+    return env.Null();
+  stage_metrics_t metrics;
+  this->ov_server_->get_counters()->snapshot(metrics);
+  return MetricsToObject(env, metrics);
+}
+
+Napi::Value OvServerWrapper::AddTrunk(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  if(info.Length() != 1 || !info[0].IsString()) {
+    Napi::TypeError::New(env, "Trunk address expected")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(!this->ov_server_)
+    return env.Null();
+  try {
+    this->ov_server_->add_trunk(info[0].As<Napi::String>().Utf8Value());
+  }
+  catch(const std::exception& e) {
+    Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+  }
+  return env.Null();
+}
+
+Napi::Object OvServerWrapper::MetricsToObject(Napi::Env env,
+                                              const stage_metrics_t& m)
+{
+  // counters are converted to doubles, exact up to 2^53:
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("stageId", m.stage_id);
+  obj.Set("port", m.portno);
+  obj.Set("packetsIn", (double)m.packets_in);
+  obj.Set("bytesIn", (double)m.bytes_in);
+  obj.Set("packetsOut", (double)m.packets_out);
+  obj.Set("bytesOut", (double)m.bytes_out);
+  obj.Set("seqErrors", (double)m.seq_errors);
+  obj.Set("lost", (double)m.lost);
+  obj.Set("invalid", (double)m.invalid);
+  obj.Set("sendErrors", (double)m.send_errors);
+  obj.Set("mixDropped", (double)m.mix_dropped);
+  obj.Set("sendQueueDropped", (double)m.queue_dropped);
+  obj.Set("trunkIn", (double)m.trunk_in);
+  obj.Set("trunkOut", (double)m.trunk_out);
+  obj.Set("latencyReportsDropped", (double)m.latreports_dropped);
+  obj.Set("latencyQueueDepth", (double)m.latfifo_depth);
+  obj.Set("mixQueueDepth", (double)m.mixfifo_depth);
+  Napi::Object sched = Napi::Object::New(env);
+  sched.Set("p50", m.sched.p50);
+  sched.Set("p99", m.sched.p99);
+  sched.Set("p999", m.sched.p999);
+  sched.Set("max", m.sched.max);
+  obj.Set("schedLatency", sched);
+  Napi::Array endpoints = Napi::Array::New(env, m.endpoints.size());
+  for(size_t k = 0; k < m.endpoints.size(); ++k) {
+    const endpoint_metrics_t& e(m.endpoints[k]);
+    Napi::Object ep = Napi::Object::New(env);
+    ep.Set("ovStageDeviceId", e.cid);
+    ep.Set("packetsIn", (double)e.packets_in);
+    ep.Set("bytesIn", (double)e.bytes_in);
+    ep.Set("packetsOut", (double)e.packets_out);
+    ep.Set("bytesOut", (double)e.bytes_out);
+    ep.Set("seqErrors", (double)e.seq_errors);
+    ep.Set("lost", (double)e.lost);
+    ep.Set("reordered", (double)e.reordered);
+    ep.Set("duplicates", (double)e.duplicates);
+    ep.Set("gaps", (double)e.gaps);
+    ep.Set("jitter", e.jitter_ms);
+    endpoints.Set((uint32_t)k, ep);
+  }
+  obj.Set("endpoints", endpoints);
+  return obj;
+}
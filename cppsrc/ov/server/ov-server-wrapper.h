@@ -1,15 +1,29 @@
 #include "ov-server.h"
+#include <memory>
 #include <napi.h>
 
+class ThreadSafeCallback;
+
 class OvServerWrapper : public Napi::ObjectWrap<OvServerWrapper> {
 public:
   static Napi::Object Init(Napi::Env env, Napi::Object exports);
   OvServerWrapper(const Napi::CallbackInfo& info);
-  //~NativeEmitter();
+  ~OvServerWrapper();
+  static ov_server_options_t ParseOptions(const Napi::Object& opts);
+  /**
+   * Forward the events of a server to the emit function of a JS object.
+   * The ready and disconnect events carry the stage id as last argument.
+   */
+  static void BindEvents(ov_server_t* server,
+                         std::shared_ptr<ThreadSafeCallback> callback);
+  static Napi::Object MetricsToObject(Napi::Env env,
+                                      const stage_metrics_t& metrics);
 
 private:
   static Napi::FunctionReference constructor;
   Napi::Value Stop(const Napi::CallbackInfo& info);
+  Napi::Value GetMetrics(const Napi::CallbackInfo& info);
+  Napi::Value AddTrunk(const Napi::CallbackInfo& info);
 
   ov_server_t* ov_server_;
 };
@@ -1,53 +1,158 @@
 #include "ov-server.h"
+#include <memory>
+#if defined(LINUX)
+#include "uring-socket.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
-static bool quit_app(false);
+static int64_t monotonic_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
 
-ov_server_t::ov_server_t(int portno_, int prio, const std::string& stage_id)
-    : portno(portno_), prio(prio), secret(1234), socket(secret),
-      runsession(true), stage_id(stage_id), serverjitter(-1)
+static uint64_t random_seed()
 {
-  // Init chrono and seed
-  std::chrono::high_resolution_clock::time_point start(
-      std::chrono::high_resolution_clock::now());
-  std::chrono::high_resolution_clock::time_point end(
-      std::chrono::high_resolution_clock::now());
-  unsigned int seed(
-      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
-          .count());
-  seed += portno;
-  // initialize random generator:
-  srandom(seed);
+  uint64_t seed(0);
+#if defined(LINUX)
+  if(syscall(SYS_getrandom, &seed, sizeof(seed), 0) == sizeof(seed))
+    return seed;
+#endif
+  std::random_device rd;
+  seed = ((uint64_t)rd() << 32) ^ rd();
+  return seed ^ std::chrono::steady_clock::now().time_since_epoch().count();
+}
 
+ov_server_t::ov_server_t(int portno_, int prio, const std::string& stage_id,
+                         const ov_server_options_t& options)
+    : portno(portno_), prio(prio), options(options), secret(1234),
+      socket(secret), pacer(socket), routes_dirty(false), mix_active(false),
+      runsession(true), stage_id(stage_id),
+      participantannouncementcnt(PARTICIPANTANNOUNCEPERIOD),
+      participantrefreshcnt(PARTICIPANTREFRESHPERIOD), announcecnt(0),
+      latencymatrixcnt(0)
+{
+  // each instance draws its pins from its own generator, so that
+  // stages can be created concurrently:
+  uint64_t seed(random_seed());
+  std::seed_seq seq = {(uint32_t)seed, (uint32_t)(seed >> 32)};
+  rng.seed(seq);
+  latency_matrix_report.stage_id = stage_id;
+#if !defined(LINUX)
+  // stop() can interrupt a blocking receive on linux only:
   socket.set_timeout_usec(100000);
-  portno = socket.bind(portno);
-
-  logthread = std::thread(&ov_server_t::ping_and_callerlist_service, this);
-  quitthread = std::thread(&ov_server_t::quitwatch, this);
+#endif
+  unsigned int num_workers(1);
+#if defined(LINUX)
+  if(!options.hosted)
+    num_workers = std::max(
+        1u, std::min(options.relay_workers, (unsigned int)MAXRELAYWORKERS));
+  if(num_workers > 1)
+    socket.set_reuseport();
+#endif
+  if(options.shared_port) {
+    // the stage engine receives for the stage and shares its socket:
+    if(!options.hosted)
+      throw ErrMsg("The shared port mode needs the stage engine");
+    portno = options.shared_port;
+    // trunk datagrams carry the pin of the other relay, not a local one:
+    if(options.trunk_key)
+      throw ErrMsg("Trunks are not supported in the shared port mode");
+  } else {
+    portno = socket.bind(portno);
+  }
+  counters.reset(new stage_counters_t(stage_id, portno, num_workers));
+  workers.emplace_back(new relay_worker_t(socket, 0, routes.add_reader(),
+                                          counters->relay(0)));
+  for(unsigned int k = 1; k < num_workers; ++k) {
+    relay_worker_t* w(new relay_worker_t(secret, k, routes.add_reader(),
+                                         counters->relay(k)));
+    workers.emplace_back(w);
+    w->socket.set_reuseport();
+    w->socket.bind(portno);
+  }
+  // keep the stream of each sender on one worker, so that it is not
+  // reordered:
+  if(num_workers > 1)
+    socket.steer_by_callerid(num_workers);
+  for(auto& w : workers)
+    w->socket.set_send_buffer(options.send_buffer);
+  bool txtime(options.txtime && socket.enable_txtime());
+  if(options.txtime && !txtime)
+    log(portno, "SO_TXTIME is not available, pacing by sleeping");
+  // the event loop of a hosted stage must not sleep:
+  pacer.configure(txtime, !options.hosted);
 
   // OV box related
   endpoints.resize(255);
-  jittermeasurement_thread =
-      std::thread(&ov_server_t::jittermeasurement_service, this);
+  for(stage_device_id_t cid = 0; cid != MAXEP; ++cid) {
+    compact_list[cid] = false;
+    plist_synced[cid] = false;
+  }
+  if(!options.capture_dir.empty())
+    capture.reset(new capture_writer_t(
+        options.capture_dir + "/" + stage_id + "-" + std::to_string(portno) +
+            ".ovcap",
+        portno, workers.size(), options.capture_file_size,
+        options.capture_files));
+  if(options.trunk_key)
+    trunks.reset(new trunk_table_t(options.trunk_key));
+  if(options.server_downmix) {
+    mixer.reset(new ov_mixer_t(socket, secret, routes, workers.size()));
+    mix_pool_t::add(mixer.get());
+  }
+  // scheduling latency is measured once per process:
+  sched_probe_t::acquire(prio - 1);
+  async_log_t::acquire();
+}
+
+void ov_server_t::start()
+{
+  if(options.hosted || logthread.joinable())
+    return;
+  logthread = std::thread(&ov_server_t::ping_and_callerlist_service, this);
   announce_thread = std::thread(&ov_server_t::announce_service, this);
 
-  // Now start worker
-  workerthread = std::thread(&ov_server_t::srv, this);
+  // Now start workers
+  for(auto& w : workers)
+    w->thread = std::thread(&ov_server_t::srv, this, std::ref(*w));
 }
 
 ov_server_t::~ov_server_t()
 {
-  runsession = false;
-  logthread.join();
-  quitthread.join();
-  workerthread.join();
+  {
+    // waits for a running status callback:
+    std::lock_guard<std::mutex> lk(statusmtx);
+    closing = true;
+  }
+  stop();
+  if(logthread.joinable())
+    logthread.join();
+  if(announce_thread.joinable())
+    announce_thread.join();
+  for(auto& w : workers) {
+    if(w->thread.joinable())
+      w->thread.join();
+    if(w->own_socket)
+      w->own_socket->close();
+  }
+  if(mixer)
+    mix_pool_t::remove(mixer.get());
+  // writes the remaining records:
+  capture.reset();
+  socket.close();
+  sched_probe_t::release();
+  async_log_t::release();
+  if(on_closed)
+    on_closed(portno);
 }
 
-void ov_server_t::quitwatch()
+bool ov_server_t::wait_for_quit(std::chrono::microseconds t)
 {
-  while(!quit_app)
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-  runsession = false;
-  socket.close();
+  std::unique_lock<std::mutex> lk(quitmtx);
+  return quitcv.wait_for(lk, t, [this]() { return !runsession; });
 }
 
 void ov_server_t::announce_new_connection(stage_device_id_t cid,
@@ -62,6 +167,10 @@ void ov_server_t::announce_new_connection(stage_device_id_t cid,
 
 void ov_server_t::announce_connection_lost(stage_device_id_t cid)
 {
+  std::lock_guard<std::mutex> lk(statusmtx);
+  if(closing)
+    return;
+  request_routes();
   log(portno, "connection for " + std::to_string(cid) + " lost.");
 }
 
@@ -69,212 +178,607 @@ void ov_server_t::announce_latency(stage_device_id_t cid, double lmin,
                                    double lmean, double lmax, uint32_t received,
                                    uint32_t lost)
 {
+  std::lock_guard<std::mutex> lk(statusmtx);
+  if(closing)
+    return;
   if(lmean > 0) {
-    {
-      std::lock_guard<std::mutex> lk(latfifomtx);
-      latfifo.push(latreport_t(cid, 200, lmean, lmax - lmean));
-    }
-    char ctmp[1024];
-    sprintf(ctmp, "latency %d min=%1.2fms, mean=%1.2fms, max=%1.2fms", cid,
-            lmin, lmean, lmax);
-    log(portno, ctmp);
+    ping_latfifo.push(
+        latreport_t(cid, 200, lmean, lmax - lmean, received, lost));
+    log_record_t r = {LOG_LATENCY, cid, portno, {lmin, lmean, lmax}};
+    async_log_t::push(r);
   }
 }
 
 // this thread announces the room service to the lobby:
 void ov_server_t::announce_service()
 {
-  // participand announcement counter:
-  uint32_t cnt(0);
-  //char cpost[1024];
-  while(runsession) {
-    if(!cnt) {
-      // if nobody is connected create a new pin:
-      if(get_num_clients() == 0) {
-        long int r(random());
-        secret = r & 0xfffffff;
-        socket.set_secret(secret);
-      }
+  // the route table is refreshed in between the announcements:
+  uint32_t refreshcnt(0);
+  do {
+    if(!refreshcnt) {
+      announce();
+      refreshcnt = PINGPERIODMS / ROUTEREFRESHMS;
+    }
+    --refreshcnt;
+    refresh_routes();
+  } while(!wait_for_quit(std::chrono::milliseconds(ROUTEREFRESHMS)));
+}
 
-     status_report_t report;
-     report.stage_id = stage_id;
-     report.pin = secret;
-     report.serverjitter = serverjitter;
-     report.portno = portno;
-     if( this->on_status ) {
-        this->on_status({this->stage_id, secret, serverjitter, this->portno});
-     }
-     // retry in 6000 periods (10 minutes):
-      cnt = 6000;
+// called once per ping period
+void ov_server_t::announce()
+{
+  if(!announcecnt) {
+    // if nobody is connected create a new pin:
+    if(get_num_clients() == 0) {
+      secret_t pin(rng() & 0xfffffff);
+      // in shared port mode the pin has to be unique on the port:
+      while(claim_pin && !claim_pin(pin))
+        pin = rng() & 0xfffffff;
+      secret = pin;
+      for(auto& w : workers)
+        w->socket.set_secret(secret);
     }
-    --cnt;
-    std::this_thread::sleep_for(std::chrono::milliseconds(PINGPERIODMS));
-    while(!latfifo.empty()) {
-      latreport_t lr(latfifo.front());
-      latfifo.pop();
-
-      if( this->on_latency ) {
-        this->on_latency({this->stage_id, lr.src, lr.dest, lr.tmean, lr.jitter});
-      }
+    if(this->on_status) {
+      sched_stats_t jitter(sched_probe_t::get_stats());
+      this->on_status({this->stage_id, secret, jitter.max, this->portno,
+                       jitter.p50, jitter.p99, jitter.p999});
     }
+    // retry in 6000 periods (10 minutes):
+    announcecnt = 6000;
+  }
+  --announcecnt;
+  latreport_t lr;
+  uint64_t dropped(ping_latfifo.take_dropped());
+  uint64_t depth(ping_latfifo.size());
+  for(auto& w : workers)
+    depth += w->latfifo.size();
+  counters->latfifo_depth = depth;
+  if(mixer)
+    counters->mixfifo_depth = mixer->get_queue_depth();
+  for(auto& w : workers) {
+    dropped += w->latfifo.take_dropped();
+    while(w->latfifo.pop(lr))
+      deliver_latency(lr);
+  }
+  while(ping_latfifo.pop(lr))
+    deliver_latency(lr);
+  if(options.latency_interval_ms) {
+    if(!latencymatrixcnt) {
+      latencymatrixcnt =
+          std::max(1u, options.latency_interval_ms / PINGPERIODMS);
+      if(latency_matrix.take_updates(latency_matrix_report.rows) &&
+         this->on_latency_matrix)
+        this->on_latency_matrix(latency_matrix_report);
+    }
+    --latencymatrixcnt;
+  }
+  if(dropped) {
+    counters->latreports_dropped.add(dropped);
+    log(portno, "dropped " + std::to_string(dropped) + " latency reports");
+  }
+}
+
+void ov_server_t::add_trunk(const std::string& address)
+{
+  if(!trunks)
+    throw ErrMsg("Trunks need a trunk key");
+  trunks->add_peer(address);
+  log(portno, "trunk to " + address);
+}
+
+void ov_server_t::refresh_routes()
+{
+  // a change after this point sets the flag again:
+  if(routes_dirty.exchange(false, std::memory_order_acq_rel))
+    update_routes();
+}
+
+void ov_server_t::update_routes()
+{
+  // the snapshot is taken under the lock, so that an older state is never
+  // published after a newer one:
+  std::lock_guard<std::mutex> lk(routemtx);
+  endpoint_state_t state;
+  state.update(endpoints);
+  if(trunks)
+    trunks->apply(state);
+  routes.rebuild(state, subscriptions);
+  if(mixer)
+    mix_active = ov_mixer_t::has_receivers(state);
+}
+
+void ov_server_t::deliver_latency(const latreport_t& lr)
+{
+  if(options.latency_interval_ms) {
+    latency_matrix.update(lr);
+  } else if(this->on_latency) {
+    this->on_latency({this->stage_id, lr.src, lr.dest, lr.tmean, lr.jitter});
   }
 }
 
 // this thread sends ping and participant list messages
 void ov_server_t::ping_and_callerlist_service()
+{
+  while(!wait_for_quit(std::chrono::milliseconds(PINGPERIODMS)))
+    ping_and_callerlist();
+}
+
+// called once per ping period
+void ov_server_t::ping_and_callerlist()
 {
   char buffer[BUFSIZE];
-  // participand announcement counter:
-  uint32_t participantannouncementcnt(PARTICIPANTANNOUNCEPERIOD);
-  while(runsession) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(PINGPERIODMS));
-    // send ping message to all connected endpoints:
-    for(stage_device_id_t cid = 0; cid != MAXEP; ++cid) {
-      if(endpoints[cid].timeout) {
-        // endpoint is connected
-        socket.send_ping(cid, endpoints[cid].ep);
-      }
+  // send ping message to all connected endpoints:
+  for(stage_device_id_t cid = 0; cid != MAXEP; ++cid) {
+    if(endpoints[cid].timeout) {
+      // endpoint is connected
+      socket.send_ping(cid, endpoints[cid].ep);
     }
-    if(!participantannouncementcnt) {
-      // announcement of connected participants to all clients:
-      participantannouncementcnt = PARTICIPANTANNOUNCEPERIOD;
-      for(stage_device_id_t cid = 0; cid != MAXEP; ++cid) {
-        if(endpoints[cid].timeout) {
-          for(stage_device_id_t epl = 0; epl != MAXEP; ++epl) {
-            if(endpoints[epl].timeout) {
-              // endpoint is alive, send info of epl to cid:
-              size_t n = packmsg(buffer, BUFSIZE, secret, epl, PORT_LISTCID,
-                                 endpoints[epl].mode,
-                                 (const char*)(&(endpoints[epl].ep)),
-                                 sizeof(endpoints[epl].ep));
-              socket.send(buffer, n, endpoints[cid].ep);
-              n = packmsg(buffer, BUFSIZE, secret, epl, PORT_SETLOCALIP, 0,
-                          (const char*)(&(endpoints[epl].localep)),
-                          sizeof(endpoints[epl].localep));
-              socket.send(buffer, n, endpoints[cid].ep);
-            }
+  }
+  // spread the participant lists over the next milliseconds:
+  pacer.begin();
+  // the lists include the participants of the trunks:
+  const std::vector<ep_desc_t>* view(&endpoints);
+  if(trunks) {
+    for(auto& w : workers)
+      while(w->trunkfifo.pop(trunk_msg))
+        trunks->receive(trunk_msg.from, trunk_msg.data, trunk_msg.len);
+    trunks->encode(secret, endpoints, trunk_msgs);
+    for(size_t t = 0; t < trunks->size(); ++t)
+      for(auto& msg : trunk_msgs)
+        pacer.send(msg.data(), msg.size(), trunks->peer(t));
+    trunk_view = endpoints;
+    if(trunks->merge(trunk_view))
+      request_routes();
+    view = &trunk_view;
+  }
+  send_participant_list(*view);
+  if(!participantannouncementcnt) {
+    // announcement of connected participants to legacy clients:
+    participantannouncementcnt = PARTICIPANTANNOUNCEPERIOD;
+    for(stage_device_id_t cid = 0; cid != MAXEP; ++cid) {
+      if(endpoints[cid].timeout && !compact_list[cid]) {
+        for(stage_device_id_t epl = 0; epl != MAXEP; ++epl) {
+          const ep_desc_t& ep((*view)[epl]);
+          if(ep.timeout) {
+            // endpoint is alive, send info of epl to cid:
+            size_t n = packmsg(buffer, BUFSIZE, secret, epl, PORT_LISTCID,
+                               ep.mode, (const char*)(&(ep.ep)),
+                               sizeof(ep.ep));
+            pacer.send(buffer, n, endpoints[cid].ep);
+            n = packmsg(buffer, BUFSIZE, secret, epl, PORT_SETLOCALIP, 0,
+                        (const char*)(&(ep.localep)), sizeof(ep.localep));
+            pacer.send(buffer, n, endpoints[cid].ep);
           }
         }
       }
     }
-    --participantannouncementcnt;
   }
+  --participantannouncementcnt;
 }
 
-void ov_server_t::srv()
+// compact participant list, one datagram per recipient: changes are
+// sent in the next ping period, the full list as a low rate refresh and
+// to clients which just sent ROUTEREXT_HELLO
+void ov_server_t::send_participant_list(const std::vector<ep_desc_t>& view)
+{
+  bool changed(participants.update(view));
+  bool refresh(!participantrefreshcnt);
+  if(refresh)
+    participantrefreshcnt = PARTICIPANTREFRESHPERIOD;
+  --participantrefreshcnt;
+  bool have_full(false);
+  bool have_delta(false);
+  for(stage_device_id_t cid = 0; cid != MAXEP; ++cid) {
+    if(!endpoints[cid].timeout) {
+      plist_synced[cid] = false;
+      continue;
+    }
+    if(!compact_list[cid]) {
+      plist_synced[cid] = false;
+      continue;
+    }
+    if(refresh || !plist_synced[cid]) {
+      if(!have_full)
+        participants.encode(secret, true, plist_full);
+      have_full = true;
+      for(auto& msg : plist_full)
+        pacer.send(msg.data(), msg.size(), endpoints[cid].ep);
+    } else if(changed) {
+      if(!have_delta)
+        participants.encode(secret, false, plist_delta);
+      have_delta = true;
+      for(auto& msg : plist_delta)
+        pacer.send(msg.data(), msg.size(), endpoints[cid].ep);
+    }
+    plist_synced[cid] = true;
+  }
+}
+
+void ov_server_t::srv(relay_worker_t& w)
 {
   set_thread_prio(prio);
-  char buffer[BUFSIZE];
-  log(portno, "Multiplex service started (version " OVBOXVERSION ")");
-  if( this->on_ready ) {
-    this->on_ready(portno);
+  // the first worker reports the state of the service:
+  bool first(&w == workers[0].get());
+  if(first) {
+    log(portno, "Multiplex service started (version " OVBOXVERSION ")");
+    if(this->on_ready)
+      this->on_ready(portno);
   }
+  if(options.io_mode == OV_IO_URING)
+    srv_uring(w);
+  else if(options.io_mode == OV_IO_BATCHED)
+    srv_batched(w);
+  else
+    srv_single(w);
+  if(first)
+    log(portno, "Multiplex service stopped");
+}
+
+void ov_server_t::srv_single(relay_worker_t& w)
+{
+  ovbox_batch_socket_t& socket(w.socket);
+  relay_counters_t& counters(w.counters);
+  char buffer[BUFSIZE];
   endpoint_t sender_endpoint;
   stage_device_id_t rcallerid;
   port_t destport;
   while(runsession) {
-    size_t n(BUFSIZE);
-    size_t un(BUFSIZE);
-    sequence_t seq(0);
-    char* msg(socket.recv_sec_msg(buffer, n, un, rcallerid, destport, seq,
-                                  sender_endpoint));
-    if(msg) {
-      // retransmit data:
-      if(destport > MAXSPECIALPORT) {
-        for(stage_device_id_t ep = 0; ep != MAXEP; ++ep) {
-          if((ep != rcallerid) && (endpoints[ep].timeout > 0) &&
-             (!(endpoints[ep].mode & B_DONOTSEND)) &&
-             ((!(endpoints[ep].mode & B_PEER2PEER)) ||
-              (!(endpoints[rcallerid].mode & B_PEER2PEER))) &&
-             ((!(endpoints[ep].mode & B_DOWNMIXONLY)) ||
-              (rcallerid == MAXEP - 1))) {
-            socket.send(buffer, n, endpoints[ep].ep);
-          }
-        }
+    size_t n(socket.recv(buffer, sender_endpoint));
+    flush_backlog(w);
+    if(!n)
+      continue;
+    w.rx_time_ns = monotonic_ns();
+    if(capture)
+      capture->push(w.index, buffer, n, sender_endpoint);
+    if(trunks && relay_trunk(w, buffer, n, sender_endpoint, NULL))
+      continue;
+    if(socket.peek_audio(buffer, n, rcallerid)) {
+      // retransmit data from the receive buffer:
+      if(rcallerid < MAXEP) {
+        relay_audio(w, rcallerid, buffer, n, NULL, false);
       } else {
-        // this is a control message:
-        switch(destport) {
-        case PORT_SEQREP:
-          if(un == sizeof(sequence_t) + sizeof(stage_device_id_t)) {
-            stage_device_id_t sender_cid(*(sequence_t*)msg);
-            sequence_t seq(*(sequence_t*)(&(msg[sizeof(stage_device_id_t)])));
-            char ctmp[1024];
-            sprintf(ctmp, "sequence error %d sender %d %d", rcallerid,
-                    sender_cid, seq);
-            log(portno, ctmp);
-          }
-          break;
-        case PORT_PEERLATREP:
-          if(un == 6 * sizeof(double)) {
-            double* data((double*)msg);
-            {
-              std::lock_guard<std::mutex> lk(latfifomtx);
-              latfifo.push(
-                  latreport_t(rcallerid, data[0], data[2], data[3] - data[2]));
-            }
-            char ctmp[1024];
-            sprintf(ctmp,
-                    "peerlat %d-%g min=%1.2fms, mean=%1.2fms, max=%1.2fms",
-                    rcallerid, data[0], data[1], data[2], data[3]);
-            log(portno, ctmp);
-            sprintf(ctmp, "packages %d-%g received=%g lost=%g (%1.2f%%)",
-                    rcallerid, data[0], data[4], data[5],
-                    100.0 * data[5] / (std::max(1.0, data[4] + data[5])));
-            log(portno, ctmp);
-          }
-          break;
-        case PORT_PONG: {
-          double tms(get_pingtime(msg, un));
-          if(tms > 0)
-            cid_setpingtime(rcallerid, tms);
-        } break;
-        case PORT_SETLOCALIP:
-          if(un == sizeof(endpoint_t)) {
-            endpoint_t* localep((endpoint_t*)msg);
-            cid_setlocalip(rcallerid, *localep);
-          }
-          break;
-        case PORT_REGISTER:
-          // in the register packet the sequence is used to transmit
-          // peer2peer flag:
-          std::string rver("---");
-          if(un > 0) {
-            msg[un - 1] = 0;
-            rver = msg;
-          }
-          cid_register(rcallerid, sender_endpoint, seq, rver);
-          break;
-        }
+        counters.invalid.add(1);
       }
+      continue;
     }
+    size_t un(0);
+    sequence_t seq(0);
+    char* msg(socket.decode(buffer, n, un, rcallerid, destport, seq));
+    if(msg)
+      handle_control(w, msg, un, rcallerid, destport, seq, sender_endpoint);
+    else
+      counters.invalid.add(1);
   }
-  log(portno, "Multiplex service stopped");
 }
 
-double get_pingtime(std::chrono::high_resolution_clock::time_point& t1)
+void ov_server_t::srv_batched(relay_worker_t& w)
 {
-  std::chrono::high_resolution_clock::time_point t2(
-      std::chrono::high_resolution_clock::now());
-  std::chrono::duration<double> time_span =
-      std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1);
-  t1 = t2;
-  return (1000.0 * time_span.count());
+  std::unique_ptr<rx_batch_t> rx(new rx_batch_t());
+  std::unique_ptr<tx_batch_t> tx(new tx_batch_t());
+  while(runsession) {
+    w.socket.recv_batch(*rx);
+    relay_batch(w, *rx, *tx);
+  }
 }
 
-void ov_server_t::jittermeasurement_service()
+void ov_server_t::srv_uring(relay_worker_t& w)
 {
-  set_thread_prio(prio - 1);
-  std::chrono::high_resolution_clock::time_point t1;
-  get_pingtime(t1);
-  while(runsession) {
-    std::this_thread::sleep_for(std::chrono::microseconds(2000));
-    double t(get_pingtime(t1));
-    t -= 2.0;
-    serverjitter = std::max(t, serverjitter);
+#if defined(HAS_URING_SOCKET)
+  try {
+    uring_socket_t ring(w.socket);
+    std::unique_ptr<tx_batch_t> tx(new tx_batch_t());
+    tx->backlog = &w.sendq;
+    while(runsession) {
+      size_t n(ring.wait());
+      w.rx_time_ns = monotonic_ns();
+      w.counters.send_errors.add(ring.take_send_errors());
+      flush_backlog(w);
+      for(size_t k = 0; k < n; ++k)
+        relay_datagram(w, ring.buf(k), ring.len(k), ring.from(k), *tx);
+      // the fan-out is submitted by the next wait:
+      w.counters.send_errors.add(ring.send(*tx));
+      w.counters.queue_dropped.add(w.sendq.take_dropped());
+    }
+    return;
+  }
+  catch(const std::exception& e) {
+    if(w.index == 0)
+      log(portno, std::string(e.what()) + ", using batched I/O");
+  }
+#else
+  if(w.index == 0)
+    log(portno, "io_uring is not supported by this build, using batched I/O");
+#endif
+  srv_batched(w);
+}
+
+void ov_server_t::process_pending(rx_batch_t& rx, tx_batch_t& tx)
+{
+  // take at most one batch, so that a busy stage cannot starve the
+  // other stages of the same event loop:
+  if(socket.recv_batch(rx, false))
+    relay_batch(*workers[0], rx, tx);
+}
+
+void ov_server_t::process_shared(rx_batch_t& rx, const size_t* index,
+                                 size_t num, tx_batch_t& tx)
+{
+  relay_worker_t& w(*workers[0]);
+  w.rx_time_ns = monotonic_ns();
+  tx.backlog = &w.sendq;
+  flush_backlog(w);
+  for(size_t k = 0; k < num; ++k)
+    relay_datagram(w, rx.buf[index[k]], rx.len[index[k]], rx.from[index[k]],
+                   tx);
+  finish_batch(w, tx);
+}
+
+void ov_server_t::relay_batch(relay_worker_t& w, rx_batch_t& rx,
+                              tx_batch_t& tx)
+{
+  w.rx_time_ns = monotonic_ns();
+  tx.backlog = &w.sendq;
+  flush_backlog(w);
+  for(size_t k = 0; k < rx.count; ++k)
+    relay_datagram(w, rx.buf[k], rx.len[k], rx.from[k], tx);
+  finish_batch(w, tx);
+}
+
+void ov_server_t::relay_datagram(relay_worker_t& w, char* buf, size_t n,
+                                 const endpoint_t& from, tx_batch_t& tx)
+{
+  ovbox_batch_socket_t& socket(w.socket);
+  relay_counters_t& counters(w.counters);
+  stage_device_id_t rcallerid;
+  port_t destport;
+  if(capture)
+    capture->push(w.index, buf, n, from);
+  if(trunks && relay_trunk(w, buf, n, from, &tx))
+    return;
+  if(socket.peek_audio(buf, n, rcallerid)) {
+    // queue the fan-out, the receive buffer stays valid until flush:
+    if(rcallerid < MAXEP)
+      relay_audio(w, rcallerid, buf, n, &tx, false);
+    else
+      counters.invalid.add(1);
+    return;
+  }
+  // control ports take the full decoder:
+  size_t un(0);
+  sequence_t seq(0);
+  char* msg(socket.decode(buf, n, un, rcallerid, destport, seq));
+  if(msg)
+    handle_control(w, msg, un, rcallerid, destport, seq, from);
+  else
+    counters.invalid.add(1);
+}
+
+void ov_server_t::relay_audio(relay_worker_t& w, stage_device_id_t rcallerid,
+                              const char* buf, size_t n, tx_batch_t* tx,
+                              bool from_trunk)
+{
+  relay_counters_t& counters(w.counters);
+  route_table_t::read_guard_t route(routes, w.reader);
+  bool local(route->endpoints.active(rcallerid));
+  if(from_trunk) {
+    // the sender is connected here, the datagram went around a loop:
+    if(local) {
+      counters.invalid.add(1);
+      return;
+    }
+    counters.trunk_in.add(1);
+  }
+  endpoint_counters_t& in(counters.ep[rcallerid]);
+  in.packets_in.add(1);
+  in.bytes_in.add(n);
+  sequence_t seq;
+  memcpy(&seq, &buf[POS_SEQ], sizeof(seq));
+  in.stream.update(seq, w.rx_time_ns);
+  for(uint32_t d = route->begin[rcallerid]; d != route->begin[rcallerid + 1];
+      ++d) {
+    stage_device_id_t dcid(route->dest_cid[d]);
+    send_relayed(w, buf, n, route->dest[d], dcid, tx);
+    endpoint_counters_t& out(counters.ep[dcid]);
+    out.packets_out.add(1);
+    out.bytes_out.add(n);
+  }
+  // once per trunk with receivers; split horizon, audio which came over
+  // a trunk is not sent to another one:
+  if(trunks && local && !from_trunk)
+    for(size_t t = 0; t < trunks->size(); ++t)
+      if(trunks->forward(t)) {
+        send_relayed(w, buf, n, trunks->peer(t), TRUNK_CALLERID, tx);
+        counters.trunk_out.add(1);
+      }
+  if(mix_active && !mixer->push(w.index, buf, n))
+    counters.mix_dropped.add(1);
+}
+
+// datagrams of other relays carry the trunk key (trunk list) or the pin
+// of the stage at the other end (audio):
+bool ov_server_t::relay_trunk(relay_worker_t& w, char* buf, size_t n,
+                              const endpoint_t& from, tx_batch_t* tx)
+{
+  if(n < HEADERLEN)
+    return false;
+  secret_t s;
+  port_t p;
+  sequence_t seq;
+  memcpy(&s, &buf[POS_SECRET], sizeof(s));
+  memcpy(&p, &buf[POS_PORT], sizeof(p));
+  memcpy(&seq, &buf[POS_SEQ], sizeof(seq));
+  int t(trunks->find(from));
+  if(s == trunks->get_key()) {
+    // the list is taken by the service thread, the queue drops it if full:
+    if((t < 0) || (p != PORT_ROUTEREXT) || (seq != ROUTEREXT_TRUNK) ||
+       (n - HEADERLEN > BUFSIZE)) {
+      w.counters.invalid.add(1);
+    } else {
+      trunk_msg_t& msg(w.trunk_msg);
+      msg.from = from;
+      msg.len = n - HEADERLEN;
+      memcpy(msg.data, buf + HEADERLEN, msg.len);
+      w.trunkfifo.push(msg);
+    }
+    return true;
+  }
+  if(t < 0)
+    return false;
+  stage_device_id_t cid(buf[POS_CALLERID]);
+  if((s != trunks->peer_pin(t)) || !ov_audio_port(p) || (cid >= MAXEP)) {
+    w.counters.invalid.add(1);
+    return true;
+  }
+  // the local receivers know the stage by the local pin:
+  secret_t pin(secret);
+  memcpy(&buf[POS_SECRET], &pin, sizeof(pin));
+  relay_audio(w, cid, buf, n, tx, true);
+  return true;
+}
+
+void ov_server_t::send_relayed(relay_worker_t& w, const char* buf, size_t n,
+                               const endpoint_t& ep, stage_device_id_t dcid,
+                               tx_batch_t* tx)
+{
+  // keep the order behind datagrams which are still queued:
+  if(w.sendq.pending(dcid)) {
+    w.sendq.push(dcid, ep, buf, n);
+  } else if(tx) {
+    w.counters.send_errors.add(w.socket.queue(*tx, buf, n, ep, dcid));
+  } else {
+    // single mode, one send syscall per receiver:
+    send_result_t r(w.socket.send_nowait(buf, n, ep));
+    if(r == SEND_AGAIN)
+      w.sendq.push(dcid, ep, buf, n);
+    else if(r == SEND_FAILED)
+      w.counters.send_errors.add(1);
+  }
+}
+
+void ov_server_t::finish_batch(relay_worker_t& w, tx_batch_t& tx)
+{
+  // one send syscall for all packets of this wakeup:
+  w.counters.send_errors.add(w.socket.flush(tx));
+  w.counters.queue_dropped.add(w.sendq.take_dropped());
+}
+
+void ov_server_t::flush_backlog(relay_worker_t& w)
+{
+  if(w.sendq.empty())
+    return;
+  w.counters.send_errors.add(w.sendq.flush(w.socket));
+  w.counters.queue_dropped.add(w.sendq.take_dropped());
+}
+
+void ov_server_t::handle_control(relay_worker_t& w, char* msg, size_t un,
+                                 stage_device_id_t rcallerid, port_t destport,
+                                 sequence_t seq,
+                                 const endpoint_t& sender_endpoint)
+{
+  switch(destport) {
+  case PORT_SEQREP:
+    if(un == sizeof(sequence_t) + sizeof(stage_device_id_t)) {
+      stage_device_id_t sender_cid(*(sequence_t*)msg);
+      sequence_t seq(*(sequence_t*)(&(msg[sizeof(stage_device_id_t)])));
+      if(sender_cid < MAXEP)
+        w.counters.ep[sender_cid].seq_errors.add(1);
+      log_record_t r = {
+          LOG_SEQERR, rcallerid, portno, {(double)sender_cid, (double)seq}};
+      async_log_t::push(r);
+    }
+    break;
+  case PORT_PEERLATREP:
+    if(un == 6 * sizeof(double)) {
+      double* data((double*)msg);
+      w.latfifo.push(latreport_t(rcallerid, data[0], data[2],
+                                     data[3] - data[2], data[4], data[5]));
+      log_record_t r = {LOG_PEERLAT, rcallerid, portno,
+                        {data[0], data[1], data[2], data[3], data[4], data[5]}};
+      async_log_t::push(r);
+    }
+    break;
+  case PORT_ROUTEREXT:
+    if((rcallerid >= MAXEP) || (endpoints[rcallerid].timeout == 0))
+      break;
+    if((seq == ROUTEREXT_HELLO) || (seq == ROUTEREXT_SUBSCRIBE))
+      compact_list[rcallerid] = true;
+    if((seq == ROUTEREXT_SUBSCRIBE) && subscriptions[rcallerid].set(msg, un))
+      request_routes();
+    break;
+  case PORT_PONG: {
+    double tms(get_pingtime(msg, un));
+    if(tms > 0)
+      cid_setpingtime(rcallerid, tms);
+  } break;
+  case PORT_SETLOCALIP:
+    if(un == sizeof(endpoint_t)) {
+      endpoint_t* localep((endpoint_t*)msg);
+      cid_setlocalip(rcallerid, *localep);
+    }
+    break;
+  case PORT_REGISTER:
+    // in the register packet the sequence is used to transmit
+    // peer2peer flag:
+    if(rcallerid < MAXEP) {
+      std::string rver("---");
+      if(un > 0) {
+        msg[un - 1] = 0;
+        rver = msg;
+      }
+      const ep_desc_t& prev(endpoints[rcallerid]);
+      bool routing_changed(
+          (prev.timeout == 0) || (prev.mode != seq) ||
+          (prev.ep.sin_addr.s_addr != sender_endpoint.sin_addr.s_addr) ||
+          (prev.ep.sin_port != sender_endpoint.sin_port));
+      // a new session starts with all senders and the legacy
+      // participant list, until the client sends ROUTEREXT_HELLO:
+      if(prev.timeout == 0) {
+        subscriptions[rcallerid].set_all();
+        compact_list[rcallerid] = false;
+        for(auto& w : workers)
+          w->counters.ep[rcallerid].stream.reset();
+      }
+      cid_register(rcallerid, sender_endpoint, seq, rver);
+      if(routing_changed)
+        request_routes();
+    }
+    break;
   }
 }
 
 void ov_server_t::stop()
 {
-  quit_app = true;
+  {
+    std::lock_guard<std::mutex> lk(quitmtx);
+    if(!runsession)
+      return;
+    runsession = false;
+  }
+  // wake up the services and the relay thread:
+  quitcv.notify_all();
+  if(!options.hosted)
+    for(auto& w : workers)
+      w->socket.interrupt();
+}
+
+relay_worker_t::relay_worker_t(ovbox_batch_socket_t& socket, size_t index,
+                               size_t reader, relay_counters_t& counters)
+    : socket(socket), index(index), reader(reader), counters(counters),
+      rx_time_ns(0)
+{
+}
+
+relay_worker_t::relay_worker_t(secret_t secret, size_t index, size_t reader,
+                               relay_counters_t& counters)
+    : own_socket(new ovbox_batch_socket_t(secret)), socket(*own_socket),
+      index(index), reader(reader), counters(counters), rx_time_ns(0)
+{
+}
+
+void ov_server_release(ov_server_t* server)
+{
+  if(!server)
+    return;
+  server->stop();
+  std::thread([server]() { delete server; }).detach();
 }
@@ -1,13 +1,28 @@
 #ifndef OV_SERVER_H
 #define OV_SERVER_H
 
+#include "async-log.h"
+#include "batch-socket.h"
 #include "callerlist.h"
+#include "capture-file.h"
 #include "common.h"
+#include "downmix.h"
 #include "errmsg.h"
+#include "latency-matrix.h"
+#include "participant-list.h"
+#include "route-table.h"
+#include "sched-probe.h"
+#include "send-queue.h"
+#include "spsc-queue.h"
+#include "stage-metrics.h"
+#include "trunk.h"
 #include "udpsocket.h"
+#include <atomic>
 #include <condition_variable>
 #include <functional>
-#include <queue>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <signal.h>
 #include <string.h>
 #include <thread>
@@ -15,6 +30,15 @@
 
 // period time of participant list announcement, in ping periods:
 #define PARTICIPANTANNOUNCEPERIOD 20
+// period time of the compact participant list refresh, in ping periods:
+#define PARTICIPANTREFRESHPERIOD 50
+// capacity of the latency report queues:
+#define LATFIFOSIZE 1024
+// maximum number of relay threads of one stage:
+#define MAXRELAYWORKERS 8
+// longest delay between a routing change and the rebuild of the route
+// table, in milliseconds:
+#define ROUTEREFRESHMS 5
 
 struct connection_report_t {
   std::string stage_id;
@@ -30,66 +54,302 @@ struct latency_report_t {
   double jitter;
 };
 
+struct latency_matrix_report_t {
+  std::string stage_id;
+  // LATMATRIXFIELDS values per device pair:
+  std::vector<double> rows;
+};
+
 struct status_report_t {
   std::string stage_id;
   secret_t pin;
+  // maximum scheduling latency of the last seconds, in ms:
   double serverjitter;
   int portno;
+  // percentiles of the scheduling latency, in ms, sent with the pin only
+  // (see stage_metrics_t::sched for polling):
+  double jitter_p50;
+  double jitter_p99;
+  double jitter_p999;
+};
+
+enum ov_io_mode_t {
+  // one recv and one send syscall per datagram:
+  OV_IO_SINGLE,
+  // recvmmsg/sendmmsg, one send syscall per received batch:
+  OV_IO_BATCHED,
+  // io_uring with multishot receive into registered buffers, one
+  // syscall per wakeup (linux 6.0, falls back to OV_IO_BATCHED; not
+  // used by hosted stages):
+  OV_IO_URING
+};
+
+struct ov_server_options_t {
+  ov_server_options_t()
+      : io_mode(OV_IO_SINGLE), hosted(false), latency_interval_ms(0),
+        relay_workers(1), server_downmix(false), send_buffer(0),
+        txtime(false), capture_file_size(CAPTUREFILESIZE),
+        capture_files(CAPTUREFILES), shared_port(0), trunk_key(0){};
+  ov_io_mode_t io_mode;
+  // do not start any threads, the server is driven by a shared event
+  // loop (see ov_stage_engine_t):
+  bool hosted;
+  // if non-zero, latency reports are delivered as one matrix snapshot
+  // per interval (on_latency_matrix) instead of one on_latency per report:
+  uint32_t latency_interval_ms;
+  // number of relay threads, each with its own socket bound to the
+  // stage port with SO_REUSEPORT (linux only, not in hosted mode):
+  unsigned int relay_workers;
+  // mix the audio of all senders for B_DOWNMIXONLY receivers, instead
+  // of relying on an external mixer client (see ov_mixer_t):
+  bool server_downmix;
+  // kernel send buffer of each socket in bytes, zero for the default:
+  int send_buffer;
+  // pace control datagrams with SO_TXTIME (linux, needs the fq qdisc)
+  // instead of sleeping between the pacing slots. Hosted stages must not
+  // sleep, so without SO_TXTIME they send each burst of participant and
+  // trunk lists at once (see control_pacer_t):
+  bool txtime;
+  // if not empty, all received datagrams are recorded to the capture
+  // file <capture_dir>/<stage_id>-<port>.ovcap (see capture_writer_t):
+  std::string capture_dir;
+  // size at which a capture file is rotated, zero for no rotation:
+  uint64_t capture_file_size;
+  uint32_t capture_files;
+  // if non-zero, the stage does not bind a socket: the stage engine
+  // receives the datagrams of all stages on this port and passes them
+  // on by session secret (hosted mode only):
+  port_t shared_port;
+  // if non-zero, the stage accepts trunks from relays in other regions
+  // which present this key (larger than 0xfffffff, see trunk_table_t),
+  // not in the shared port mode:
+  secret_t trunk_key;
 };
 
-class latreport_t {
+/**
+ * One relay thread of a stage. The first worker uses the main socket of
+ * the stage, additional workers own a socket bound to the same port.
+ */
+class relay_worker_t {
 public:
-  latreport_t() : src(0), dest(0), tmean(0), jitter(0){};
-  latreport_t(stage_device_id_t src_, stage_device_id_t dest_, double tmean_,
-              double jitter_)
-      : src(src_), dest(dest_), tmean(tmean_), jitter(jitter_){};
-  stage_device_id_t src;
-  stage_device_id_t dest;
-  double tmean;
-  double jitter;
+  relay_worker_t(ovbox_batch_socket_t& socket, size_t index, size_t reader,
+                 relay_counters_t& counters);
+  relay_worker_t(secret_t secret, size_t index, size_t reader,
+                 relay_counters_t& counters);
+  std::unique_ptr<ovbox_batch_socket_t> own_socket;
+  ovbox_batch_socket_t& socket;
+  const size_t index;
+  // route table reader slot:
+  const size_t reader;
+  relay_counters_t& counters;
+  // latency reports received by this worker (peer reports):
+  spsc_queue_t<latreport_t, LATFIFOSIZE> latfifo;
+  // trunk lists received by this worker (see trunk_table_t):
+  spsc_queue_t<trunk_msg_t, TRUNKFIFOSIZE> trunkfifo;
+  trunk_msg_t trunk_msg;
+  // datagrams which would have blocked the relay:
+  send_queue_t sendq;
+  // receive time of the current datagrams (CLOCK_MONOTONIC), taken once
+  // per wakeup, i.e., shared by all datagrams of a batch:
+  int64_t rx_time_ns;
+  std::thread thread;
+};
+
+/**
+ * Closing flag for the callbacks of the libov status thread. The thread
+ * is only joined by the endpoint_list_t destructor, after the members of
+ * the server are gone. This base class comes before endpoint_list_t, so
+ * that the flag outlives the thread.
+ */
+class status_guard_t {
+protected:
+  status_guard_t() : closing(false){};
+  std::mutex statusmtx;
+  // set by the server destructor, the callbacks return without action:
+  bool closing;
 };
 
-class ov_server_t : public endpoint_list_t {
+class ov_server_t : public status_guard_t, public endpoint_list_t {
 public:
-  ov_server_t(int portno, int prio, const std::string& stage_id);
+  ov_server_t(int portno, int prio, const std::string& stage_id,
+              const ov_server_options_t& options = ov_server_options_t());
   ~ov_server_t();
   int portno;
+  /**
+   * Start the relay and service threads. The callbacks have to be set
+   * before, on_ready is called once the first relay thread runs. Not
+   * used in hosted mode, where the event loop calls on_ready.
+   */
+  void start();
   void announce_new_connection(stage_device_id_t cid, const ep_desc_t& ep);
   void announce_connection_lost(stage_device_id_t cid);
   void announce_latency(stage_device_id_t cid, double lmin, double lmean,
                         double lmax, uint32_t received, uint32_t lost);
+  /**
+   * Ask all threads of this instance to quit, without waiting for
+   * them. The threads are joined and the socket is closed by the
+   * destructor, which then calls on_closed.
+   */
   void stop();
 
+  // entry points for a shared event loop, used in hosted mode:
+  int get_fd() const { return socket.get_fd(); };
+  void process_pending(rx_batch_t& rx, tx_batch_t& tx);
+  // entry points of the shared port mode:
+  /**
+   * Send through the shared socket of the event loop.
+   */
+  void share_socket(const ovbox_batch_socket_t& shared)
+  {
+    socket.share(shared);
+  };
+  /**
+   * Relay the datagrams rx.buf[index[0..num-1]], which carry the pin of
+   * this stage, in place.
+   */
+  void process_shared(rx_batch_t& rx, const size_t* index, size_t num,
+                      tx_batch_t& tx);
+  void ping_and_callerlist();
+  void announce();
+  /**
+   * Rebuild the route table if a routing change was requested, called
+   * every ROUTEREFRESHMS by the announce thread or the event loop.
+   */
+  void refresh_routes();
+  /**
+   * Add a trunk to the relay of the same stage in another region,
+   * "host:port". Throws ErrMsg if trunks are not enabled (trunk_key)
+   * or the address is invalid.
+   */
+  void add_trunk(const std::string& address);
+  const std::string& get_stage_id() const { return stage_id; };
+  /**
+   * Current session pin. A new pin is drawn by the first announce() and
+   * then only while nobody is connected.
+   */
+  secret_t get_pin() const { return secret; };
+  /**
+   * Traffic counters of this stage, may be kept and read after the
+   * stage was deleted.
+   */
+  std::shared_ptr<const stage_counters_t> get_counters() const
+  {
+    return counters;
+  };
+
   std::function<void(int)> on_ready;
   std::function<void(connection_report_t)> on_connect;
   std::function<void(stage_device_id_t)> on_disconnect;
   std::function<void(latency_report_t)> on_latency;
+  std::function<void(const latency_matrix_report_t&)> on_latency_matrix;
   std::function<void(status_report_t)> on_status;
+  std::function<void(int)> on_closed;
+  /**
+   * Called with each new pin before it is used, a pin is drawn again
+   * while this returns false (shared port mode).
+   */
+  std::function<bool(secret_t)> claim_pin;
 
 private:
-  void jittermeasurement_service();
-  std::thread jittermeasurement_thread;
   void announce_service();
   std::thread announce_thread;
   void ping_and_callerlist_service();
+  void deliver_latency(const latreport_t& lr);
+  /**
+   * Mark the route table as outdated. The relay threads and the libov
+   * status thread only set this flag, so that they never take a lock,
+   * and all rebuilds happen in refresh_routes().
+   */
+  void request_routes()
+  {
+    routes_dirty.store(true, std::memory_order_release);
+  };
+  void update_routes();
+  void send_participant_list(const std::vector<ep_desc_t>& view);
   std::thread logthread;
-  void quitwatch();
-  std::thread quitthread;
-  void srv();
-  std::thread workerthread;
+  /**
+   * Wait for the given time or until stop() is called.
+   * @return True if the server is stopping
+   */
+  bool wait_for_quit(std::chrono::microseconds t);
+  std::mutex quitmtx;
+  std::condition_variable quitcv;
+  void srv(relay_worker_t& w);
+  void srv_single(relay_worker_t& w);
+  void srv_batched(relay_worker_t& w);
+  void srv_uring(relay_worker_t& w);
+  void relay_batch(relay_worker_t& w, rx_batch_t& rx, tx_batch_t& tx);
+  void relay_datagram(relay_worker_t& w, char* buf, size_t n,
+                      const endpoint_t& from, tx_batch_t& tx);
+  void relay_audio(relay_worker_t& w, stage_device_id_t rcallerid,
+                   const char* buf, size_t n, tx_batch_t* tx,
+                   bool from_trunk);
+  bool relay_trunk(relay_worker_t& w, char* buf, size_t n,
+                   const endpoint_t& from, tx_batch_t* tx);
+  void send_relayed(relay_worker_t& w, const char* buf, size_t n,
+                    const endpoint_t& ep, stage_device_id_t dcid,
+                    tx_batch_t* tx);
+  void finish_batch(relay_worker_t& w, tx_batch_t& tx);
+  void flush_backlog(relay_worker_t& w);
+  void handle_control(relay_worker_t& w, char* msg, size_t un,
+                      stage_device_id_t rcallerid, port_t destport,
+                      sequence_t seq, const endpoint_t& sender_endpoint);
   const int prio;
+  const ov_server_options_t options;
 
-  secret_t secret;
-  ovbox_udpsocket_t socket;
-  bool runsession;
+  std::atomic<secret_t> secret;
+  // pin generator, used by announce() only:
+  std::mt19937 rng;
+  ovbox_batch_socket_t socket;
+  control_pacer_t pacer;
+  // destinations per sender, rebuilt on register/timeout/mode change
+  // and when a receiver changes its subscription:
+  route_table_t routes;
+  subscription_t subscriptions[MAXEP];
+  std::atomic<bool> routes_dirty;
+  // serializes the rebuilds, from the endpoint snapshot to the publication
+  // of the table and mix_active:
+  std::mutex routemtx;
+  std::shared_ptr<stage_counters_t> counters;
+  std::vector<std::unique_ptr<relay_worker_t>> workers;
+  std::unique_ptr<ov_mixer_t> mixer;
+  std::unique_ptr<capture_writer_t> capture;
+  // relays of the same stage in other regions, NULL without trunk key:
+  std::unique_ptr<trunk_table_t> trunks;
+  // endpoint list with the remote participants, and the trunk list:
+  std::vector<ep_desc_t> trunk_view;
+  std::vector<std::vector<char>> trunk_msgs;
+  trunk_msg_t trunk_msg;
+  // there is a receiver of the server mix, relay workers feed the mixer:
+  std::atomic<bool> mix_active;
+  std::atomic<bool> runsession;
   std::string stage_id;
 
-  std::queue<latreport_t> latfifo;
-  std::mutex latfifomtx;
+  // latency reports of the caller list thread (server pings):
+  spsc_queue_t<latreport_t, LATFIFOSIZE> ping_latfifo;
 
-  double serverjitter;
+  uint32_t participantannouncementcnt;
+  uint32_t participantrefreshcnt;
+  participant_list_t participants;
+  std::vector<std::vector<char>> plist_full;
+  std::vector<std::vector<char>> plist_delta;
+  // client announced the router extensions and gets the compact
+  // participant list:
+  std::atomic<bool> compact_list[MAXEP];
+  // client received the full compact participant list:
+  bool plist_synced[MAXEP];
+  uint32_t announcecnt;
+  latency_matrix_t latency_matrix;
+  latency_matrix_report_t latency_matrix_report;
+  uint32_t latencymatrixcnt;
 
   std::string group;
 };
 
+/**
+ * Stop a server and delete it in a background thread, so that the
+ * caller does not block while the threads are joined.
+ */
+void ov_server_release(ov_server_t* server);
+
 #endif // OV_SERVER_H
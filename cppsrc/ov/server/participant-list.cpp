@@ -0,0 +1,123 @@
+#include "participant-list.h"
+#include <string.h>
+
+// size of one participant record:
+#define PRECSIZE (2 + sizeof(uint32_t) + 2 * sizeof(endpoint_t))
+// size of the list header:
+#define PLISTHEADERSIZE 2
+
+participant_list_t::participant_list_t()
+{
+  memset(current, 0, sizeof(current));
+  memset(changed, 0, sizeof(changed));
+}
+
+bool participant_list_t::update(const std::vector<ep_desc_t>& endpoints)
+{
+  bool any(false);
+  for(stage_device_id_t cid = 0; cid != MAXEP; ++cid) {
+    const ep_desc_t& ep(endpoints[cid]);
+    participant_t& p(current[cid]);
+    bool live(ep.timeout > 0);
+    changed[cid] = (live != p.live) ||
+                   (live && ((ep.mode != p.mode) ||
+                             memcmp(&ep.ep, &p.ep, sizeof(endpoint_t)) ||
+                             memcmp(&ep.localep, &p.localep,
+                                    sizeof(endpoint_t))));
+    if(changed[cid]) {
+      any = true;
+      p.live = live;
+      p.mode = ep.mode;
+      p.ep = ep.ep;
+      p.localep = ep.localep;
+    }
+  }
+  return any;
+}
+
+void participant_list_t::encode(secret_t secret, bool full,
+                                std::vector<std::vector<char>>& msgs) const
+{
+  encode_msgs(secret, full, ROUTEREXT_PARTICIPANTS, NULL, 0, msgs);
+}
+
+void participant_list_t::encode_trunk(
+    secret_t key, secret_t pin, std::vector<std::vector<char>>& msgs) const
+{
+  uint32_t p(pin);
+  encode_msgs(key, true, ROUTEREXT_TRUNK, (const char*)&p, sizeof(p), msgs);
+}
+
+bool participant_list_t::decode(const char* payload, size_t len,
+                                uint8_t& flags,
+                                std::vector<participant_record_t>& records)
+{
+  records.clear();
+  if(len < PLISTHEADERSIZE)
+    return false;
+  size_t nrec((uint8_t)payload[1]);
+  if(len != PLISTHEADERSIZE + nrec * PRECSIZE)
+    return false;
+  flags = payload[0];
+  for(size_t k = 0; k < nrec; ++k) {
+    const char* rec(&payload[PLISTHEADERSIZE + k * PRECSIZE]);
+    participant_record_t r;
+    uint32_t mode;
+    r.cid = rec[0];
+    r.flags = rec[1];
+    memcpy(&mode, &rec[2], sizeof(mode));
+    r.mode = mode;
+    memcpy(&r.ep, &rec[2 + sizeof(mode)], sizeof(endpoint_t));
+    memcpy(&r.localep, &rec[2 + sizeof(mode) + sizeof(endpoint_t)],
+           sizeof(endpoint_t));
+    if(r.cid >= MAXEP)
+      return false;
+    records.push_back(r);
+  }
+  return true;
+}
+
+void participant_list_t::encode_msgs(secret_t secret, bool full,
+                                     sequence_t type, const char* prefix,
+                                     size_t prefix_len,
+                                     std::vector<std::vector<char>>& msgs) const
+{
+  msgs.clear();
+  const size_t maxrecords(
+      (BUFSIZE - HEADERLEN - prefix_len - PLISTHEADERSIZE) / PRECSIZE);
+  char buffer[BUFSIZE];
+  if(prefix_len)
+    memcpy(buffer, prefix, prefix_len);
+  char* payload(&buffer[prefix_len]);
+  size_t nrec(0);
+  uint8_t flags(full ? PLIST_FULL : 0);
+  for(size_t cid = 0; cid <= MAXEP; ++cid) {
+    bool last(cid == MAXEP);
+    if(!last) {
+      const participant_t& p(current[cid]);
+      if(full ? p.live : changed[cid]) {
+        char* rec(&payload[PLISTHEADERSIZE + nrec * PRECSIZE]);
+        rec[0] = cid;
+        rec[1] = p.live ? 0 : PREC_REMOVED;
+        uint32_t mode(p.mode);
+        memcpy(&rec[2], &mode, sizeof(mode));
+        memcpy(&rec[2 + sizeof(mode)], &p.ep, sizeof(endpoint_t));
+        memcpy(&rec[2 + sizeof(mode) + sizeof(endpoint_t)], &p.localep,
+               sizeof(endpoint_t));
+        ++nrec;
+      }
+    }
+    if((nrec == maxrecords) || (last && (nrec || full))) {
+      payload[0] = flags;
+      payload[1] = nrec;
+      msgs.push_back(std::vector<char>(BUFSIZE));
+      std::vector<char>& msg(msgs.back());
+      msg.resize(packmsg(msg.data(), BUFSIZE, secret, SERVER_CALLERID,
+                         PORT_ROUTEREXT, type, buffer,
+                         prefix_len + PLISTHEADERSIZE + nrec * PRECSIZE));
+      // only the first message of a full list resets the receiver:
+      flags = 0;
+      nrec = 0;
+    }
+  }
+}
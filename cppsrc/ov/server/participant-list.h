@@ -0,0 +1,80 @@
+#ifndef PARTICIPANT_LIST_H
+#define PARTICIPANT_LIST_H
+
+#include "callerlist.h"
+#include "ov-protocol.h"
+#include <vector>
+
+// flags of a participant list message:
+#define PLIST_FULL 1
+// flags of a participant record:
+#define PREC_REMOVED 1
+
+/**
+ * Participant list broadcast with one datagram per recipient.
+ *
+ * Message layout (port PORT_ROUTEREXT, sequence ROUTEREXT_PARTICIPANTS):
+ * uint8 flags (PLIST_FULL: the receiver replaces its list), uint8 number
+ * of records, followed by the records: uint8 cid, uint8 record flags
+ * (PREC_REMOVED), uint32 mode, public endpoint, local endpoint. Lists
+ * which exceed one datagram are continued in further messages without
+ * PLIST_FULL.
+ */
+/**
+ * One decoded participant record.
+ */
+struct participant_record_t {
+  stage_device_id_t cid;
+  uint8_t flags;
+  epmode_t mode;
+  endpoint_t ep;
+  endpoint_t localep;
+};
+
+class participant_list_t {
+public:
+  participant_list_t();
+  /**
+   * Take the current state of the endpoint list.
+   * @return True if participants joined, left or changed since the
+   * last call
+   */
+  bool update(const std::vector<ep_desc_t>& endpoints);
+  /**
+   * Encode the list into datagrams.
+   * @param full Encode all live participants, otherwise only the
+   * changes detected by the last update
+   * @param msgs Output, one element per datagram
+   */
+  void encode(secret_t secret, bool full,
+              std::vector<std::vector<char>>& msgs) const;
+  /**
+   * Encode all live participants as trunk list (ROUTEREXT_TRUNK): the
+   * payload starts with the pin of the stage, followed by the same
+   * list layout.
+   */
+  void encode_trunk(secret_t key, secret_t pin,
+                    std::vector<std::vector<char>>& msgs) const;
+  /**
+   * Decode the payload of a list message, without the pin of a trunk
+   * list.
+   * @return False if the payload is malformed
+   */
+  static bool decode(const char* payload, size_t len, uint8_t& flags,
+                     std::vector<participant_record_t>& records);
+
+private:
+  void encode_msgs(secret_t secret, bool full, sequence_t type,
+                   const char* prefix, size_t prefix_len,
+                   std::vector<std::vector<char>>& msgs) const;
+  struct participant_t {
+    bool live;
+    epmode_t mode;
+    endpoint_t ep;
+    endpoint_t localep;
+  };
+  participant_t current[MAXEP];
+  bool changed[MAXEP];
+};
+
+#endif // PARTICIPANT_LIST_H
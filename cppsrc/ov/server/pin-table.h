@@ -0,0 +1,114 @@
+#ifndef PIN_TABLE_H
+#define PIN_TABLE_H
+
+#include "common.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// initial number of slots of a pin table (power of two):
+#define PINTABLESIZE 64
+
+/**
+ * Map from session secret to stage for the shared port mode:
+ * open addressing with linear probing, at most half full. A lookup
+ * hashes the secret and usually reads a single slot, nothing is
+ * allocated except when the table grows.
+ *
+ * Not thread safe, the table is owned by one event loop.
+ */
+template <class T> class pin_table_t {
+public:
+  pin_table_t() : slots(PINTABLESIZE), bits(0), used(0)
+  {
+    while(((size_t)1 << bits) < slots.size())
+      ++bits;
+  };
+  /**
+   * @return Value stored for the secret, or NULL
+   */
+  T* find(secret_t pin) const
+  {
+    size_t mask(slots.size() - 1);
+    for(size_t k = hash(pin);; k = (k + 1) & mask) {
+      const slot_t& s(slots[k]);
+      if(!s.value)
+        return NULL;
+      if(s.pin == pin)
+        return s.value;
+    }
+  };
+  /**
+   * Add a secret, value must not be NULL.
+   * @return False if the secret is already used
+   */
+  bool insert(secret_t pin, T* value)
+  {
+    if(2 * (used + 1) > slots.size())
+      grow();
+    size_t mask(slots.size() - 1);
+    for(size_t k = hash(pin);; k = (k + 1) & mask) {
+      slot_t& s(slots[k]);
+      if(!s.value) {
+        s.pin = pin;
+        s.value = value;
+        ++used;
+        return true;
+      }
+      if(s.pin == pin)
+        return false;
+    }
+  };
+  /**
+   * Remove a secret if it is stored with this value.
+   */
+  void erase(secret_t pin, const T* value)
+  {
+    size_t mask(slots.size() - 1);
+    size_t k(hash(pin));
+    while(slots[k].value && (slots[k].pin != pin))
+      k = (k + 1) & mask;
+    if(slots[k].value != value)
+      return;
+    // shift the following entries of the probe sequence back, so that
+    // no lookup stops at the hole:
+    size_t hole(k);
+    for(size_t j = (k + 1) & mask; slots[j].value; j = (j + 1) & mask) {
+      size_t home(hash(slots[j].pin));
+      if(((j - home) & mask) >= ((j - hole) & mask)) {
+        slots[hole] = slots[j];
+        hole = j;
+      }
+    }
+    slots[hole].value = NULL;
+    --used;
+  };
+  size_t size() const { return used; };
+
+private:
+  struct slot_t {
+    slot_t() : pin(0), value(NULL){};
+    secret_t pin;
+    T* value;
+  };
+  size_t hash(secret_t pin) const
+  {
+    // Fibonacci hashing, the upper bits of the product are well mixed:
+    return (uint32_t)((uint32_t)pin * 2654435769u) >> (32 - bits);
+  };
+  void grow()
+  {
+    std::vector<slot_t> old(2 * slots.size());
+    old.swap(slots);
+    ++bits;
+    used = 0;
+    for(auto& s : old)
+      if(s.value)
+        insert(s.pin, s.value);
+  };
+  std::vector<slot_t> slots;
+  size_t bits;
+  size_t used;
+};
+
+#endif // PIN_TABLE_H
@@ -0,0 +1,129 @@
+#include "route-table.h"
+#include "errmsg.h"
+#include <string.h>
+#include <thread>
+
+void subscription_t::set_all()
+{
+  for(auto& w : words)
+    w.store(~(uint64_t)0, std::memory_order_relaxed);
+}
+
+bool subscription_t::set(const char* mask, size_t len)
+{
+  bool changed(false);
+  for(size_t k = 0; k < sizeof(words) / sizeof(words[0]); ++k) {
+    uint64_t w(~(uint64_t)0);
+    for(size_t b = 0; b < 8; ++b)
+      if(k * 8 + b < len) {
+        w &= ~((uint64_t)0xff << (8 * b));
+        w |= (uint64_t)(uint8_t)mask[k * 8 + b] << (8 * b);
+      }
+    if(words[k].exchange(w, std::memory_order_relaxed) != w)
+      changed = true;
+  }
+  return changed;
+}
+
+endpoint_state_t::endpoint_state_t()
+{
+  memset(active_set, 0, sizeof(active_set));
+  memset(downmix_set, 0, sizeof(downmix_set));
+  memset(mode, 0, sizeof(mode));
+  memset(ep, 0, sizeof(ep));
+}
+
+void endpoint_state_t::update(const std::vector<ep_desc_t>& endpoints)
+{
+  memset(active_set, 0, sizeof(active_set));
+  memset(downmix_set, 0, sizeof(downmix_set));
+  for(stage_device_id_t cid = 0; cid != MAXEP; ++cid) {
+    const ep_desc_t& e(endpoints[cid]);
+    mode[cid] = e.mode;
+    ep[cid] = e.ep;
+    if(e.timeout > 0) {
+      active_set[cid / 64] |= (uint64_t)1 << (cid % 64);
+      if(e.mode & B_DOWNMIXONLY)
+        downmix_set[cid / 64] |= (uint64_t)1 << (cid % 64);
+    }
+  }
+}
+
+route_snapshot_t::route_snapshot_t()
+{
+  memset(begin, 0, sizeof(begin));
+}
+
+route_table_t::route_table_t()
+    : current(&buffers[0]), epoch(1), num_readers(0)
+{
+  for(size_t k = 0; k < MAXROUTEREADERS; ++k)
+    readers[k] = 0;
+}
+
+size_t route_table_t::add_reader()
+{
+  size_t reader(num_readers++);
+  if(reader >= MAXROUTEREADERS)
+    throw ErrMsg("Too many route table readers");
+  return reader;
+}
+
+bool route_table_t::relay_to(const endpoint_state_t& endpoints,
+                             stage_device_id_t src, stage_device_id_t dest)
+{
+  return (dest != src) && endpoints.active(dest) &&
+         (!(endpoints.mode[dest] & B_DONOTSEND)) &&
+         ((!(endpoints.mode[dest] & B_PEER2PEER)) ||
+          (!(endpoints.mode[src] & B_PEER2PEER))) &&
+         ((!(endpoints.mode[dest] & B_DOWNMIXONLY)) || (src == MAXEP - 1));
+}
+
+void route_table_t::rebuild(const endpoint_state_t& endpoints,
+                            const subscription_t* subscriptions)
+{
+  std::lock_guard<std::mutex> lk(writemtx);
+  route_snapshot_t* old(current.load());
+  route_snapshot_t* next(old == &buffers[0] ? &buffers[1] : &buffers[0]);
+  // only live endpoints can receive:
+  std::vector<stage_device_id_t> live;
+  for(stage_device_id_t cid = 0; cid != MAXEP; ++cid)
+    if(endpoints.active(cid))
+      live.push_back(cid);
+  next->dest.clear();
+  next->dest_cid.clear();
+  for(stage_device_id_t src = 0; src != MAXEP; ++src) {
+    next->begin[src] = next->dest.size();
+    for(auto dest : live) {
+      if(relay_to(endpoints, src, dest) &&
+         (!subscriptions || subscriptions[dest].test(src))) {
+        next->dest.push_back(endpoints.ep[dest]);
+        next->dest_cid.push_back(dest);
+      }
+    }
+  }
+  next->begin[MAXEP] = next->dest.size();
+  next->endpoints = endpoints;
+  // publish, then wait until no reader can see the old snapshot, so
+  // that it can be reused by the next rebuild:
+  current = next;
+  uint64_t e(++epoch);
+  size_t n(std::min((size_t)num_readers, (size_t)MAXROUTEREADERS));
+  for(size_t r = 0; r < n; ++r) {
+    uint64_t re;
+    while(((re = readers[r].load()) != 0) && (re < e))
+      std::this_thread::yield();
+  }
+}
+
+route_table_t::read_guard_t::read_guard_t(route_table_t& table, size_t reader)
+    : table(table), reader(reader)
+{
+  table.readers[reader] = table.epoch.load();
+  snapshot = table.current.load();
+}
+
+route_table_t::read_guard_t::~read_guard_t()
+{
+  table.readers[reader].store(0, std::memory_order_release);
+}
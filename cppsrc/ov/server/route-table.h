@@ -0,0 +1,132 @@
+#ifndef ROUTE_TABLE_H
+#define ROUTE_TABLE_H
+
+#include "callerlist.h"
+#include "common.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// maximum number of threads reading the route table concurrently:
+#define MAXROUTEREADERS 16
+// number of 64 bit words of an endpoint bit set:
+#define EPWORDS ((MAXEP + 63) / 64)
+
+/**
+ * Set of senders a receiver wants to get audio from, see
+ * ROUTEREXT_SUBSCRIBE. Written by the relay threads, read by rebuild.
+ */
+class subscription_t {
+public:
+  subscription_t() { set_all(); };
+  void set_all();
+  /**
+   * @return True if the set changed
+   */
+  bool set(const char* mask, size_t len);
+  bool test(stage_device_id_t cid) const
+  {
+    return (words[cid / 64].load(std::memory_order_relaxed) >> (cid % 64)) &
+           1;
+  };
+
+private:
+  std::atomic<uint64_t> words[EPWORDS];
+};
+
+/**
+ * Routing fields of all endpoints (timeout, mode, address) in dense
+ * arrays, copied from the endpoint list by the control path. Threads
+ * which need them per packet or per mix period read this copy instead
+ * of ep_desc_t, whose statistics and version string spread the three
+ * fields over several cache lines per endpoint. The two bit sets share
+ * one cache line.
+ */
+class endpoint_state_t {
+public:
+  endpoint_state_t();
+  void update(const std::vector<ep_desc_t>& endpoints);
+  bool active(stage_device_id_t cid) const
+  {
+    return (active_set[cid / 64] >> (cid % 64)) & 1;
+  };
+  bool downmix(stage_device_id_t cid) const
+  {
+    return (downmix_set[cid / 64] >> (cid % 64)) & 1;
+  };
+  // endpoints with a non-zero timeout:
+  uint64_t active_set[EPWORDS];
+  // active endpoints in B_DOWNMIXONLY mode:
+  uint64_t downmix_set[EPWORDS];
+  epmode_t mode[MAXEP];
+  endpoint_t ep[MAXEP];
+};
+
+/**
+ * Destinations of all senders in compressed row layout: the receivers
+ * of sender cid are dest[begin[cid]] ... dest[begin[cid + 1] - 1].
+ */
+class route_snapshot_t {
+public:
+  route_snapshot_t();
+  uint32_t begin[MAXEP + 1];
+  std::vector<endpoint_t> dest;
+  std::vector<stage_device_id_t> dest_cid;
+  // endpoint state from which the table was built:
+  endpoint_state_t endpoints;
+};
+
+/**
+ * Per-sender routing table. The table is rebuilt by the control path
+ * whenever the set of receivers changes, and published as a new
+ * snapshot. Readers never lock: they announce the epoch in which they
+ * started reading, and a writer reuses a snapshot only after all
+ * readers which may still see it have finished (double buffering with
+ * an epoch based grace period).
+ */
+class route_table_t {
+public:
+  route_table_t();
+  /**
+   * Register a reader thread.
+   * @return Reader slot, to be used with read_guard_t
+   */
+  size_t add_reader();
+  /**
+   * Rebuild the destination lists from the endpoint state and publish
+   * them together with the state. Must not be called while holding a
+   * read guard.
+   * @param subscriptions MAXEP receiver subscriptions, or NULL to relay
+   * all senders
+   */
+  void rebuild(const endpoint_state_t& endpoints,
+               const subscription_t* subscriptions = NULL);
+  /**
+   * Routing rule: should packets of src be forwarded to dest?
+   */
+  static bool relay_to(const endpoint_state_t& endpoints,
+                       stage_device_id_t src, stage_device_id_t dest);
+
+  class read_guard_t {
+  public:
+    read_guard_t(route_table_t& table, size_t reader);
+    ~read_guard_t();
+    const route_snapshot_t* operator->() const { return snapshot; };
+
+  private:
+    route_table_t& table;
+    size_t reader;
+    const route_snapshot_t* snapshot;
+  };
+
+private:
+  route_snapshot_t buffers[2];
+  std::atomic<route_snapshot_t*> current;
+  std::atomic<uint64_t> epoch;
+  // epoch in which a reader started, or zero if not reading:
+  std::atomic<uint64_t> readers[MAXROUTEREADERS];
+  std::atomic<size_t> num_readers;
+  std::mutex writemtx;
+};
+
+#endif // ROUTE_TABLE_H
@@ -0,0 +1,147 @@
+#include "sched-probe.h"
+#include "common.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+// number of sub-buckets per power of two:
+#define HISTSUBBUCKETS 16
+
+latency_histogram_t::latency_histogram_t()
+{
+  clear();
+}
+
+void latency_histogram_t::clear()
+{
+  memset(buckets, 0, sizeof(buckets));
+  count = 0;
+  max = 0;
+}
+
+size_t latency_histogram_t::index(uint32_t us)
+{
+  if(us < 2 * HISTSUBBUCKETS)
+    return us;
+  // position of the most significant bit:
+  uint32_t msb(31 - __builtin_clz(us));
+  uint32_t shift(msb - 4);
+  size_t idx((shift + 1) * HISTSUBBUCKETS + ((us >> shift) - HISTSUBBUCKETS));
+  return std::min(idx, (size_t)(HISTBUCKETS - 1));
+}
+
+uint32_t latency_histogram_t::upper(size_t idx)
+{
+  if(idx < 2 * HISTSUBBUCKETS)
+    return idx;
+  uint32_t shift(idx / HISTSUBBUCKETS - 1);
+  return (((idx % HISTSUBBUCKETS) + HISTSUBBUCKETS + 1) << shift) - 1;
+}
+
+void latency_histogram_t::add(uint32_t us)
+{
+  ++buckets[index(us)];
+  ++count;
+  max = std::max(max, us);
+}
+
+void latency_histogram_t::add(const latency_histogram_t& h)
+{
+  for(size_t k = 0; k < HISTBUCKETS; ++k)
+    buckets[k] += h.buckets[k];
+  count += h.count;
+  max = std::max(max, h.max);
+}
+
+uint32_t latency_histogram_t::quantile(double q) const
+{
+  if(!count)
+    return 0;
+  uint64_t rank(q * count);
+  uint64_t sum(0);
+  for(size_t k = 0; k < HISTBUCKETS; ++k) {
+    sum += buckets[k];
+    if(sum > rank)
+      return std::min(upper(k), max);
+  }
+  return max;
+}
+
+std::mutex sched_probe_t::mtx;
+size_t sched_probe_t::users(0);
+std::atomic<bool> sched_probe_t::running(false);
+std::thread sched_probe_t::thread;
+std::mutex sched_probe_t::statsmtx;
+sched_stats_t sched_probe_t::stats = {-1, -1, -1, -1};
+
+void sched_probe_t::acquire(int prio)
+{
+  std::lock_guard<std::mutex> lk(mtx);
+  if(users++ == 0) {
+    running = true;
+    thread = std::thread(&sched_probe_t::run, prio);
+  }
+}
+
+void sched_probe_t::release()
+{
+  std::lock_guard<std::mutex> lk(mtx);
+  if(users == 0)
+    return;
+  if(--users == 0) {
+    running = false;
+    thread.join();
+  }
+}
+
+sched_stats_t sched_probe_t::get_stats()
+{
+  std::lock_guard<std::mutex> lk(statsmtx);
+  return stats;
+}
+
+void sched_probe_t::run(int prio)
+{
+  set_thread_prio(prio);
+  latency_histogram_t windows[PROBEWINDOWS];
+  latency_histogram_t sum;
+  size_t current(0);
+  uint32_t ticks(0);
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while(running) {
+    next.tv_nsec += PROBEPERIODUS * 1000;
+    if(next.tv_nsec >= 1000000000) {
+      next.tv_nsec -= 1000000000;
+      ++next.tv_sec;
+    }
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) ==
+          EINTR) {
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t late_ns((now.tv_sec - next.tv_sec) * 1000000000ll +
+                    (now.tv_nsec - next.tv_nsec));
+    windows[current].add(std::max((int64_t)0, late_ns / 1000));
+    if(late_ns > PROBEPERIODUS * 1000ll) {
+      // we missed wakeups, do not try to catch up:
+      next = now;
+    }
+    if(++ticks == 1000000 / PROBEPERIODUS) {
+      // one second is complete, publish and move to the next window:
+      ticks = 0;
+      sum.clear();
+      for(size_t k = 0; k < PROBEWINDOWS; ++k)
+        sum.add(windows[k]);
+      {
+        std::lock_guard<std::mutex> lk(statsmtx);
+        stats.p50 = 0.001 * sum.quantile(0.5);
+        stats.p99 = 0.001 * sum.quantile(0.99);
+        stats.p999 = 0.001 * sum.quantile(0.999);
+        stats.max = 0.001 * sum.get_max();
+      }
+      current = (current + 1) % PROBEWINDOWS;
+      windows[current].clear();
+    }
+  }
+}
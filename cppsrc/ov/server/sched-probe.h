@@ -0,0 +1,81 @@
+#ifndef SCHED_PROBE_H
+#define SCHED_PROBE_H
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+
+// wakeup period of the scheduler latency probe, in microseconds:
+#define PROBEPERIODUS 2000
+// number of one second windows the statistics are taken from:
+#define PROBEWINDOWS 10
+// number of histogram buckets, covers lateness up to 30 s:
+#define HISTBUCKETS 352
+
+/**
+ * Log-linear histogram of values in microseconds, with a relative
+ * resolution of 1/16 above 32 us (similar to HDR histograms).
+ */
+class latency_histogram_t {
+public:
+  latency_histogram_t();
+  void clear();
+  void add(uint32_t us);
+  void add(const latency_histogram_t& h);
+  /**
+   * Value below which the given fraction of all samples lies.
+   * @param q Quantile, 0..1
+   * @return Upper bound of the bucket, in microseconds
+   */
+  uint32_t quantile(double q) const;
+  uint32_t get_max() const { return max; };
+  uint64_t get_count() const { return count; };
+
+private:
+  static size_t index(uint32_t us);
+  static uint32_t upper(size_t idx);
+  uint64_t buckets[HISTBUCKETS];
+  uint64_t count;
+  uint32_t max;
+};
+
+/**
+ * Scheduling latency statistics, lateness of wakeups in milliseconds.
+ */
+struct sched_stats_t {
+  double p50;
+  double p99;
+  double p999;
+  double max;
+};
+
+/**
+ * Process-wide scheduler latency probe: one thread wakes up every
+ * PROBEPERIODUS at absolute times and records its lateness. The
+ * statistics are computed over the last PROBEWINDOWS seconds.
+ */
+class sched_probe_t {
+public:
+  /**
+   * Start the probe if this is the first user.
+   * @param prio Thread priority of the probe, should match the relay
+   */
+  static void acquire(int prio);
+  /**
+   * Stop the probe when the last user is gone.
+   */
+  static void release();
+  static sched_stats_t get_stats();
+
+private:
+  static void run(int prio);
+  static std::mutex mtx;
+  static size_t users;
+  static std::atomic<bool> running;
+  static std::thread thread;
+  static std::mutex statsmtx;
+  static sched_stats_t stats;
+};
+
+#endif // SCHED_PROBE_H
@@ -0,0 +1,115 @@
+#include "send-queue.h"
+#include <string.h>
+#include <thread>
+#include <time.h>
+
+send_queue_t::send_queue_t() : next(0), dropped(0)
+{
+  active.reserve(MAXEP + 1);
+}
+
+void send_queue_t::push(stage_device_id_t cid, const endpoint_t& ep,
+                        const char* buf, size_t len)
+{
+  if(len > BUFSIZE)
+    return;
+  if(!receivers[cid])
+    receivers[cid].reset(new receiver_t());
+  receiver_t& r(*receivers[cid]);
+  if(!r.count) {
+    active.push_back(cid);
+  } else if(r.count == SENDQUEUESIZE) {
+    // drop oldest:
+    r.head = (r.head + 1) % SENDQUEUESIZE;
+    --r.count;
+    ++dropped;
+  }
+  packet_t& p(r.packets[(r.head + r.count) % SENDQUEUESIZE]);
+  p.ep = ep;
+  p.len = len;
+  memcpy(p.data, buf, len);
+  ++r.count;
+}
+
+size_t send_queue_t::flush(ovbox_batch_socket_t& socket)
+{
+  size_t failed(0);
+  size_t num(active.size());
+  if(!num)
+    return 0;
+  bool blocked(false);
+  for(size_t k = 0; (k < num) && !blocked; ++k) {
+    receiver_t& r(*receivers[active[(next + k) % num]]);
+    while(r.count) {
+      const packet_t& p(r.packets[r.head]);
+      send_result_t res(socket.send_nowait(p.data, p.len, p.ep));
+      if(res == SEND_AGAIN) {
+        blocked = true;
+        break;
+      }
+      if(res == SEND_FAILED)
+        ++failed;
+      r.head = (r.head + 1) % SENDQUEUESIZE;
+      --r.count;
+    }
+  }
+  // rotate the first receiver, so that all backlogs make progress:
+  next = (next + 1) % num;
+  for(size_t k = 0; k < active.size();) {
+    if(receivers[active[k]]->count) {
+      ++k;
+    } else {
+      active[k] = active.back();
+      active.pop_back();
+    }
+  }
+  if(next >= active.size())
+    next = 0;
+  return failed;
+}
+
+uint64_t send_queue_t::take_dropped()
+{
+  uint64_t d(dropped);
+  dropped = 0;
+  return d;
+}
+
+control_pacer_t::control_pacer_t(ovbox_batch_socket_t& socket)
+    : socket(socket), txtime(false), may_sleep(false), slot_ns(0), in_slot(0),
+      begin_ns(0)
+{
+}
+
+void control_pacer_t::configure(bool txtime_, bool may_sleep_)
+{
+  txtime = txtime_;
+  may_sleep = may_sleep_;
+}
+
+void control_pacer_t::begin()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  slot_ns = begin_ns = now.tv_sec * 1000000000ull + now.tv_nsec;
+  in_slot = 0;
+}
+
+void control_pacer_t::send(const char* buf, size_t len, const endpoint_t& ep)
+{
+  if(in_slot == PACEBURST) {
+    in_slot = 0;
+    slot_ns += PACESLOTUS * 1000ull;
+    if(may_sleep && !txtime) {
+      // a large burst must not delay the pings of the next period:
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if(now.tv_sec * 1000000000ull + now.tv_nsec - begin_ns <
+         PACEMAXSPREADUS * 1000ull)
+        std::this_thread::sleep_for(std::chrono::microseconds(PACESLOTUS));
+    }
+  }
+  ++in_slot;
+  if(!(txtime && socket.send_at(buf, len, ep, slot_ns)))
+    socket.send(buf, len, ep);
+}
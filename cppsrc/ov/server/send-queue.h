@@ -0,0 +1,108 @@
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+#include "batch-socket.h"
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+// capacity of the backlog of each receiver, in datagrams:
+#define SENDQUEUESIZE 16
+// number of control datagrams sent per pacing slot:
+#define PACEBURST 8
+// distance of the pacing slots, in microseconds:
+#define PACESLOTUS 500
+// longest time a sleeping pacer spreads a burst over, a quarter of the
+// ping period, in microseconds; the rest of a larger burst is sent at once:
+#define PACEMAXSPREADUS (PINGPERIODMS * 250)
+
+/**
+ * Per-receiver backlog of a relay thread. Datagrams which cannot be
+ * sent without blocking are copied here instead of stalling the relay,
+ * and sent before any newer datagram of the same receiver. If the
+ * backlog of a receiver is full, its oldest datagram is dropped, so
+ * that a receiver which cannot keep up only loses its own packets.
+ *
+ * The backlog of a receiver is allocated on first use; nothing is
+ * allocated or copied while the socket accepts all datagrams.
+ */
+class send_queue_t {
+public:
+  send_queue_t();
+  /**
+   * Are datagrams of this receiver waiting? New datagrams have to be
+   * queued then, to keep the order.
+   */
+  bool pending(stage_device_id_t cid) const
+  {
+    return receivers[cid] && receivers[cid]->count;
+  };
+  bool empty() const { return active.empty(); };
+  void push(stage_device_id_t cid, const endpoint_t& ep, const char* buf,
+            size_t len);
+  /**
+   * Send queued datagrams until the socket would block, starting with a
+   * different receiver each time.
+   * @return Number of datagrams which could not be sent
+   */
+  size_t flush(ovbox_batch_socket_t& socket);
+  /**
+   * Number of datagrams dropped from full backlogs since the last call.
+   */
+  uint64_t take_dropped();
+
+private:
+  struct packet_t {
+    endpoint_t ep;
+    size_t len;
+    char data[BUFSIZE];
+  };
+  struct receiver_t {
+    receiver_t() : head(0), count(0){};
+    size_t head;
+    size_t count;
+    packet_t packets[SENDQUEUESIZE];
+  };
+  // one more receiver for the trunks of the stage (SERVER_CALLERID):
+  std::unique_ptr<receiver_t> receivers[MAXEP + 1];
+  // receivers with queued datagrams:
+  std::vector<stage_device_id_t> active;
+  size_t next;
+  uint64_t dropped;
+};
+
+/**
+ * Spreads bursts of control datagrams (participant lists) into slots of
+ * PACEBURST datagrams every PACESLOTUS, so that they do not overrun the
+ * send buffer while audio is relayed. With SO_TXTIME the kernel (fq
+ * qdisc) releases the datagrams at their slot time; otherwise the
+ * sending thread sleeps between slots, if it is allowed to block, for at
+ * most PACEMAXSPREADUS per burst. Pings are not paced, they are sent
+ * before the burst starts. Without SO_TXTIME and without sleeping
+ * (hosted stages) a burst goes out at once.
+ */
+class control_pacer_t {
+public:
+  control_pacer_t(ovbox_batch_socket_t& socket);
+  /**
+   * @param txtime Use SO_TXTIME, the socket has to be configured
+   * @param may_sleep The sending thread may sleep between slots
+   */
+  void configure(bool txtime, bool may_sleep);
+  /**
+   * Start a burst, the first slot is sent immediately.
+   */
+  void begin();
+  void send(const char* buf, size_t len, const endpoint_t& ep);
+
+private:
+  ovbox_batch_socket_t& socket;
+  bool txtime;
+  bool may_sleep;
+  uint64_t slot_ns;
+  uint32_t in_slot;
+  // start of the current burst (CLOCK_MONOTONIC):
+  uint64_t begin_ns;
+};
+
+#endif // SEND_QUEUE_H
@@ -0,0 +1,112 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// size of a cache line, used to keep producer and consumer indices apart:
+#define CACHELINESIZE 64
+
+/**
+ * Bounded lock-free single producer single consumer queue. All storage
+ * is preallocated, push and pop never block or allocate. If the queue
+ * is full, the element is dropped and counted.
+ *
+ * N must be a power of two.
+ */
+template <class T, size_t N> class spsc_queue_t {
+  static_assert((N & (N - 1)) == 0, "queue size must be a power of two");
+
+public:
+  spsc_queue_t() : head(0), tail(0), dropped(0){};
+  /**
+   * Add an element, called by the producer thread only.
+   * @return False if the queue was full and the element was dropped
+   */
+  bool push(const T& v)
+  {
+    size_t t(tail.load(std::memory_order_relaxed));
+    if(t - head.load(std::memory_order_acquire) == N) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    buf[t & (N - 1)] = v;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  };
+  /**
+   * Zero copy variant of push: slot of the next element, or NULL if the
+   * queue is full (the element is counted as dropped). The element is
+   * published by commit().
+   */
+  T* reserve()
+  {
+    size_t t(tail.load(std::memory_order_relaxed));
+    if(t - head.load(std::memory_order_acquire) == N) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return NULL;
+    }
+    return &buf[t & (N - 1)];
+  };
+  void commit()
+  {
+    tail.store(tail.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  };
+  /**
+   * Take the oldest element, called by the consumer thread only.
+   * @return False if the queue was empty
+   */
+  bool pop(T& v)
+  {
+    size_t h(head.load(std::memory_order_relaxed));
+    if(h == tail.load(std::memory_order_acquire))
+      return false;
+    v = buf[h & (N - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  };
+  /**
+   * Zero copy variant of pop: oldest element, or NULL if the queue is
+   * empty. The element stays valid until release().
+   */
+  T* front()
+  {
+    size_t h(head.load(std::memory_order_relaxed));
+    if(h == tail.load(std::memory_order_acquire))
+      return NULL;
+    return &buf[h & (N - 1)];
+  };
+  void release()
+  {
+    head.store(head.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  };
+  size_t size() const
+  {
+    return tail.load(std::memory_order_acquire) -
+           head.load(std::memory_order_acquire);
+  };
+  /**
+   * Number of elements dropped since the last call, called by the
+   * consumer thread.
+   */
+  uint64_t take_dropped()
+  {
+    return dropped.exchange(0, std::memory_order_relaxed);
+  };
+
+private:
+  // consumer index:
+  std::atomic<size_t> head;
+  char pad0[CACHELINESIZE - sizeof(std::atomic<size_t>)];
+  // producer index:
+  std::atomic<size_t> tail;
+  std::atomic<uint64_t> dropped;
+  char pad1[CACHELINESIZE - sizeof(std::atomic<size_t>) -
+            sizeof(std::atomic<uint64_t>)];
+  T buf[N];
+};
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,137 @@
+#include "napi-thread-safe-callback.hpp"
+
+#include "ov-server-wrapper.h"
+#include "stage-engine-wrapper.h"
+
+Napi::FunctionReference OvStageEngineWrapper::constructor;
+
+Napi::Object OvStageEngineWrapper::Init(Napi::Env env, Napi::Object exports)
+{
+  Napi::HandleScope scope(env);
+
+  Napi::Function func = DefineClass(
+      env, "OvStageEngineWrapper",
+      {InstanceMethod("addStage", &OvStageEngineWrapper::AddStage),
+       InstanceMethod("removeStage", &OvStageEngineWrapper::RemoveStage),
+       InstanceMethod("getMetrics", &OvStageEngineWrapper::GetMetrics),
+       InstanceMethod("stop", &OvStageEngineWrapper::Stop)});
+
+  constructor = Napi::Persistent(func);
+  constructor.SuppressDestruct();
+
+  exports.Set("OvStageEngineWrapper", func);
+  return exports;
+}
+
+OvStageEngineWrapper::OvStageEngineWrapper(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<OvStageEngineWrapper>(info), engine_(NULL)
+{
+  Napi::Env env = info.Env();
+  int length = info.Length();
+
+  if(length < 1 || length > 3) {
+    Napi::TypeError::New(env, "One to three arguments expected")
+        .ThrowAsJavaScriptException();
+    return;
+  }
+  if(!info[0].IsNumber()) {
+    Napi::TypeError::New(env, "First argument is not a number")
+        .ThrowAsJavaScriptException();
+    return;
+  }
+  if(length >= 2 && !info[1].IsNumber()) {
+    Napi::TypeError::New(env, "Second argument is not a number")
+        .ThrowAsJavaScriptException();
+    return;
+  }
+  if(length == 3 && !info[2].IsObject()) {
+    Napi::TypeError::New(env, "Third argument is not an object")
+        .ThrowAsJavaScriptException();
+    return;
+  }
+
+  // Initialize class
+  prio_ = info[0].As<Napi::Number>().Int32Value();
+  unsigned int threads(0);
+  if(length >= 2)
+    threads = info[1].As<Napi::Number>().Uint32Value();
+  if(length == 3)
+    options_ = OvServerWrapper::ParseOptions(info[2].As<Napi::Object>());
+  // stages are always driven by the event loops of the engine:
+  options_.hosted = true;
+  try {
+    this->engine_ = new ov_stage_engine_t(
+        prio_, threads, options_.shared_port, options_.send_buffer);
+  }
+  catch(const std::exception& e) {
+    Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+    return;
+  }
+
+  // Bind events, shared by all stages
+  this->callback_ = std::make_shared<ThreadSafeCallback>(
+      info.This().As<Napi::Object>(),
+      info.This().As<Napi::Object>().Get("emit").As<Napi::Function>());
+}
+
+Napi::Value OvStageEngineWrapper::AddStage(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  if(info.Length() != 2 || !info[0].IsNumber() || !info[1].IsString()) {
+    Napi::TypeError::New(env, "Port and stage id expected")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if(!this->engine_) {
+    Napi::Error::New(env, "Engine is stopped").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  try {
+    ov_server_t* stage =
+        new ov_server_t(info[0].As<Napi::Number>().Int32Value(), prio_,
+                        info[1].As<Napi::String>().Utf8Value(), options_);
+    OvServerWrapper::BindEvents(stage, this->callback_);
+    int port(stage->portno);
+    this->engine_->add_stage(stage);
+    return Napi::Number::New(env, port);
+  }
+  catch(const std::exception& e) {
+    Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+}
+
+Napi::Value OvStageEngineWrapper::RemoveStage(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  if(info.Length() != 1 || !info[0].IsString()) {
+    Napi::TypeError::New(env, "Stage id expected")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  bool removed(false);
+  if(this->engine_)
+    removed =
+        this->engine_->remove_stage(info[0].As<Napi::String>().Utf8Value());
+  return Napi::Boolean::New(env, removed);
+}
+
+Napi::Value OvStageEngineWrapper::GetMetrics(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  std::vector<stage_metrics_t> metrics;
+  if(this->engine_)
+    this->engine_->get_metrics(metrics);
+  Napi::Array result = Napi::Array::New(env, metrics.size());
+  for(size_t k = 0; k < metrics.size(); ++k)
+    result.Set((uint32_t)k, OvServerWrapper::MetricsToObject(env, metrics[k]));
+  return result;
+}
+
+Napi::Value OvStageEngineWrapper::Stop(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  delete this->engine_;
+  this->engine_ = NULL;
+  return Napi::String::New(env, "stopped");
+}
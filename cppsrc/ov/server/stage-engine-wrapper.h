@@ -0,0 +1,23 @@
+#include "stage-engine.h"
+#include <memory>
+#include <napi.h>
+
+class ThreadSafeCallback;
+
+class OvStageEngineWrapper : public Napi::ObjectWrap<OvStageEngineWrapper> {
+public:
+  static Napi::Object Init(Napi::Env env, Napi::Object exports);
+  OvStageEngineWrapper(const Napi::CallbackInfo& info);
+
+private:
+  static Napi::FunctionReference constructor;
+  Napi::Value AddStage(const Napi::CallbackInfo& info);
+  Napi::Value RemoveStage(const Napi::CallbackInfo& info);
+  Napi::Value Stop(const Napi::CallbackInfo& info);
+  Napi::Value GetMetrics(const Napi::CallbackInfo& info);
+
+  int prio_;
+  ov_server_options_t options_;
+  ov_stage_engine_t* engine_;
+  std::shared_ptr<ThreadSafeCallback> callback_;
+};
@@ -0,0 +1,289 @@
+#include "stage-engine.h"
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// maximum number of socket events handled per epoll_wait call:
+#define MAXEVENTS 64
+// receive buffer of a shared socket, which takes the traffic of many
+// stages (capped by net.core.rmem_max):
+#define SHAREDRCVBUF (4 << 20)
+
+ov_io_loop_t::ov_io_loop_t(int prio, size_t index, size_t num_loops,
+                           ovbox_batch_socket_t* shared)
+    : prio(prio), index(index), num_loops(num_loops),
+      epfd(epoll_create1(EPOLL_CLOEXEC)),
+      evfd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), running(true),
+      num_stages(0), rx(new rx_batch_t()), tx(new tx_batch_t()),
+      shared(shared), batch_owner(RXBATCHSIZE), batch_stage(RXBATCHSIZE),
+      batch_index(RXBATCHSIZE)
+{
+  if(epfd < 0)
+    throw ErrMsg("Unable to create epoll instance", errno);
+  if(evfd < 0)
+    throw ErrMsg("Unable to create eventfd", errno);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev);
+  if(shared) {
+    ev.data.ptr = shared;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, shared->get_fd(), &ev);
+  }
+  thread = std::thread(&ov_io_loop_t::run, this);
+}
+
+ov_io_loop_t::~ov_io_loop_t()
+{
+  running = false;
+  wakeup();
+  thread.join();
+  // delete remaining stages, including those never attached; hosted
+  // stages have no threads, so this does not block:
+  stages.clear();
+  for(auto& cmd : commands)
+    delete cmd.stage;
+  close(evfd);
+  close(epfd);
+}
+
+void ov_io_loop_t::post_add(ov_server_t* stage)
+{
+  {
+    std::lock_guard<std::mutex> lk(cmdmtx);
+    commands.push_back({stage, stage->get_stage_id()});
+  }
+  ++num_stages;
+  wakeup();
+}
+
+void ov_io_loop_t::post_remove(const std::string& stage_id)
+{
+  {
+    std::lock_guard<std::mutex> lk(cmdmtx);
+    commands.push_back({NULL, stage_id});
+  }
+  wakeup();
+}
+
+void ov_io_loop_t::wakeup()
+{
+  uint64_t v(1);
+  if(write(evfd, &v, sizeof(v)) < 0) {
+    // counter is already non-zero, the loop will wake up anyway
+  }
+}
+
+void ov_io_loop_t::process_commands()
+{
+  std::vector<command_t> cmds;
+  {
+    std::lock_guard<std::mutex> lk(cmdmtx);
+    cmds.swap(commands);
+  }
+  // keep the order, a stage may be removed and added again:
+  for(auto& cmd : cmds) {
+    if(cmd.stage)
+      attach(cmd.stage);
+    else
+      detach(cmd.stage_id);
+  }
+}
+
+void ov_io_loop_t::attach(ov_server_t* stage)
+{
+  hosted_stage_t& hs(stages[stage->get_stage_id()]);
+  hs.server.reset(stage);
+  if(shared) {
+    stage->share_socket(*shared);
+    stage->claim_pin = [this, stage](secret_t pin) {
+      return claim_pin(stage, pin);
+    };
+  } else {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = stage;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, stage->get_fd(), &ev);
+  }
+  // spread the timers of the stages over the ping period:
+  uint32_t offset(std::hash<std::string>()(stage->get_stage_id()) %
+                  PINGPERIODMS);
+  hs.ping_timer = timers.add(PINGPERIODMS, offset,
+                             [stage]() { stage->ping_and_callerlist(); });
+  hs.announce_timer = timers.add(PINGPERIODMS, offset,
+                                 [stage]() { stage->announce(); });
+  hs.route_timer = timers.add(ROUTEREFRESHMS, 0,
+                              [stage]() { stage->refresh_routes(); });
+  if(stage->on_ready)
+    stage->on_ready(stage->portno);
+}
+
+void ov_io_loop_t::detach(const std::string& stage_id)
+{
+  auto it(stages.find(stage_id));
+  if(it == stages.end())
+    return;
+  if(shared)
+    pins.erase(it->second.server->get_pin(), it->second.server.get());
+  else
+    epoll_ctl(epfd, EPOLL_CTL_DEL, it->second.server->get_fd(), NULL);
+  timers.remove(it->second.ping_timer);
+  timers.remove(it->second.announce_timer);
+  timers.remove(it->second.route_timer);
+  ov_server_release(it->second.server.release());
+  stages.erase(it);
+  --num_stages;
+}
+
+bool ov_io_loop_t::claim_pin(ov_server_t* stage, secret_t pin)
+{
+  // the kernel steers by the first byte of the secret on the wire, which
+  // is its low byte on little endian hosts:
+  if((pin & 0xff) % num_loops != index)
+    return false;
+  if(!pins.insert(pin, stage))
+    return false;
+  if(stage->get_pin() != pin)
+    pins.erase(stage->get_pin(), stage);
+  return true;
+}
+
+void ov_io_loop_t::process_shared()
+{
+  // take at most one batch, as for a socket of a single stage:
+  if(!shared->recv_batch(*rx, false))
+    return;
+  // group the datagrams by stage, keeping their order; the payload stays
+  // in the receive buffers:
+  size_t num_stages(0);
+  for(size_t k = 0; k < rx->count; ++k) {
+    ov_server_t* stage(NULL);
+    if(rx->len[k] >= HEADERLEN)
+      stage = pins.find(msg_secret(rx->buf[k]));
+    batch_owner[k] = stage;
+    if(!stage)
+      continue;
+    size_t s(0);
+    while((s < num_stages) && (batch_stage[s] != stage))
+      ++s;
+    if(s == num_stages)
+      batch_stage[num_stages++] = stage;
+  }
+  for(size_t s = 0; s < num_stages; ++s) {
+    size_t num(0);
+    for(size_t k = 0; k < rx->count; ++k)
+      if(batch_owner[k] == batch_stage[s])
+        batch_index[num++] = k;
+    batch_stage[s]->process_shared(*rx, batch_index.data(), num, *tx);
+  }
+}
+
+void ov_io_loop_t::run()
+{
+  set_thread_prio(prio);
+  struct epoll_event events[MAXEVENTS];
+  int timeout_ms(0);
+  while(running) {
+    int n(epoll_wait(epfd, events, MAXEVENTS, timeout_ms));
+    for(int k = 0; k < n; ++k) {
+      void* ptr(events[k].data.ptr);
+      ov_server_t* stage((ov_server_t*)ptr);
+      if(shared && (ptr == shared.get())) {
+        process_shared();
+      } else if(stage) {
+        stage->process_pending(*rx, *tx);
+      } else {
+        uint64_t v;
+        if(read(evfd, &v, sizeof(v)) < 0) {
+          // spurious wakeup
+        }
+      }
+    }
+    process_commands();
+    timeout_ms = timers.advance();
+  }
+}
+
+ov_stage_engine_t::ov_stage_engine_t(int prio, unsigned int num_threads,
+                                     port_t shared_port, int send_buffer)
+{
+  if(num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  if(!shared_port) {
+    for(unsigned int k = 0; k < num_threads; ++k)
+      loops.push_back(new ov_io_loop_t(prio));
+    return;
+  }
+  // the sockets of a reuseport group are indexed in bind order:
+  std::vector<ovbox_batch_socket_t*> sockets;
+  try {
+    for(unsigned int k = 0; k < num_threads; ++k) {
+      sockets.push_back(new ovbox_batch_socket_t(0));
+      sockets[k]->set_reuseport();
+      sockets[k]->bind(shared_port);
+      sockets[k]->set_send_buffer(send_buffer);
+      sockets[k]->set_recv_buffer(SHAREDRCVBUF);
+    }
+    if(num_threads > 1)
+      sockets[0]->steer_by_secret(num_threads);
+  }
+  catch(...) {
+    for(auto s : sockets)
+      delete s;
+    throw;
+  }
+  for(unsigned int k = 0; k < num_threads; ++k)
+    loops.push_back(new ov_io_loop_t(prio, k, num_threads, sockets[k]));
+}
+
+ov_stage_engine_t::~ov_stage_engine_t()
+{
+  for(auto loop : loops)
+    delete loop;
+}
+
+void ov_stage_engine_t::add_stage(ov_server_t* stage)
+{
+  std::lock_guard<std::mutex> lk(mtx);
+  if(stage_loop.find(stage->get_stage_id()) != stage_loop.end()) {
+    std::string msg("Stage " + stage->get_stage_id() + " is already hosted");
+    delete stage;
+    throw ErrMsg(msg);
+  }
+  // assign the stage to the least loaded event loop:
+  ov_io_loop_t* loop(loops[0]);
+  for(auto l : loops)
+    if(l->get_num_stages() < loop->get_num_stages())
+      loop = l;
+  stage_loop[stage->get_stage_id()] = loop;
+  stage_counters[stage->get_stage_id()] = stage->get_counters();
+  loop->post_add(stage);
+}
+
+bool ov_stage_engine_t::remove_stage(const std::string& stage_id)
+{
+  std::lock_guard<std::mutex> lk(mtx);
+  auto it(stage_loop.find(stage_id));
+  if(it == stage_loop.end())
+    return false;
+  it->second->post_remove(stage_id);
+  stage_loop.erase(it);
+  stage_counters.erase(stage_id);
+  return true;
+}
+
+size_t ov_stage_engine_t::get_num_stages()
+{
+  std::lock_guard<std::mutex> lk(mtx);
+  return stage_loop.size();
+}
+
+void ov_stage_engine_t::get_metrics(std::vector<stage_metrics_t>& metrics)
+{
+  std::lock_guard<std::mutex> lk(mtx);
+  metrics.resize(stage_counters.size());
+  size_t k(0);
+  for(auto& sc : stage_counters)
+    sc.second->snapshot(metrics[k++]);
+}
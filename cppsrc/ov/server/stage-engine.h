@@ -0,0 +1,127 @@
+#ifndef STAGE_ENGINE_H
+#define STAGE_ENGINE_H
+
+#include "ov-server.h"
+#include "pin-table.h"
+#include "timer-wheel.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * One event loop thread, owning the sockets and timers of many stages.
+ * All methods of the hosted stages are called from this thread only.
+ */
+class ov_io_loop_t {
+public:
+  /**
+   * @param shared Socket of this loop in shared port mode, or NULL. The
+   * datagrams are steered to loop index of num_loops by pin.
+   */
+  ov_io_loop_t(int prio, size_t index = 0, size_t num_loops = 1,
+               ovbox_batch_socket_t* shared = NULL);
+  ~ov_io_loop_t();
+  /**
+   * Take ownership of a stage created in hosted mode.
+   */
+  void post_add(ov_server_t* stage);
+  /**
+   * Remove and delete a stage. The stage is deleted asynchronously by
+   * the loop thread.
+   */
+  void post_remove(const std::string& stage_id);
+  size_t get_num_stages() const { return num_stages; };
+
+private:
+  struct command_t {
+    // stage to add, or NULL to remove stage_id:
+    ov_server_t* stage;
+    std::string stage_id;
+  };
+  struct hosted_stage_t {
+    std::unique_ptr<ov_server_t> server;
+    uint64_t ping_timer;
+    uint64_t announce_timer;
+    uint64_t route_timer;
+  };
+  void run();
+  void wakeup();
+  void process_commands();
+  void attach(ov_server_t* stage);
+  void detach(const std::string& stage_id);
+  void process_shared();
+  bool claim_pin(ov_server_t* stage, secret_t pin);
+  const int prio;
+  const size_t index;
+  const size_t num_loops;
+  int epfd;
+  int evfd;
+  std::atomic<bool> running;
+  std::atomic<size_t> num_stages;
+  std::mutex cmdmtx;
+  std::vector<command_t> commands;
+  std::map<std::string, hosted_stage_t> stages;
+  timer_wheel_t timers;
+  std::unique_ptr<rx_batch_t> rx;
+  std::unique_ptr<tx_batch_t> tx;
+  // shared port mode:
+  std::unique_ptr<ovbox_batch_socket_t> shared;
+  pin_table_t<ov_server_t> pins;
+  std::vector<ov_server_t*> batch_owner;
+  std::vector<ov_server_t*> batch_stage;
+  std::vector<size_t> batch_index;
+  std::thread thread;
+};
+
+/**
+ * Multi-stage engine: serves many stages with one epoll driven event
+ * loop per core, instead of a set of threads per stage.
+ *
+ * In shared port mode all stages are reached on one UDP port. Each loop
+ * binds a socket of a SO_REUSEPORT group, which the kernel steers by the
+ * low byte of the session secret; a loop only hands out pins which are
+ * steered to itself, so every datagram arrives at the loop of its stage
+ * and is passed on through an open addressing table of pins.
+ */
+class ov_stage_engine_t {
+public:
+  /**
+   * @param prio Thread priority of the event loops
+   * @param num_threads Number of event loops, zero for one per core
+   * @param shared_port If non-zero, all stages share this UDP port
+   * (stages have to be created with the same shared_port option)
+   * @param send_buffer Send buffer size of the shared sockets
+   */
+  ov_stage_engine_t(int prio, unsigned int num_threads = 0,
+                    port_t shared_port = 0, int send_buffer = 0);
+  ~ov_stage_engine_t();
+  /**
+   * Host a stage. The stage has to be created with the hosted option,
+   * the engine takes ownership.
+   */
+  void add_stage(ov_server_t* stage);
+  /**
+   * Stop serving a stage and release its socket.
+   * @return False if no stage with this id is hosted
+   */
+  bool remove_stage(const std::string& stage_id);
+  size_t get_num_stages();
+  /**
+   * Snapshot of the traffic counters of all hosted stages. Only reads
+   * atomics, the event loops are not interrupted.
+   */
+  void get_metrics(std::vector<stage_metrics_t>& metrics);
+
+private:
+  std::vector<ov_io_loop_t*> loops;
+  std::map<std::string, ov_io_loop_t*> stage_loop;
+  std::map<std::string, std::shared_ptr<const stage_counters_t>>
+      stage_counters;
+  std::mutex mtx;
+};
+
+#endif // STAGE_ENGINE_H
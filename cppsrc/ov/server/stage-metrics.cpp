@@ -0,0 +1,85 @@
+#include "stage-metrics.h"
+#include <algorithm>
+#include <math.h>
+
+void stream_stats_t::restart(uint16_t seq, int64_t arrival_ns)
+{
+  started = true;
+  max_seq = seq;
+  window = 1;
+  last_arrival_ns = arrival_ns;
+  expected.add(1);
+  received.add(1);
+}
+
+void stream_stats_t::arrival(int16_t delta, int64_t arrival_ns)
+{
+  double d(arrival_ns - last_arrival_ns);
+  last_arrival_ns = arrival_ns;
+  // the period follows consecutive packets only, slower than the jitter:
+  if(delta == 1)
+    period_ns = (period_ns > 0) ? (period_ns + (d - period_ns) / 256) : d;
+  jitter_ns += (fabs(d - delta * period_ns) - jitter_ns) / 16;
+  jitter.store((uint64_t)jitter_ns, std::memory_order_relaxed);
+}
+
+stage_counters_t::stage_counters_t(const std::string& stage_id, int portno,
+                                   size_t workers)
+    : stage_id(stage_id), portno(portno), latfifo_depth(0), mixfifo_depth(0)
+{
+  for(size_t k = 0; k < workers; ++k)
+    relays.emplace_back(new relay_counters_t());
+}
+
+void stage_counters_t::snapshot(stage_metrics_t& m) const
+{
+  m.stage_id = stage_id;
+  m.portno = portno;
+  m.packets_in = m.bytes_in = m.packets_out = m.bytes_out = 0;
+  m.seq_errors = m.lost = m.invalid = m.send_errors = m.mix_dropped = 0;
+  m.queue_dropped = m.trunk_in = m.trunk_out = 0;
+  m.latreports_dropped = latreports_dropped.get();
+  m.latfifo_depth = latfifo_depth.load(std::memory_order_relaxed);
+  m.mixfifo_depth = mixfifo_depth.load(std::memory_order_relaxed);
+  m.sched = sched_probe_t::get_stats();
+  m.endpoints.clear();
+  for(auto& r : relays) {
+    m.invalid += r->invalid.get();
+    m.send_errors += r->send_errors.get();
+    m.mix_dropped += r->mix_dropped.get();
+    m.queue_dropped += r->queue_dropped.get();
+    m.trunk_in += r->trunk_in.get();
+    m.trunk_out += r->trunk_out.get();
+  }
+  for(stage_device_id_t cid = 0; cid != MAXEP; ++cid) {
+    endpoint_metrics_t e = {cid, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    for(auto& r : relays) {
+      const endpoint_counters_t& c(r->ep[cid]);
+      e.packets_in += c.packets_in.get();
+      e.bytes_in += c.bytes_in.get();
+      e.packets_out += c.packets_out.get();
+      e.bytes_out += c.bytes_out.get();
+      e.seq_errors += c.seq_errors.get();
+      // a packet counted meanwhile must not show up as lost:
+      uint64_t expected(c.stream.expected.get());
+      uint64_t received(c.stream.received.get());
+      if(expected > received)
+        e.lost += expected - received;
+      e.reordered += c.stream.reordered.get();
+      e.duplicates += c.stream.duplicates.get();
+      e.gaps += c.stream.gaps.get();
+      e.jitter_ms = std::max(
+          e.jitter_ms,
+          1e-6 * c.stream.jitter.load(std::memory_order_relaxed));
+    }
+    if(!(e.packets_in || e.packets_out || e.seq_errors))
+      continue;
+    m.packets_in += e.packets_in;
+    m.bytes_in += e.bytes_in;
+    m.packets_out += e.packets_out;
+    m.bytes_out += e.bytes_out;
+    m.seq_errors += e.seq_errors;
+    m.lost += e.lost;
+    m.endpoints.push_back(e);
+  }
+}
@@ -0,0 +1,226 @@
+#ifndef STAGE_METRICS_H
+#define STAGE_METRICS_H
+
+#include "common.h"
+#include "sched-probe.h"
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// sequence numbers behind the highest one which are told apart as
+// reordered or duplicate:
+#define SEQWINDOW 64
+// a jump by more sequence numbers restarts the stream (sender restart):
+#define SEQMAXDROPOUT 3000
+
+/**
+ * Monotonic counter with a single writer thread. An increment is a
+ * relaxed load and store without a locked instruction, any thread may
+ * read the counter.
+ */
+class counter_t {
+public:
+  counter_t() : v(0){};
+  void add(uint64_t n)
+  {
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  };
+  uint64_t get() const { return v.load(std::memory_order_relaxed); };
+
+private:
+  std::atomic<uint64_t> v;
+};
+
+/**
+ * Sequence statistics of the audio stream of one sender, as seen by the
+ * relay (RFC 3550 A.1 and A.8): loss is the number of expected minus
+ * received sequence numbers, so it covers the path from the sender to
+ * the relay only, while PORT_SEQREP reports of the receivers cover the
+ * whole path. A bit mask of the last SEQWINDOW sequence numbers tells
+ * late packets from duplicates.
+ *
+ * The header carries no media timestamp, so the jitter is the smoothed
+ * deviation of the inter-arrival time from the packet period, which is
+ * estimated from the arrivals of consecutive packets. The arrival time
+ * is taken once per wakeup of the relay thread, not per datagram: all
+ * datagrams of one receive batch share it, so the jitter includes the
+ * batching delay of the relay, which grows with the load.
+ *
+ * Updated by the relay thread of the sender without locked instructions,
+ * the results can be read by any thread. reset() may be called by any
+ * thread, the relay thread restarts the stream with its next packet.
+ */
+class stream_stats_t {
+public:
+  stream_stats_t()
+      : jitter(0), generation(0), started(false), max_seq(0), window(0),
+        last_arrival_ns(0), period_ns(0), jitter_ns(0), seen_generation(0){};
+  /**
+   * Start a new session of the sender: the sequence and the packet
+   * period of the previous session are forgotten, the counters are kept.
+   */
+  void reset() { generation.fetch_add(1, std::memory_order_relaxed); };
+  void update(sequence_t s, int64_t arrival_ns)
+  {
+    uint32_t g(generation.load(std::memory_order_relaxed));
+    if(g != seen_generation) {
+      seen_generation = g;
+      started = false;
+      period_ns = jitter_ns = 0;
+    }
+    uint16_t seq(s);
+    int16_t delta((int16_t)(uint16_t)(seq - max_seq));
+    if(!started || (delta > SEQMAXDROPOUT) || (delta < -SEQMAXDROPOUT)) {
+      restart(seq, arrival_ns);
+      return;
+    }
+    if(delta > 0) {
+      if(delta > 1)
+        gaps.add(1);
+      expected.add(delta);
+      received.add(1);
+      window = (delta < SEQWINDOW) ? ((window << delta) | 1) : 1;
+      max_seq = seq;
+      arrival(delta, arrival_ns);
+      return;
+    }
+    if(-delta >= SEQWINDOW) {
+      // too late to tell, counted as received:
+      reordered.add(1);
+      received.add(1);
+      return;
+    }
+    uint64_t bit((uint64_t)1 << -delta);
+    if(window & bit) {
+      duplicates.add(1);
+    } else {
+      window |= bit;
+      reordered.add(1);
+      received.add(1);
+    }
+  };
+  // sequence numbers from the first to the highest received:
+  counter_t expected;
+  // unique packets:
+  counter_t received;
+  // packets which arrived after a higher sequence number:
+  counter_t reordered;
+  counter_t duplicates;
+  // jumps in the sequence, i.e., loss events before any reordering:
+  counter_t gaps;
+  // interarrival jitter, in nanoseconds:
+  std::atomic<uint64_t> jitter;
+
+private:
+  std::atomic<uint32_t> generation;
+  void restart(uint16_t seq, int64_t arrival_ns);
+  void arrival(int16_t delta, int64_t arrival_ns);
+  bool started;
+  uint16_t max_seq;
+  uint64_t window;
+  int64_t last_arrival_ns;
+  double period_ns;
+  double jitter_ns;
+  uint32_t seen_generation;
+};
+
+struct endpoint_counters_t {
+  // datagrams relayed from this endpoint:
+  counter_t packets_in;
+  counter_t bytes_in;
+  // datagrams relayed to this endpoint:
+  counter_t packets_out;
+  counter_t bytes_out;
+  // sequence errors in the stream of this endpoint (PORT_SEQREP):
+  counter_t seq_errors;
+  // audio stream of this endpoint, as received by the relay:
+  stream_stats_t stream;
+};
+
+/**
+ * Counters written by one relay thread.
+ */
+class relay_counters_t {
+public:
+  endpoint_counters_t ep[MAXEP];
+  // datagrams which failed authentication or had no valid sender:
+  counter_t invalid;
+  counter_t send_errors;
+  // audio datagrams dropped because the mixer queue was full:
+  counter_t mix_dropped;
+  // datagrams dropped from full receiver backlogs (drop oldest):
+  counter_t queue_dropped;
+  // audio datagrams received from and sent to trunks (see trunk_table_t):
+  counter_t trunk_in;
+  counter_t trunk_out;
+};
+
+struct endpoint_metrics_t {
+  stage_device_id_t cid;
+  uint64_t packets_in;
+  uint64_t bytes_in;
+  uint64_t packets_out;
+  uint64_t bytes_out;
+  uint64_t seq_errors;
+  // loss, reordering and jitter between the endpoint and the relay:
+  uint64_t lost;
+  uint64_t reordered;
+  uint64_t duplicates;
+  uint64_t gaps;
+  double jitter_ms;
+};
+
+/**
+ * Snapshot of the counters of one stage, summed over all relay threads.
+ */
+struct stage_metrics_t {
+  std::string stage_id;
+  int portno;
+  uint64_t packets_in;
+  uint64_t bytes_in;
+  uint64_t packets_out;
+  uint64_t bytes_out;
+  uint64_t seq_errors;
+  // packets of all senders lost before they reached the relay:
+  uint64_t lost;
+  uint64_t invalid;
+  uint64_t send_errors;
+  uint64_t mix_dropped;
+  uint64_t queue_dropped;
+  uint64_t trunk_in;
+  uint64_t trunk_out;
+  uint64_t latreports_dropped;
+  // queue depths, sampled once per ping period:
+  uint64_t latfifo_depth;
+  uint64_t mixfifo_depth;
+  // scheduling latency of the process over the last PROBEWINDOWS
+  // seconds, polling at least this often covers every wakeup:
+  sched_stats_t sched;
+  // endpoints with any traffic:
+  std::vector<endpoint_metrics_t> endpoints;
+};
+
+/**
+ * Counters of one stage. The object is shared, so that a metrics reader
+ * can keep it after the stage was deleted, and snapshot() only reads
+ * atomics: polling never blocks the relay threads.
+ */
+class stage_counters_t {
+public:
+  stage_counters_t(const std::string& stage_id, int portno, size_t workers);
+  relay_counters_t& relay(size_t worker) { return *relays[worker]; };
+  void snapshot(stage_metrics_t& m) const;
+  const std::string stage_id;
+  const int portno;
+  // written by the announce service:
+  counter_t latreports_dropped;
+  std::atomic<uint64_t> latfifo_depth;
+  std::atomic<uint64_t> mixfifo_depth;
+
+private:
+  std::vector<std::unique_ptr<relay_counters_t>> relays;
+};
+
+#endif // STAGE_METRICS_H
@@ -0,0 +1,60 @@
+#include "timer-wheel.h"
+
+timer_wheel_t::timer_wheel_t()
+    : start(std::chrono::steady_clock::now()), current(0), nextid(1)
+{
+}
+
+uint64_t timer_wheel_t::add(uint32_t period_ms, uint32_t offset_ms,
+                            callback_t cb)
+{
+  uint64_t id(nextid++);
+  entry_t& e(timers[id]);
+  e.period = std::max(1u, period_ms / TIMERWHEELTICKMS);
+  e.cb = cb;
+  schedule(id, current + offset_ms / TIMERWHEELTICKMS);
+  return id;
+}
+
+void timer_wheel_t::remove(uint64_t id)
+{
+  // stale ids in the slots are skipped when the slot expires:
+  timers.erase(id);
+}
+
+void timer_wheel_t::schedule(uint64_t id, uint64_t expires)
+{
+  timers[id].expires = expires;
+  slots[expires % TIMERWHEELSLOTS].push_back(id);
+}
+
+int timer_wheel_t::advance()
+{
+  std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+  double elapsed_ms(
+      std::chrono::duration<double, std::milli>(now - start).count());
+  uint64_t now_tick(elapsed_ms / TIMERWHEELTICKMS);
+  for(; current <= now_tick; ++current) {
+    std::vector<uint64_t>& slot(slots[current % TIMERWHEELSLOTS]);
+    if(slot.empty())
+      continue;
+    due.clear();
+    due.swap(slot);
+    for(auto id : due) {
+      auto it(timers.find(id));
+      if(it == timers.end())
+        continue;
+      if(it->second.expires > current) {
+        // expires in one of the next rounds:
+        slot.push_back(id);
+        continue;
+      }
+      it->second.cb();
+      // the callback may have removed this timer:
+      it = timers.find(id);
+      if(it != timers.end())
+        schedule(id, current + it->second.period);
+    }
+  }
+  return std::max(0.0, current * TIMERWHEELTICKMS - elapsed_ms) + 1;
+}
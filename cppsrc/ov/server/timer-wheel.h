@@ -0,0 +1,54 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <chrono>
+#include <functional>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+// resolution of the timer wheel, in milliseconds:
+#define TIMERWHEELTICKMS 5
+// number of slots, one round covers TIMERWHEELSLOTS * TIMERWHEELTICKMS:
+#define TIMERWHEELSLOTS 512
+
+/**
+ * Hashed timer wheel for periodic timers. The wheel is not thread safe,
+ * all methods are called from the event loop thread which owns it.
+ */
+class timer_wheel_t {
+public:
+  typedef std::function<void()> callback_t;
+  timer_wheel_t();
+  /**
+   * Add a periodic timer.
+   * @param period_ms Period in milliseconds
+   * @param offset_ms Delay of the first expiry in milliseconds
+   * @param cb Callback, may add or remove timers
+   * @return Timer id, to be used with remove()
+   */
+  uint64_t add(uint32_t period_ms, uint32_t offset_ms, callback_t cb);
+  void remove(uint64_t id);
+  /**
+   * Run all timers which expired until now.
+   * @return Time until the next tick, in milliseconds
+   */
+  int advance();
+
+private:
+  struct entry_t {
+    uint64_t expires;
+    uint64_t period;
+    callback_t cb;
+  };
+  void schedule(uint64_t id, uint64_t expires);
+  std::chrono::steady_clock::time_point start;
+  // next tick to be processed:
+  uint64_t current;
+  uint64_t nextid;
+  std::unordered_map<uint64_t, entry_t> timers;
+  std::vector<uint64_t> slots[TIMERWHEELSLOTS];
+  std::vector<uint64_t> due;
+};
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,146 @@
+#include "trunk.h"
+#include "errmsg.h"
+#include <chrono>
+#include <netdb.h>
+#include <stdlib.h>
+
+static int64_t now_ms()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+trunk_table_t::trunk_table_t(secret_t key) : key(key), num_peers(0)
+{
+  // pins are drawn below 0x10000000, so that a trunk list never passes
+  // as audio of a stage:
+  if(key <= 0xfffffff)
+    throw ErrMsg("The trunk key has to be larger than 0xfffffff");
+  for(auto& p : peers)
+    p.remote.resize(MAXEP);
+  memset(live, 0, sizeof(live));
+  memset(mode, 0, sizeof(mode));
+}
+
+void trunk_table_t::add_peer(const std::string& address)
+{
+  size_t colon(address.rfind(':'));
+  if((colon == std::string::npos) || (colon == 0))
+    throw ErrMsg("Invalid trunk address " + address);
+  std::string host(address.substr(0, colon));
+  std::string port(address.substr(colon + 1));
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  struct addrinfo* res(NULL);
+  if(getaddrinfo(host.c_str(), port.c_str(), &hints, &res) || !res)
+    throw ErrMsg("Unable to resolve trunk address " + address);
+  endpoint_t ep;
+  memcpy(&ep, res->ai_addr, sizeof(ep));
+  freeaddrinfo(res);
+  std::lock_guard<std::mutex> lk(mtx);
+  if(add(ep) < 0)
+    throw ErrMsg("Too many trunks");
+}
+
+int trunk_table_t::add(const endpoint_t& ep)
+{
+  int k(find(ep));
+  if(k >= 0)
+    return k;
+  size_t n(num_peers.load(std::memory_order_relaxed));
+  if(n == MAXTRUNKS)
+    return -1;
+  peers[n].ep = ep;
+  // the relay threads see the address with the new size:
+  num_peers.store(n + 1, std::memory_order_release);
+  return n;
+}
+
+bool trunk_table_t::receive(const endpoint_t& from, const char* msg,
+                            size_t len)
+{
+  uint32_t pin;
+  uint8_t flags;
+  int k(find(from));
+  if((k < 0) || (len < sizeof(pin)))
+    return false;
+  memcpy(&pin, msg, sizeof(pin));
+  std::lock_guard<std::mutex> lk(mtx);
+  if(!participant_list_t::decode(msg + sizeof(pin), len - sizeof(pin), flags,
+                                 records))
+    return false;
+  peer_t& p(peers[k]);
+  p.pin.store(pin, std::memory_order_relaxed);
+  int64_t expires(now_ms() + TRUNKTIMEOUTMS);
+  for(auto& r : records) {
+    remote_t& rem(p.remote[r.cid]);
+    if(r.flags & PREC_REMOVED) {
+      rem.expires_ms = 0;
+      continue;
+    }
+    // remote participants can not be reached peer-to-peer:
+    rem.mode = r.mode & ~B_PEER2PEER;
+    rem.ep = r.ep;
+    rem.localep = r.localep;
+    rem.expires_ms = expires;
+  }
+  return true;
+}
+
+void trunk_table_t::encode(secret_t pin,
+                           const std::vector<ep_desc_t>& endpoints,
+                           std::vector<std::vector<char>>& msgs)
+{
+  local.update(endpoints);
+  local.encode_trunk(key, pin, msgs);
+}
+
+bool trunk_table_t::merge(std::vector<ep_desc_t>& endpoints)
+{
+  int64_t now(now_ms());
+  bool changed(false);
+  std::lock_guard<std::mutex> lk(mtx);
+  size_t n(size());
+  bool forward[MAXTRUNKS] = {false};
+  for(stage_device_id_t cid = 0; cid != MAXEP; ++cid) {
+    ep_desc_t& ep(endpoints[cid]);
+    bool is_live(false);
+    epmode_t m(0);
+    // a local participant wins, e.g., while it moves between relays:
+    if(ep.timeout <= 0) {
+      for(size_t k = 0; k < n; ++k) {
+        const remote_t& rem(peers[k].remote[cid]);
+        if(rem.expires_ms <= now)
+          continue;
+        if(!(rem.mode & B_DONOTSEND))
+          forward[k] = true;
+        if(is_live)
+          continue;
+        is_live = true;
+        m = rem.mode;
+        ep.mode = rem.mode;
+        ep.ep = rem.ep;
+        ep.localep = rem.localep;
+        ep.timeout = 1;
+      }
+    }
+    if((is_live != live[cid]) || (is_live && (m != mode[cid])))
+      changed = true;
+    live[cid] = is_live;
+    mode[cid] = m;
+  }
+  for(size_t k = 0; k < n; ++k)
+    peers[k].forward.store(forward[k], std::memory_order_relaxed);
+  return changed;
+}
+
+void trunk_table_t::apply(endpoint_state_t& state)
+{
+  std::lock_guard<std::mutex> lk(mtx);
+  for(stage_device_id_t cid = 0; cid != MAXEP; ++cid)
+    if(live[cid] && !state.active(cid))
+      state.mode[cid] = mode[cid];
+}
@@ -0,0 +1,143 @@
+#ifndef TRUNK_H
+#define TRUNK_H
+
+#include "participant-list.h"
+#include "route-table.h"
+#include <atomic>
+#include <mutex>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// maximum number of trunks of a stage:
+#define MAXTRUNKS 8
+// remote participants expire if their trunk list is not refreshed within
+// this time, in milliseconds (the lists are sent once per ping period):
+#define TRUNKTIMEOUTMS (5 * PINGPERIODMS)
+// receiver key of the trunks in the send queues of the relay threads:
+#define TRUNK_CALLERID SERVER_CALLERID
+// capacity of the trunk list queue of each relay thread:
+#define TRUNKFIFOSIZE 32
+
+/**
+ * Trunk list datagram, passed from a relay thread to the service
+ * thread.
+ */
+struct trunk_msg_t {
+  endpoint_t from;
+  size_t len;
+  char data[BUFSIZE];
+};
+
+/**
+ * Trunks of a stage to relays in other regions which serve the same
+ * stage. Each relay sends the audio of its own participants once per
+ * trunk, instead of once per remote receiver, and fans it out to its own
+ * participants only.
+ *
+ * Once per ping period each relay sends the list of its own
+ * participants to all trunks (ROUTEREXT_TRUNK, marked by the trunk key,
+ * which is never a valid pin). The list carries the current pin of the
+ * stage, which the peer then uses to send audio. Lists are only taken
+ * from configured trunks, so both sides have to add each other: the key
+ * travels in the clear and must not be enough to join a stage.
+ *
+ * Loops are prevented by split horizon: audio received from a trunk is
+ * never sent to a trunk, and learned participants are not announced to
+ * other trunks. All relays of a stage have to be connected to each
+ * other.
+ */
+class trunk_table_t {
+public:
+  /**
+   * @param key Trunk key, has to be larger than any pin (0xfffffff).
+   * Throws ErrMsg if the key is not valid.
+   */
+  trunk_table_t(secret_t key);
+  /**
+   * Add a trunk to another relay, "host:port". Throws ErrMsg if the
+   * address can not be resolved or all trunks are used.
+   */
+  void add_peer(const std::string& address);
+  secret_t get_key() const { return key; };
+  size_t size() const { return num_peers.load(std::memory_order_acquire); };
+  /**
+   * @return Index of the trunk with this address, or -1
+   */
+  int find(const endpoint_t& from) const
+  {
+    size_t n(size());
+    for(size_t k = 0; k < n; ++k)
+      if((peers[k].ep.sin_addr.s_addr == from.sin_addr.s_addr) &&
+         (peers[k].ep.sin_port == from.sin_port))
+        return k;
+    return -1;
+  };
+  const endpoint_t& peer(size_t k) const { return peers[k].ep; };
+  /**
+   * Pin of the stage at the other end, zero until its list arrived.
+   */
+  secret_t peer_pin(size_t k) const
+  {
+    return peers[k].pin.load(std::memory_order_relaxed);
+  };
+  /**
+   * Are there receivers behind the trunk?
+   */
+  bool forward(size_t k) const
+  {
+    return peers[k].forward.load(std::memory_order_relaxed);
+  };
+  /**
+   * Take the trunk list of another relay, called by the service thread
+   * with the lists the relay threads queued.
+   * @return False if the sender is not a trunk or the list is invalid
+   */
+  bool receive(const endpoint_t& from, const char* msg, size_t len);
+  /**
+   * Encode the trunk list from the local endpoints, all trunks receive
+   * the same list.
+   */
+  void encode(secret_t pin, const std::vector<ep_desc_t>& endpoints,
+              std::vector<std::vector<char>>& msgs);
+  /**
+   * Add the remote participants to a copy of the endpoint list, unless
+   * the caller id is used locally, and update the forward flags of the
+   * trunks. Called once per ping period.
+   * @return True if the remote participants changed since the last call
+   */
+  bool merge(std::vector<ep_desc_t>& endpoints);
+  /**
+   * Set the modes of the remote senders in the routing state.
+   */
+  void apply(endpoint_state_t& state);
+
+private:
+  struct remote_t {
+    epmode_t mode;
+    endpoint_t ep;
+    endpoint_t localep;
+    // zero if the record is not used:
+    int64_t expires_ms;
+  };
+  struct peer_t {
+    peer_t() : pin(0), forward(false) { memset(&ep, 0, sizeof(ep)); };
+    endpoint_t ep;
+    std::atomic<secret_t> pin;
+    std::atomic<bool> forward;
+    std::vector<remote_t> remote;
+  };
+  int add(const endpoint_t& ep);
+  const secret_t key;
+  peer_t peers[MAXTRUNKS];
+  std::atomic<size_t> num_peers;
+  // protects the remote participants and adding trunks:
+  std::mutex mtx;
+  // remote participants of the last merge, by caller id:
+  bool live[MAXEP];
+  epmode_t mode[MAXEP];
+  std::vector<participant_record_t> records;
+  participant_list_t local;
+};
+
+#endif // TRUNK_H
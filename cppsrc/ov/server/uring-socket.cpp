@@ -0,0 +1,393 @@
+#include "uring-socket.h"
+#include "errmsg.h"
+#include "send-queue.h"
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(HAS_URING_SOCKET)
+
+// user data of the multishot receive, sends carry their slot index:
+#define URINGRECV (~(uint64_t)0)
+// user data of the cancellation of the receive:
+#define URINGCANCEL (URINGRECV - 1)
+
+static int uring_setup(unsigned int entries, struct io_uring_params* p)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int submit, unsigned int wait,
+                       unsigned int flags, const void* arg, size_t argsz)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg,
+                      argsz);
+}
+
+static int uring_register(int fd, unsigned int op, void* arg,
+                          unsigned int num)
+{
+  return (int)syscall(__NR_io_uring_register, fd, op, arg, num);
+}
+
+uring_socket_t::uring_socket_t(ovbox_batch_socket_t& socket)
+    : socket(socket), ringfd(-1), rings(NULL), rings_size(0), sqes(NULL),
+      sqes_size(0), br(NULL), br_size(0), buffers(NULL),
+      buffer_size(sizeof(struct io_uring_recvmsg_out) + sizeof(endpoint_t) +
+                  BUFSIZE),
+      br_tail(0), recv_armed(false), recv_error(0), rx(URINGBUFFERS),
+      rx_count(0), used(URINGBUFFERS), num_used(0), slots(URINGENTRIES),
+      num_slots(0), chain(TXBATCHSIZE), inflight(0), backlog(NULL),
+      send_errors(0)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+  ringfd = uring_setup(URINGENTRIES, &p);
+  if((ringfd < 0) && (errno == EINVAL)) {
+    // kernels before 5.19 do not know these flags:
+    memset(&p, 0, sizeof(p));
+    ringfd = uring_setup(URINGENTRIES, &p);
+  }
+  if(ringfd < 0)
+    throw ErrMsg("Unable to create io_uring", errno);
+  try {
+    if(!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+       !(p.features & IORING_FEAT_EXT_ARG))
+      throw ErrMsg("io_uring of this kernel is too old");
+    rings_size =
+        std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned int),
+                 p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+    rings = mmap(NULL, rings_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+    if(rings == MAP_FAILED) {
+      rings = NULL;
+      throw ErrMsg("Unable to map io_uring", errno);
+    }
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* s(mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES));
+    if(s == MAP_FAILED)
+      throw ErrMsg("Unable to map io_uring", errno);
+    sqes = (struct io_uring_sqe*)s;
+    char* r((char*)rings);
+    sq_head = (unsigned int*)(r + p.sq_off.head);
+    sq_tail = (unsigned int*)(r + p.sq_off.tail);
+    sq_mask = *(unsigned int*)(r + p.sq_off.ring_mask);
+    sq_entries = p.sq_entries;
+    unsigned int* sq_array((unsigned int*)(r + p.sq_off.array));
+    for(unsigned int k = 0; k < p.sq_entries; ++k)
+      sq_array[k] = k;
+    cq_head = (unsigned int*)(r + p.cq_off.head);
+    cq_tail = (unsigned int*)(r + p.cq_off.tail);
+    cq_mask = *(unsigned int*)(r + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(r + p.cq_off.cqes);
+    // the buffer ring has to be page aligned:
+    br_size = URINGBUFFERS * sizeof(struct io_uring_buf);
+    void* b(mmap(NULL, br_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if(b == MAP_FAILED)
+      throw ErrMsg("Unable to allocate the io_uring buffer ring", errno);
+    // the entries are addressed directly: in C++ the flexible array of
+    // struct io_uring_buf_ring does not start at offset zero
+    br = (struct io_uring_buf*)b;
+    memset(br, 0, br_size);
+    buffers = new char[URINGBUFFERS * buffer_size];
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)br;
+    reg.ring_entries = URINGBUFFERS;
+    reg.bgid = URINGBGID;
+    if(uring_register(ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+      throw ErrMsg("Unable to register the io_uring receive buffers", errno);
+    for(uint16_t bid = 0; bid < URINGBUFFERS; ++bid)
+      provide(bid);
+    publish();
+    memset(&recv_hdr, 0, sizeof(recv_hdr));
+    recv_hdr.msg_namelen = sizeof(endpoint_t);
+    arm_recv();
+  }
+  catch(...) {
+    release();
+    throw;
+  }
+}
+
+uring_socket_t::~uring_socket_t()
+{
+  cancel_recv();
+  release();
+}
+
+void uring_socket_t::release()
+{
+  // closing the ring also unregisters the buffer ring:
+  if(ringfd >= 0)
+    close(ringfd);
+  if(sqes)
+    munmap(sqes, sqes_size);
+  if(rings)
+    munmap(rings, rings_size);
+  if(br)
+    munmap(br, br_size);
+  delete[] buffers;
+}
+
+struct io_uring_sqe* uring_socket_t::next_sqe()
+{
+  // submit early if the queue is full:
+  if(pending() == sq_entries)
+    enter(0);
+  struct io_uring_sqe* sqe(&sqes[*sq_tail & sq_mask]);
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+void uring_socket_t::push_sqe()
+{
+  __atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+unsigned int uring_socket_t::pending() const
+{
+  return *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+}
+
+int uring_socket_t::enter(unsigned int wait)
+{
+  struct __kernel_timespec ts;
+  ts.tv_sec = 0;
+  ts.tv_nsec = URINGTIMEOUTMS * 1000000ll;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.ts = (uint64_t)&ts;
+  unsigned int flags(IORING_ENTER_EXT_ARG);
+  if(wait)
+    flags |= IORING_ENTER_GETEVENTS;
+  return uring_enter(ringfd, pending(), wait, flags, &arg, sizeof(arg));
+}
+
+void uring_socket_t::provide(uint16_t bid)
+{
+  // the tail shares the first entry, only the other fields are written:
+  struct io_uring_buf& b(br[br_tail & (URINGBUFFERS - 1)]);
+  b.addr = (uint64_t)(buffers + bid * buffer_size);
+  b.len = buffer_size;
+  b.bid = bid;
+  ++br_tail;
+}
+
+void uring_socket_t::publish()
+{
+  // the tail overlays the reserved field of the first entry:
+  __atomic_store_n(&br[0].resv, br_tail, __ATOMIC_RELEASE);
+}
+
+void uring_socket_t::arm_recv()
+{
+  struct io_uring_sqe* sqe(next_sqe());
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = socket.get_fd();
+  sqe->addr = (uint64_t)&recv_hdr;
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URINGBGID;
+  sqe->user_data = URINGRECV;
+  push_sqe();
+  recv_armed = true;
+}
+
+void uring_socket_t::cancel_recv()
+{
+  if(!recv_armed)
+    return;
+  struct io_uring_sqe* sqe(next_sqe());
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = URINGRECV;
+  sqe->user_data = URINGCANCEL;
+  push_sqe();
+  // the kernel must not write to the buffers after they are freed:
+  for(int k = 0; (k < 10) && recv_armed; ++k) {
+    enter(1);
+    rx_count = 0;
+    num_used = 0;
+    reap();
+  }
+}
+
+size_t uring_socket_t::wait()
+{
+  rx_count = 0;
+  size_t previous(num_used);
+  // submit the fan-out of the previous wakeup, sends complete inline:
+  if(enter(inflight + 1) < 0) {
+    if((errno != ETIME) && (errno != EINTR) && (errno != EBUSY))
+      throw ErrMsg("io_uring_enter failed", errno);
+  }
+  reap();
+  for(int k = 0; inflight && (k < 10); ++k) {
+    enter(inflight);
+    reap();
+  }
+  if(recv_error == -EINVAL)
+    throw ErrMsg("Multishot receive is not supported", EINVAL);
+  if(!inflight) {
+    requeue_failed();
+    // the datagrams of the previous wakeup are sent, their buffers can
+    // be received into again:
+    for(size_t k = 0; k < previous; ++k)
+      provide(used[k]);
+    publish();
+    std::copy(used.begin() + previous, used.begin() + num_used, used.begin());
+    num_used -= previous;
+    num_slots = 0;
+  }
+  // the receive stops when it runs out of buffers:
+  if(!recv_armed)
+    arm_recv();
+  return rx_count;
+}
+
+void uring_socket_t::reap()
+{
+  unsigned int head(*cq_head);
+  unsigned int tail(__atomic_load_n(cq_tail, __ATOMIC_ACQUIRE));
+  for(; head != tail; ++head) {
+    const struct io_uring_cqe& cqe(cqes[head & cq_mask]);
+    if(cqe.user_data == URINGRECV)
+      complete_recv(cqe);
+    else if(cqe.user_data != URINGCANCEL)
+      complete_send(cqe);
+  }
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+void uring_socket_t::complete_recv(const struct io_uring_cqe& cqe)
+{
+  if(!(cqe.flags & IORING_CQE_F_MORE))
+    recv_armed = false;
+  if(cqe.res < 0) {
+    // ENOBUFS just means that all buffers are in use:
+    recv_error = cqe.res;
+    return;
+  }
+  if(!(cqe.flags & IORING_CQE_F_BUFFER))
+    return;
+  uint16_t bid(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+  used[num_used++] = bid;
+  char* b(buffers + bid * buffer_size);
+  const struct io_uring_recvmsg_out* out((struct io_uring_recvmsg_out*)b);
+  // the name and control areas have the size given in the header:
+  if((out->flags & MSG_TRUNC) || (out->namelen > sizeof(endpoint_t)))
+    return;
+  rx_t& r(rx[rx_count++]);
+  r.from = (const endpoint_t*)(b + sizeof(*out));
+  r.buf = b + sizeof(*out) + recv_hdr.msg_namelen + recv_hdr.msg_controllen;
+  r.len = out->payloadlen;
+}
+
+void uring_socket_t::complete_send(const struct io_uring_cqe& cqe)
+{
+  --inflight;
+  slots[cqe.user_data].res = cqe.res;
+}
+
+// the completions of different receivers come in any order, the failed
+// datagrams are taken in the order of the slots once all are complete
+void uring_socket_t::requeue_failed()
+{
+  // a datagram which was overtaken by a later one of the same receiver
+  // (sent with the next wakeup) is dropped instead:
+  bool overtaken[MAXEP + 1];
+  memset(overtaken, 0, sizeof(overtaken));
+  for(size_t k = num_slots; k-- > 0;) {
+    send_slot_t& s(slots[k]);
+    if(s.res >= 0) {
+      overtaken[s.cid] = true;
+    } else if(((s.res != -EAGAIN) && (s.res != -ENOBUFS) &&
+               (s.res != -ECANCELED)) ||
+              !backlog || overtaken[s.cid]) {
+      ++send_errors;
+      s.res = 0;
+    }
+  }
+  for(size_t k = 0; k < num_slots; ++k) {
+    const send_slot_t& s(slots[k]);
+    if(s.res < 0)
+      backlog->push(s.cid, s.to, (const char*)s.iov.iov_base, s.iov.iov_len);
+  }
+}
+
+size_t uring_socket_t::send(tx_batch_t& batch)
+{
+  size_t failed(0);
+  backlog = batch.backlog;
+  // group the datagrams by receiver, in their order:
+  size_t first[MAXEP + 1];
+  size_t last[MAXEP + 1];
+  size_t length[MAXEP + 1];
+  memset(length, 0, sizeof(length));
+  for(size_t k = 0; k < batch.count; ++k) {
+    stage_device_id_t cid(batch.cid[k]);
+    if(length[cid])
+      chain[last[cid]] = k;
+    else
+      first[cid] = k;
+    last[cid] = k;
+    ++length[cid];
+  }
+  for(size_t cid = 0; cid <= MAXEP; ++cid) {
+    if(!length[cid])
+      continue;
+    if(num_slots + length[cid] > slots.size()) {
+      // more datagrams than slots until the next wakeup, dropped with
+      // all later ones of the receiver to keep the order:
+      failed += length[cid];
+      continue;
+    }
+    // a chain must not be split by an early submit:
+    if(sq_entries - pending() < length[cid])
+      enter(0);
+    size_t k(first[cid]);
+    for(size_t n = 0; n < length[cid]; ++n, k = chain[k]) {
+      send_slot_t& s(slots[num_slots]);
+      s.to = batch.to[k];
+      s.cid = batch.cid[k];
+      s.iov = batch.iov[k];
+      s.res = 0;
+      memset(&s.hdr, 0, sizeof(s.hdr));
+      s.hdr.msg_name = &s.to;
+      s.hdr.msg_namelen = sizeof(endpoint_t);
+      s.hdr.msg_iov = &s.iov;
+      s.hdr.msg_iovlen = 1;
+      struct io_uring_sqe* sqe(next_sqe());
+      sqe->opcode = IORING_OP_SENDMSG;
+      sqe->fd = socket.get_fd();
+      sqe->addr = (uint64_t)&s.hdr;
+      sqe->len = 1;
+      sqe->msg_flags = MSG_DONTWAIT;
+      // the rest of the chain is cancelled if this one would block:
+      if(n + 1 < length[cid])
+        sqe->flags = IOSQE_IO_LINK;
+      sqe->user_data = num_slots;
+      push_sqe();
+      ++num_slots;
+      ++inflight;
+    }
+  }
+  batch.count = 0;
+  return failed;
+}
+
+uint64_t uring_socket_t::take_send_errors()
+{
+  uint64_t e(send_errors);
+  send_errors = 0;
+  return e;
+}
+
+#endif // HAS_URING_SOCKET
@@ -0,0 +1,142 @@
+#ifndef URING_SOCKET_H
+#define URING_SOCKET_H
+
+#include "batch-socket.h"
+#include <stdint.h>
+#include <vector>
+#if defined(LINUX) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// the backend needs the UAPI headers of linux 6.0 or newer (multishot
+// receive, provided buffer rings), other builds use batched I/O:
+#if defined(IORING_RECV_MULTISHOT)
+#define HAS_URING_SOCKET
+#endif
+
+#if defined(HAS_URING_SOCKET)
+
+// entries of the submission queue, at least TXBATCHSIZE plus the receive:
+#define URINGENTRIES 2048
+// number of receive buffers in the provided buffer ring (power of two):
+#define URINGBUFFERS 256
+// buffer group of the receive buffers:
+#define URINGBGID 0
+// maximum time in a wait() call, so that the relay can check for stop:
+#define URINGTIMEOUTMS 100
+
+/**
+ * io_uring backend of a relay socket (linux 6.0 or newer), driven
+ * through the raw system calls:
+ *
+ * - one multishot recvmsg fills a ring of registered receive buffers,
+ *   the datagrams are relayed in place from these buffers
+ * - the fan-out of a batch goes to the submission queue and is
+ *   submitted with the wait for the next datagrams, one io_uring_enter
+ *   call per wakeup for both directions
+ *
+ * A receive buffer is given back to the kernel only after all sends
+ * which reference it have completed. The sends of each receiver are
+ * linked, so that a datagram which would block cancels the later ones
+ * of its receiver; all of them go to the backlog in their order.
+ * Owned by one relay thread.
+ */
+class uring_socket_t {
+public:
+  /**
+   * Set up a ring on the socket, which stays owned by the caller.
+   * Throws ErrMsg if io_uring is not available.
+   */
+  uring_socket_t(ovbox_batch_socket_t& socket);
+  ~uring_socket_t();
+  /**
+   * Submit the queued sends and wait for datagrams, at most
+   * URINGTIMEOUTMS. The buffers of the previous call are released.
+   * Throws ErrMsg if the kernel does not support multishot receive.
+   * @return Number of received datagrams, see buf(), len() and from()
+   */
+  size_t wait();
+  char* buf(size_t k) const { return rx[k].buf; };
+  size_t len(size_t k) const { return rx[k].len; };
+  const endpoint_t& from(size_t k) const { return *rx[k].from; };
+  /**
+   * Queue the datagrams of the batch for the next wait() and clear the
+   * batch. Datagrams which would block go to the backlog of the batch.
+   * @return Number of datagrams which could not be queued
+   */
+  size_t send(tx_batch_t& batch);
+  /**
+   * @return Number of failed sends since the last call
+   */
+  uint64_t take_send_errors();
+
+private:
+  struct rx_t {
+    char* buf;
+    size_t len;
+    const endpoint_t* from;
+  };
+  struct send_slot_t {
+    struct msghdr hdr;
+    struct iovec iov;
+    endpoint_t to;
+    stage_device_id_t cid;
+    // result of the send:
+    int res;
+  };
+  struct io_uring_sqe* next_sqe();
+  void push_sqe();
+  unsigned int pending() const;
+  int enter(unsigned int wait);
+  void reap();
+  void complete_recv(const struct io_uring_cqe& cqe);
+  void complete_send(const struct io_uring_cqe& cqe);
+  void requeue_failed();
+  void provide(uint16_t bid);
+  void publish();
+  void arm_recv();
+  void cancel_recv();
+  void release();
+  ovbox_batch_socket_t& socket;
+  int ringfd;
+  // submission and completion queue, in one mapping:
+  void* rings;
+  size_t rings_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+  unsigned int* sq_head;
+  unsigned int* sq_tail;
+  unsigned int sq_mask;
+  unsigned int sq_entries;
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int cq_mask;
+  struct io_uring_cqe* cqes;
+  // provided buffer ring and its buffers:
+  struct io_uring_buf* br;
+  size_t br_size;
+  char* buffers;
+  size_t buffer_size;
+  uint16_t br_tail;
+  struct msghdr recv_hdr;
+  bool recv_armed;
+  int recv_error;
+  std::vector<rx_t> rx;
+  size_t rx_count;
+  // buffers to give back, of the previous and the current wakeup:
+  std::vector<uint16_t> used;
+  size_t num_used;
+  std::vector<send_slot_t> slots;
+  size_t num_slots;
+  // next datagram of the same receiver in the batch of send():
+  std::vector<size_t> chain;
+  unsigned int inflight;
+  send_queue_t* backlog;
+  uint64_t send_errors;
+};
+
+#endif // HAS_URING_SOCKET
+
+#endif // URING_SOCKET_H
@@ -29,6 +29,7 @@ const {
     CITY,
     LATITUDE,
     LONGITUDE,
+    OV_CAPTURE_DIR,
 } = process.env
 
 const PORT = parseInt(process.env.PORT, 10)
@@ -39,8 +40,33 @@ const OV_MIN_PORT = parseInt(process.env.OV_MIN_PORT, 10)
 const OV_MAX_PORT = parseInt(process.env.OV_MAX_PORT, 10)
 const JAMMER_MIN_PORT = parseInt(process.env.JAMMER_MIN_PORT, 10)
 const JAMMER_MAX_PORT = parseInt(process.env.JAMMER_MAX_PORT, 10)
+const JAMMER_BUFFER = process.env.JAMMER_BUFFER
+    ? parseInt(process.env.JAMMER_BUFFER, 10)
+    : undefined
+const JAMMER_WAIT = process.env.JAMMER_WAIT ? parseInt(process.env.JAMMER_WAIT, 10) : undefined
+const JAMMER_PREFILL = process.env.JAMMER_PREFILL
+    ? parseInt(process.env.JAMMER_PREFILL, 10)
+    : undefined
+const JAMMER_MIX_THREADS = process.env.JAMMER_MIX_THREADS
+    ? parseInt(process.env.JAMMER_MIX_THREADS, 10)
+    : undefined
 const CONNECTIONS_PER_CPU = parseInt(process.env.CONNECTIONS_PER_CPU, 10)
 const USE_IPV6 = process.env.USE_IPV6 ? process.env.USE_IPV6 === 'true' : false
+const OV_BATCHED_IO = process.env.OV_BATCHED_IO ? process.env.OV_BATCHED_IO === 'true' : false
+const OV_IO_URING = process.env.OV_IO_URING ? process.env.OV_IO_URING === 'true' : false
+const OV_SHARED_ENGINE = process.env.OV_SHARED_ENGINE
+    ? process.env.OV_SHARED_ENGINE === 'true'
+    : false
+const OV_SHARED_PORT = parseInt(process.env.OV_SHARED_PORT, 10) || 0
+const OV_ENGINE_THREADS = parseInt(process.env.OV_ENGINE_THREADS, 10) || 0
+const OV_LATENCY_INTERVAL = parseInt(process.env.OV_LATENCY_INTERVAL, 10) || 1000
+const OV_RELAY_WORKERS = parseInt(process.env.OV_RELAY_WORKERS, 10) || 1
+const OV_SERVER_DOWNMIX = process.env.OV_SERVER_DOWNMIX
+    ? process.env.OV_SERVER_DOWNMIX === 'true'
+    : false
+const OV_SEND_BUFFER = parseInt(process.env.OV_SEND_BUFFER, 10) || 0
+const OV_TXTIME = process.env.OV_TXTIME ? process.env.OV_TXTIME === 'true' : false
+const OV_TRUNK_KEY = parseInt(process.env.OV_TRUNK_KEY, 10) || 0
 const USE_SENTRY = process.env.USE_SENTRY ? process.env.USE_SENTRY === 'true' : false
 
 const MEDIASOUP_CONFIG = require('./config').default
@@ -51,8 +77,24 @@ export {
     RTC_MAX_PORT,
     OV_MIN_PORT,
     OV_MAX_PORT,
+    OV_BATCHED_IO,
+    OV_IO_URING,
+    OV_SHARED_ENGINE,
+    OV_SHARED_PORT,
+    OV_ENGINE_THREADS,
+    OV_LATENCY_INTERVAL,
+    OV_RELAY_WORKERS,
+    OV_SERVER_DOWNMIX,
+    OV_SEND_BUFFER,
+    OV_TXTIME,
+    OV_TRUNK_KEY,
+    OV_CAPTURE_DIR,
     JAMMER_MIN_PORT,
     JAMMER_MAX_PORT,
+    JAMMER_BUFFER,
+    JAMMER_WAIT,
+    JAMMER_PREFILL,
+    JAMMER_MIX_THREADS,
     API_KEY,
     IP_V4,
     IP_V6,
@@ -1,11 +1,42 @@
 import { EventEmitter } from 'events'
 
+interface JammerServerOptions {
+    /**
+     * Capacity of the jitter buffer of each client, in blocks
+     */
+    buffer?: number
+    /**
+     * Maximum time (ms) the mixer waits for a late client in each period
+     */
+    wait?: number
+    /**
+     * Blocks buffered before a client is mixed, again after each underrun
+     */
+    prefill?: number
+    /**
+     * Threads which mix and encode the per client mixes besides the mixer threads,
+     * one per core by default. The threads are shared by all servers of the process,
+     * the first server created while there are none sets their number
+     */
+    mixThreads?: number
+}
+
+interface JammerServerMetrics {
+    /**
+     * Mixes which missed their period and were replaced by the previous mix of
+     * the client, since the start
+     */
+    missedMixes: number
+}
+
 declare class JammerServer extends EventEmitter.EventEmitter {
-    constructor(cryptoKey: string, port: number, stageId: string)
+    constructor(cryptoKey: string, port: number, stageId: string, options?: JammerServerOptions)
 
     on(event: 'ready', listener: (port: number) => void): this
 
     stop: () => void
+
+    getMetrics: () => JammerServerMetrics | null
 }
 
 export = JammerServer
@@ -4,12 +4,48 @@ import bindings from 'bindings'
 
 import { inherits } from 'util'
 
+export interface JammerServerOptions {
+    /**
+     * Capacity of the jitter buffer of each client, in blocks
+     */
+    buffer?: number
+    /**
+     * Maximum time (ms) the mixer waits for a late client in each period
+     */
+    wait?: number
+    /**
+     * Blocks buffered before a client is mixed, again after each underrun
+     */
+    prefill?: number
+    /**
+     * Threads which mix and encode the per client mixes besides the mixer threads,
+     * one per core by default. The threads are shared by all servers of the process,
+     * the first server created while there are none sets their number
+     */
+    mixThreads?: number
+}
+
+export interface JammerServerMetrics {
+    /**
+     * Mixes which missed their period and were replaced by the previous mix of
+     * the client, since the start
+     */
+    missedMixes: number
+}
+
 export interface JammerServer extends EventEmitter.EventEmitter {
-    new (cryptoKey: string, port: number, stageId: string): JammerServer
+    new (
+        cryptoKey: string,
+        port: number,
+        stageId: string,
+        options?: JammerServerOptions
+    ): JammerServer
 
     on(event: 'ready', listener: (port: number) => void): this
 
     stop: () => void
+
+    getMetrics: () => JammerServerMetrics | null
 }
 
 const NativeJammerServer: JammerServer = bindings('jammerserver').JammerServerWrapper
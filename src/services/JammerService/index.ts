@@ -1,3 +1,4 @@
+import { randomBytes } from 'crypto'
 import ITeckosClient from 'teckos-client/dist/ITeckosClient'
 import {
     ClientRouterEvents,
@@ -9,11 +10,16 @@ import {
     Stage,
 } from '@digitalstage/api-types'
 import NativeJammerServer, { JammerServer } from './JammerServer'
-import { JAMMER_MAX_PORT, JAMMER_MIN_PORT } from '../../env'
+import {
+    JAMMER_BUFFER,
+    JAMMER_MAX_PORT,
+    JAMMER_MIN_PORT,
+    JAMMER_MIX_THREADS,
+    JAMMER_PREFILL,
+    JAMMER_WAIT,
+} from '../../env'
 import logger from '../../logger'
 
-const TIMEOUT: number = 2000
-
 const { info, warn, error } = logger('jammer')
 
 class JammerService {
@@ -37,8 +43,6 @@ class JammerService {
         [port: number]: string
     } = {}
 
-    private delay: number = 0
-
     constructor(serverConnection: ITeckosClient, router: Router, ipv4: string, ipv6?: string) {
         this.serverConnection = serverConnection
         this.router = router
@@ -70,16 +74,14 @@ class JammerService {
             if (port) {
                 this.ports[port] = stage._id
                 try {
-                    const key: string = 'blablabla'
+                    // The clients of the stage sign their audio with this key
+                    const key: string = randomBytes(16).toString('hex')
                     const jammerServer = await this.startJammerServer(key, port, stage._id)
                     this.managedStages[stage._id] = {
                         stage,
                         kind: 'audio',
                         jammerServer,
                     }
-                    jammerServer.on('ready', (listenPort) => {
-                        info(`Jammer is ready at port ${listenPort}`)
-                    })
                     info(`Manging stage ${stage._id} '${stage.name}' ${this.ipv4}:${port}`)
                     this.serverConnection.emit(ClientRouterEvents.StageServed, {
                         kind: 'audio',
@@ -102,22 +104,26 @@ class JammerService {
         }
     }
 
+    /**
+     * Resolves when the threads of the new server are running
+     */
     public startJammerServer = (
         key: string,
         port: number,
         stageId: string
-    ): Promise<JammerServer> => {
-        // TODO: Create secret key
-        const promise = new Promise<JammerServer>((resolve) => {
-            const timeout = setTimeout(() => {
-                clearTimeout(timeout)
-                resolve(new NativeJammerServer(key, port, stageId))
-                this.delay -= TIMEOUT
-            }, this.delay)
+    ): Promise<JammerServer> =>
+        new Promise<JammerServer>((resolve) => {
+            const jammerServer = new NativeJammerServer(key, port, stageId, {
+                buffer: JAMMER_BUFFER,
+                wait: JAMMER_WAIT,
+                prefill: JAMMER_PREFILL,
+                mixThreads: JAMMER_MIX_THREADS,
+            })
+            jammerServer.once('ready', (listenPort) => {
+                info(`Jammer is ready at port ${listenPort}`)
+                resolve(jammerServer)
+            })
         })
-        this.delay += TIMEOUT
-        return promise
-    }
 
     private unManageStage = (payload: ServerRouterPayloads.UnServeStage) => {
         const { stageId, type, kind } = payload
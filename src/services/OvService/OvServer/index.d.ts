@@ -1,7 +1,130 @@
 import { EventEmitter } from 'events'
 
+interface OvServerOptions {
+    /**
+     * Relay with recvmmsg/sendmmsg instead of one syscall per datagram
+     */
+    batchedIo?: boolean
+    /**
+     * Relay with io_uring and multishot receive (linux 6.0), falls back to
+     * batchedIo if not available
+     */
+    ioUring?: boolean
+    /**
+     * Deliver latency reports as one latencyMatrix event per interval (ms)
+     * instead of one latency event per report
+     */
+    latencyInterval?: number
+    /**
+     * Number of relay threads sharing the stage port (SO_REUSEPORT, linux only)
+     */
+    relayWorkers?: number
+    /**
+     * Mix the audio of all senders for downmix-only devices on the server
+     */
+    serverDownmix?: boolean
+    /**
+     * Kernel send buffer of the stage sockets in bytes, 0 for the system default
+     */
+    sendBuffer?: number
+    /**
+     * Pace control messages with SO_TXTIME (linux, needs the fq qdisc). Hosted
+     * stages (OvStageEngine) do not sleep, so without it they send each burst
+     * of participant lists at once
+     */
+    txtime?: boolean
+    /**
+     * Record all received datagrams to <captureDir>/<stageId>-<port>.ovcap,
+     * for offline replay with ov-replay
+     */
+    captureDir?: string
+    /**
+     * Size of one capture file in bytes before it is rotated (64 MiB),
+     * 0 never rotates
+     */
+    captureFileSize?: number
+    /**
+     * Number of capture files kept, including the current one (4)
+     */
+    captureFiles?: number
+    /**
+     * Exchange participant lists with the trunks under this key (larger than
+     * 0xfffffff), see addTrunk
+     */
+    trunkKey?: number
+}
+
+interface OvStageMetrics {
+    stageId: string
+    port: number
+    packetsIn: number
+    bytesIn: number
+    packetsOut: number
+    bytesOut: number
+    seqErrors: number
+    /**
+     * Packets lost between the senders and the relay, seqErrors are reported
+     * by the receivers
+     */
+    lost: number
+    /**
+     * Datagrams which failed authentication
+     */
+    invalid: number
+    sendErrors: number
+    mixDropped: number
+    /**
+     * Datagrams dropped from the backlog of receivers which could not keep up
+     */
+    sendQueueDropped: number
+    /**
+     * Audio datagrams received from and sent to trunks
+     */
+    trunkIn: number
+    trunkOut: number
+    latencyReportsDropped: number
+    /**
+     * Queue depths, sampled once per ping period
+     */
+    latencyQueueDepth: number
+    mixQueueDepth: number
+    /**
+     * Scheduling latency of the process over the last 10 seconds, in ms,
+     * polling at least every 10 seconds covers every wakeup
+     */
+    schedLatency: {
+        p50: number
+        p99: number
+        p999: number
+        max: number
+    }
+    /**
+     * Endpoints with any traffic since the stage was started
+     */
+    endpoints: {
+        ovStageDeviceId: number
+        packetsIn: number
+        bytesIn: number
+        packetsOut: number
+        bytesOut: number
+        seqErrors: number
+        /**
+         * Stream of the endpoint as received by the relay: lost, late and
+         * duplicate packets, loss events (jumps in the sequence), and the
+         * interarrival jitter in ms. The arrival time is taken once per
+         * receive batch, so the jitter includes the batching delay of the
+         * relay
+         */
+        lost: number
+        reordered: number
+        duplicates: number
+        gaps: number
+        jitter: number
+    }[]
+}
+
 declare class OvServer extends EventEmitter.EventEmitter {
-    constructor(port: number, prio: number, stageId: string)
+    constructor(port: number, prio: number, stageId: string, options?: OvServerOptions)
 
     on(event: 'ready', listener: (port: number) => void): this
 
@@ -32,6 +155,18 @@ declare class OvServer extends EventEmitter.EventEmitter {
         }) => void
     ): this
 
+    on(
+        event: 'latencyMatrix',
+        listener: (
+            stageId: string,
+            /**
+             * Rows of six values per device pair:
+             * src, dest, latency, jitter, received, lost
+             */
+            matrix: Float64Array
+        ) => void
+    ): this
+
     on(
         event: 'status',
         listener: (report: {
@@ -39,11 +174,31 @@ declare class OvServer extends EventEmitter.EventEmitter {
             pin: number
             serverjitter: number
             port: number
+            jitterP50: number
+            jitterP99: number
+            jitterP999: number
         }) => void
     ): this
 
     on(event: 'disconnect', listener: (id: number) => void): this
 
+    /**
+     * Emitted after stop() when all threads are joined and the port is free
+     */
+    on(event: 'closed', listener: (port: number) => void): this
+
+    /**
+     * Counters of the stage since it was started, cheap to poll
+     */
+    getMetrics: () => OvStageMetrics | null
+
+    /**
+     * Relay the stage once to the relay of the same stage in another region,
+     * "host:port", which shares its participants (needs trunkKey). Lists are
+     * only taken from added trunks, so the other relay has to add this one
+     */
+    addTrunk: (address: string) => void
+
     stop: () => void
 }
 
@@ -0,0 +1,154 @@
+import { EventEmitter } from 'events'
+
+interface OvStageMetrics {
+    stageId: string
+    port: number
+    packetsIn: number
+    bytesIn: number
+    packetsOut: number
+    bytesOut: number
+    seqErrors: number
+    /**
+     * Packets lost between the senders and the relay, seqErrors are reported
+     * by the receivers
+     */
+    lost: number
+    /**
+     * Datagrams which failed authentication
+     */
+    invalid: number
+    sendErrors: number
+    mixDropped: number
+    /**
+     * Datagrams dropped from the backlog of receivers which could not keep up
+     */
+    sendQueueDropped: number
+    /**
+     * Audio datagrams received from and sent to trunks
+     */
+    trunkIn: number
+    trunkOut: number
+    latencyReportsDropped: number
+    /**
+     * Queue depths, sampled once per ping period
+     */
+    latencyQueueDepth: number
+    mixQueueDepth: number
+    /**
+     * Scheduling latency of the process over the last 10 seconds, in ms,
+     * polling at least every 10 seconds covers every wakeup
+     */
+    schedLatency: {
+        p50: number
+        p99: number
+        p999: number
+        max: number
+    }
+    /**
+     * Endpoints with any traffic since the stage was started
+     */
+    endpoints: {
+        ovStageDeviceId: number
+        packetsIn: number
+        bytesIn: number
+        packetsOut: number
+        bytesOut: number
+        seqErrors: number
+        /**
+         * Stream of the endpoint as received by the relay: lost, late and
+         * duplicate packets, loss events (jumps in the sequence), and the
+         * interarrival jitter in ms. The arrival time is taken once per
+         * receive batch, so the jitter includes the batching delay of the
+         * relay
+         */
+        lost: number
+        reordered: number
+        duplicates: number
+        gaps: number
+        jitter: number
+    }[]
+}
+
+declare class OvStageEngine extends EventEmitter.EventEmitter {
+    constructor(
+        prio: number,
+        threads?: number,
+        options?: {
+            latencyInterval?: number
+            serverDownmix?: boolean
+            sendBuffer?: number
+            txtime?: boolean
+            captureDir?: string
+            captureFileSize?: number
+            captureFiles?: number
+            /**
+             * Serve all stages on this UDP port, the datagrams are passed
+             * on by pin
+             */
+            sharedPort?: number
+            /**
+             * Accept trunks from other relays of a stage which present this
+             * key, not with sharedPort
+             */
+            trunkKey?: number
+        }
+    )
+
+    on(event: 'ready', listener: (port: number, stageId: string) => void): this
+
+    on(
+        event: 'latency',
+        listener: (report: {
+            stageId: string
+            srcOvStageDevceId: number
+            destOvStageDeviceId: number
+            latency: number
+            jitter: number
+        }) => void
+    ): this
+
+    on(
+        event: 'latencyMatrix',
+        listener: (
+            stageId: string,
+            /**
+             * Rows of six values per device pair:
+             * src, dest, latency, jitter, received, lost
+             */
+            matrix: Float64Array
+        ) => void
+    ): this
+
+    on(
+        event: 'status',
+        listener: (report: {
+            stageId: string
+            pin: number
+            serverjitter: number
+            port: number
+            jitterP50: number
+            jitterP99: number
+            jitterP999: number
+        }) => void
+    ): this
+
+    on(event: 'disconnect', listener: (id: number, stageId: string) => void): this
+
+    /**
+     * Emitted after removeStage() when the port of the stage is free
+     */
+    on(event: 'closed', listener: (port: number, stageId: string) => void): this
+
+    addStage: (port: number, stageId: string) => number
+
+    removeStage: (stageId: string) => boolean
+
+    /**
+     * Counters of all hosted stages, cheap to poll
+     */
+    getMetrics: () => OvStageMetrics[]
+
+    stop: () => void
+}
+
+export = OvStageEngine
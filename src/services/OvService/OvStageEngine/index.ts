@@ -0,0 +1,76 @@
+/// <reference path='./index.d.ts' />
+import { EventEmitter } from 'events'
+import bindings from 'bindings'
+
+import { inherits } from 'util'
+import { OvServerOptions, OvStageMetrics } from '../OvServer'
+
+/**
+ * Hosts many ov stages in a few shared event loop threads,
+ * only available on linux
+ */
+export interface OvStageEngine extends EventEmitter.EventEmitter {
+    new (prio: number, threads?: number, options?: OvServerOptions): OvStageEngine
+
+    on(event: 'ready', listener: (port: number, stageId: string) => void): this
+
+    on(
+        event: 'latency',
+        listener: (report: {
+            stageId: string
+            srcOvStageDevceId: number
+            destOvStageDeviceId: number
+            latency: number
+            jitter: number
+        }) => void
+    ): this
+
+    on(
+        event: 'latencyMatrix',
+        listener: (
+            stageId: string,
+            /**
+             * Rows of six values per device pair:
+             * src, dest, latency, jitter, received, lost
+             */
+            matrix: Float64Array
+        ) => void
+    ): this
+
+    on(
+        event: 'status',
+        listener: (report: {
+            stageId: string
+            pin: number
+            serverjitter: number
+            port: number
+            jitterP50: number
+            jitterP99: number
+            jitterP999: number
+        }) => void
+    ): this
+
+    on(event: 'disconnect', listener: (id: number, stageId: string) => void): this
+
+    /**
+     * Emitted after removeStage() when the port of the stage is free
+     */
+    on(event: 'closed', listener: (port: number, stageId: string) => void): this
+
+    addStage: (port: number, stageId: string) => number
+
+    removeStage: (stageId: string) => boolean
+
+    /**
+     * Counters of all hosted stages, cheap to poll
+     */
+    getMetrics: () => OvStageMetrics[]
+
+    stop: () => void
+}
+
+const NativeOvStageEngine: OvStageEngine = bindings('ovserver').OvStageEngineWrapper
+
+if (NativeOvStageEngine) inherits(NativeOvStageEngine, EventEmitter)
+
+export default NativeOvStageEngine
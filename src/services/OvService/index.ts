@@ -9,11 +9,25 @@ import {
     Stage,
 } from '@digitalstage/api-types'
 import NativeOvServer, { OvServer } from './OvServer'
-import { OV_MAX_PORT, OV_MIN_PORT } from '../../env'
+import NativeOvStageEngine, { OvStageEngine } from './OvStageEngine'
+import {
+    OV_BATCHED_IO,
+    OV_CAPTURE_DIR,
+    OV_ENGINE_THREADS,
+    OV_IO_URING,
+    OV_LATENCY_INTERVAL,
+    OV_MAX_PORT,
+    OV_MIN_PORT,
+    OV_RELAY_WORKERS,
+    OV_SEND_BUFFER,
+    OV_SERVER_DOWNMIX,
+    OV_SHARED_ENGINE,
+    OV_SHARED_PORT,
+    OV_TRUNK_KEY,
+    OV_TXTIME,
+} from '../../env'
 import logger from '../../logger'
 
-const TIMEOUT: number = 2000
-
 const { info, warn, error } = logger('ov')
 
 class OvService {
@@ -29,7 +43,7 @@ class OvService {
         [stageId: string]: {
             stage: Stage
             kind: 'audio' | 'video' | 'both'
-            ovServer: OvServer
+            stop: () => void
         }
     } = {}
 
@@ -37,7 +51,7 @@ class OvService {
         [port: number]: string
     } = {}
 
-    private delay: number = 0
+    private engine?: OvStageEngine
 
     constructor(serverConnection: ITeckosClient, router: Router, ipv4: string, ipv6?: string) {
         this.serverConnection = serverConnection
@@ -58,44 +72,121 @@ class OvService {
 
     private unManageAllStages = () => {
         Object.keys(this.managedStages).forEach((stageId) => {
-            this.managedStages[stageId].ovServer.stop()
+            this.managedStages[stageId].stop()
         })
         this.managedStages = {}
+        if (this.engine) {
+            this.engine.stop()
+            this.engine = undefined
+        }
+    }
+
+    private handleStatus = (status: {
+        stageId: string
+        pin: number
+        serverjitter: number
+        port: number
+    }) => {
+        this.serverConnection.emit(ClientRouterEvents.ChangeStage, {
+            _id: status.stageId,
+            ovJitter: status.serverjitter,
+            ovPin: status.pin,
+        } as ClientRouterPayloads.ChangeStage<OvStage>)
+    }
+
+    private handleLatency = (report: {
+        stageId: string
+        srcOvStageDevceId: number
+        destOvStageDeviceId: number
+        latency: number
+        jitter: number
+    }) => {
+        this.serverConnection.emit(ClientRouterEvents.ChangeStage, {
+            _id: report.stageId,
+            latency: {
+                [report.srcOvStageDevceId]: {
+                    [report.destOvStageDeviceId]: {
+                        latency: report.latency,
+                        jitter: report.jitter,
+                    },
+                },
+            },
+        } as ClientRouterPayloads.ChangeStage<OvStage>)
+    }
+
+    private handleLatencyMatrix = (stageId: string, matrix: Float64Array) => {
+        const latency: {
+            [src: number]: { [dest: number]: { latency: number; jitter: number } }
+        } = {}
+        for (let i = 0; i + 5 < matrix.length; i += 6) {
+            const src = matrix[i]
+            const dest = matrix[i + 1]
+            if (!latency[src]) latency[src] = {}
+            latency[src][dest] = {
+                latency: matrix[i + 2],
+                jitter: matrix[i + 3],
+            }
+        }
+        this.serverConnection.emit(ClientRouterEvents.ChangeStage, {
+            _id: stageId,
+            latency,
+        } as ClientRouterPayloads.ChangeStage<OvStage>)
+    }
+
+    private handleClosed = (port: number) => {
+        // the port can be reused as soon as the native server released it
+        delete this.ports[port]
+    }
+
+    private getEngine = (): OvStageEngine => {
+        if (!this.engine) {
+            this.engine = new NativeOvStageEngine(50, OV_ENGINE_THREADS, {
+                latencyInterval: OV_LATENCY_INTERVAL,
+                serverDownmix: OV_SERVER_DOWNMIX,
+                sendBuffer: OV_SEND_BUFFER,
+                txtime: OV_TXTIME,
+                captureDir: OV_CAPTURE_DIR,
+                sharedPort: OV_SHARED_PORT,
+                // trunks are not available on the shared port
+                trunkKey: OV_SHARED_PORT ? 0 : OV_TRUNK_KEY,
+            })
+            this.engine.on('status', this.handleStatus)
+            this.engine.on('latency', this.handleLatency)
+            this.engine.on('latencyMatrix', this.handleLatencyMatrix)
+            this.engine.on('closed', this.handleClosed)
+        }
+        return this.engine
+    }
+
+    private serveStage = async (port: number, stageId: string): Promise<() => void> => {
+        if ((OV_SHARED_ENGINE || OV_SHARED_PORT) && NativeOvStageEngine) {
+            const engine = this.getEngine()
+            engine.addStage(port, stageId)
+            return () => engine.removeStage(stageId)
+        }
+        const ovServer = await this.startOvServer(port, 50, stageId)
+        ovServer.on('status', this.handleStatus)
+        ovServer.on('latency', this.handleLatency)
+        ovServer.on('latencyMatrix', this.handleLatencyMatrix)
+        ovServer.on('closed', this.handleClosed)
+        return () => ovServer.stop()
     }
 
     private manageStage = async (payload: ServerRouterPayloads.ServeStage) => {
         const { stage } = payload
         if (stage.audioType === 'ov' && !this.managedStages[stage._id]) {
-            const port: number | null = this.getFreePort()
+            // with a shared port all stages are told the same port and told
+            // apart by their pin
+            const port: number | null = OV_SHARED_PORT || this.getFreePort()
             if (port) {
-                this.ports[port] = stage._id
+                if (!OV_SHARED_PORT) this.ports[port] = stage._id
                 try {
-                    const ovServer = await this.startOvServer(port, 50, stage._id)
+                    const stop = await this.serveStage(port, stage._id)
                     this.managedStages[stage._id] = {
                         stage,
                         kind: 'audio',
-                        ovServer,
+                        stop,
                     }
-                    ovServer.on('status', (status) => {
-                        this.serverConnection.emit(ClientRouterEvents.ChangeStage, {
-                            _id: status.stageId,
-                            ovJitter: status.serverjitter,
-                            ovPin: status.pin,
-                        } as ClientRouterPayloads.ChangeStage<OvStage>)
-                    })
-                    ovServer.on('latency', (report) => {
-                        this.serverConnection.emit(ClientRouterEvents.ChangeStage, {
-                            _id: report.stageId,
-                            latency: {
-                                [report.srcOvStageDevceId]: {
-                                    [report.destOvStageDeviceId]: {
-                                        latency: report.latency,
-                                        jitter: report.jitter,
-                                    },
-                                },
-                            },
-                        } as ClientRouterPayloads.ChangeStage<OvStage>)
-                    })
                     info(`Manging stage ${stage._id} '${stage.name}' ${this.ipv4}:${port}`)
                     this.serverConnection.emit(ClientRouterEvents.StageServed, {
                         kind: 'audio',
@@ -117,17 +208,24 @@ class OvService {
         }
     }
 
-    public startOvServer = (port: number, prio: number, stageId: string): Promise<OvServer> => {
-        const promise = new Promise<OvServer>((resolve) => {
-            const timeout = setTimeout(() => {
-                clearTimeout(timeout)
-                resolve(new NativeOvServer(port, 50, stageId))
-                this.delay -= TIMEOUT
-            }, this.delay)
+    /**
+     * Resolves when the relay threads of the new stage are running
+     */
+    public startOvServer = (port: number, prio: number, stageId: string): Promise<OvServer> =>
+        new Promise<OvServer>((resolve) => {
+            const ovServer = new NativeOvServer(port, prio, stageId, {
+                batchedIo: OV_BATCHED_IO,
+                ioUring: OV_IO_URING,
+                latencyInterval: OV_LATENCY_INTERVAL,
+                relayWorkers: OV_RELAY_WORKERS,
+                serverDownmix: OV_SERVER_DOWNMIX,
+                sendBuffer: OV_SEND_BUFFER,
+                txtime: OV_TXTIME,
+                captureDir: OV_CAPTURE_DIR,
+                trunkKey: OV_TRUNK_KEY,
+            })
+            ovServer.once('ready', () => resolve(ovServer))
         })
-        this.delay += TIMEOUT
-        return promise
-    }
 
     private unManageStage = (payload: ServerRouterPayloads.UnServeStage) => {
         const { stageId, type, kind } = payload
@@ -135,7 +233,7 @@ class OvService {
             const managedStage = this.managedStages[stageId]
             if (managedStage) {
                 info(`Stop serving '${managedStage.stage.name}'`)
-                managedStage.ovServer.stop()
+                managedStage.stop()
                 delete this.managedStages[stageId]
                 this.serverConnection.emit(ClientRouterEvents.StageUnServed, {
                     type,